@@ -0,0 +1,14 @@
+# - Try to find the LZ4 compression library
+# Once done this will define
+#
+#  LZ4_FOUND - system has LZ4 including its frame API
+#  LZ4_INCLUDE_DIRS - the LZ4 include directory
+#  LZ4_LIBRARIES - the libraries needed to use LZ4
+
+find_path(LZ4_INCLUDE_DIRS "lz4frame.h")
+find_library(LZ4_LIBRARIES NAMES lz4)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(LZ4 REQUIRED_VARS LZ4_LIBRARIES LZ4_INCLUDE_DIRS)
+
+mark_as_advanced(LZ4_INCLUDE_DIRS LZ4_LIBRARIES)
@@ -0,0 +1,24 @@
+# - Try to find the zstd compression library
+# Once done this will define
+#
+#  ZSTD_FOUND - system has zstd
+#  ZSTD_INCLUDE_DIRS - the zstd include directory
+#  ZSTD_LIBRARIES - the libraries needed to use zstd
+#
+# The streaming API we use (ZSTD_compressStream2) needs at least zstd 1.4.0.
+
+find_path(ZSTD_INCLUDE_DIRS "zstd.h")
+find_library(ZSTD_LIBRARIES NAMES zstd)
+
+if (ZSTD_INCLUDE_DIRS AND EXISTS "${ZSTD_INCLUDE_DIRS}/zstd.h")
+    file(STRINGS "${ZSTD_INCLUDE_DIRS}/zstd.h" _zstd_version_lines REGEX "^#define ZSTD_VERSION_(MAJOR|MINOR|RELEASE) ")
+    string(REGEX REPLACE ".*ZSTD_VERSION_MAJOR +([0-9]+).*" "\\1" _zstd_major "${_zstd_version_lines}")
+    string(REGEX REPLACE ".*ZSTD_VERSION_MINOR +([0-9]+).*" "\\1" _zstd_minor "${_zstd_version_lines}")
+    string(REGEX REPLACE ".*ZSTD_VERSION_RELEASE +([0-9]+).*" "\\1" _zstd_release "${_zstd_version_lines}")
+    set(ZSTD_VERSION "${_zstd_major}.${_zstd_minor}.${_zstd_release}")
+endif()
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(Zstd REQUIRED_VARS ZSTD_LIBRARIES ZSTD_INCLUDE_DIRS VERSION_VAR ZSTD_VERSION)
+
+mark_as_advanced(ZSTD_INCLUDE_DIRS ZSTD_LIBRARIES)
@@ -51,6 +51,7 @@ public:
     inline int totalBuffers() const { return _totalBuffers; }
 
     bool buffer(BufferId bufferId, const MessageList &messages); //! returns false if it was the last missing backlogpart
+    inline void bufferPart(const MessageList &messages) { _bufferedMessages << messages; } //! more parts of the buffer follow
 
     virtual void requestBacklog(const BufferIdList &bufferIds) = 0;
     virtual inline void requestInitialBacklog() { requestBacklog(allBufferIds()); }
@@ -168,6 +168,7 @@ void Client::init()
     coreAccountModel()->load();
 
     connect(coreConnection(), SIGNAL(stateChanged(CoreConnection::ConnectionState)), SLOT(connectionStateChanged(CoreConnection::ConnectionState)));
+    connect(coreConnection(), SIGNAL(sessionDiscarded()), SLOT(coreSessionDiscarded()));
     coreConnection()->init();
 }
 
@@ -363,10 +364,23 @@ void Client::connectionStateChanged(CoreConnection::ConnectionState state)
 {
     switch (state) {
     case CoreConnection::Disconnected:
-        setDisconnectedFromCore();
+        // a suspended session keeps its state, cf. coreSessionDiscarded()
+        if (coreConnection()->isSuspended()) {
+            _connected = false;
+            emit coreConnectionStateChanged(false);
+        }
+        else {
+            setDisconnectedFromCore();
+        }
         break;
     case CoreConnection::Synchronized:
-        setSyncedToCore();
+        if (coreConnection()->wasResumed()) {
+            _connected = true;
+            emit coreConnectionStateChanged(true);
+        }
+        else {
+            setSyncedToCore();
+        }
         break;
     default:
         break;
@@ -444,7 +458,7 @@ void Client::requestInitialBacklog()
 
 void Client::disconnectFromCore()
 {
-    if (!coreConnection()->isConnected())
+    if (!coreConnection()->isConnected() && !coreConnection()->isSuspended())
         return;
 
     coreConnection()->disconnectFromCore();
@@ -523,6 +537,16 @@ void Client::setDisconnectedFromCore()
 }
 
 
+void Client::coreSessionDiscarded()
+{
+    // we may already be connected again, and the core features are those of the new connection
+    Quassel::Features features = _coreFeatures;
+    setDisconnectedFromCore();
+    if (coreConnection()->state() != CoreConnection::Disconnected)
+        _coreFeatures = features;
+}
+
+
 /*** ***/
 
 void Client::networkDestroyed()
@@ -209,6 +209,7 @@ public slots:
 private slots:
     void setSyncedToCore();
     void setDisconnectedFromCore();
+    void coreSessionDiscarded();
     void connectionStateChanged(CoreConnection::ConnectionState);
 
     void recvMessage(const Message &message);
@@ -46,12 +46,20 @@ ClientAuthHandler::ClientAuthHandler(CoreAccount account, QObject *parent)
     _account(account),
     _probing(false),
     _legacy(false),
-    _connectionFeatures(0)
+    _connectionFeatures(0),
+    _resumeSequence(0)
 {
 
 }
 
 
+void ClientAuthHandler::setResumeRequest(const QByteArray &token, quint64 sequence)
+{
+    _resumeToken = token;
+    _resumeSequence = sequence;
+}
+
+
 void ClientAuthHandler::connectToCore()
 {
     CoreAccountSettings s;
@@ -180,7 +188,7 @@ void ClientAuthHandler::onSocketConnected()
         if (_account.useSsl())
             magic |= Protocol::Encryption;
 #endif
-        magic |= Protocol::Compression;
+        magic |= supportedCompressionFeatures();
 
         stream << magic;
 
@@ -202,7 +210,7 @@ void ClientAuthHandler::onSocketConnected()
 
     qDebug() << "Legacy core detected, switching to compatibility mode";
 
-    RemotePeer *peer = PeerFactory::createPeer(PeerFactory::ProtoDescriptor(Protocol::LegacyProtocol, 0), this, socket(), Compressor::NoCompression, this);
+    RemotePeer *peer = PeerFactory::createPeer(PeerFactory::ProtoDescriptor(Protocol::LegacyProtocol, 0), this, socket(), Compressor::NoCompression, Compressor::Deflate, this);
     // Only needed for the legacy peer, as all others check the protocol version before instantiation
     connect(peer, SIGNAL(protocolVersionMismatch(int,int)), SLOT(onProtocolVersionMismatch(int,int)));
 
@@ -229,13 +237,8 @@ void ClientAuthHandler::onReadyRead()
     quint16 protoFeatures = static_cast<quint16>(reply>>8 & 0xffff);
     _connectionFeatures = static_cast<quint8>(reply>>24);
 
-    Compressor::CompressionLevel level;
-    if (_connectionFeatures & Protocol::Compression)
-        level = Compressor::BestCompression;
-    else
-        level = Compressor::NoCompression;
-
-    RemotePeer *peer = PeerFactory::createPeer(PeerFactory::ProtoDescriptor(type, protoFeatures), this, socket(), level, this);
+    RemotePeer *peer = PeerFactory::createPeer(PeerFactory::ProtoDescriptor(type, protoFeatures), this, socket(), compressionLevel(_connectionFeatures),
+                                               compressionMethod(_connectionFeatures), this);
     if (!peer) {
         qWarning() << "No valid protocol supported for this core!";
         emit errorPopup(tr("<b>Incompatible Quassel Core!</b><br>"
@@ -288,7 +291,7 @@ void ClientAuthHandler::startRegistration()
     useSsl = _account.useSsl();
 #endif
 
-    _peer->dispatch(RegisterClient(Quassel::buildInfo().fancyVersionString, Quassel::buildInfo().buildDate, useSsl));
+    _peer->dispatch(RegisterClient(Quassel::buildInfo().fancyVersionString, Quassel::buildInfo().buildDate, useSsl, Quassel::features()));
 }
 
 
@@ -305,6 +308,7 @@ void ClientAuthHandler::handle(const ClientRegistered &msg)
     _backendInfo = msg.backendInfo;
 
     Client::setCoreFeatures(static_cast<Quassel::Features>(msg.coreFeatures));
+    _peer->setFeatures(static_cast<Quassel::Features>(msg.coreFeatures));
 
     // The legacy protocol enables SSL at this point
     if(_legacy && _account.useSsl())
@@ -369,7 +373,11 @@ void ClientAuthHandler::login(const QString &previousError)
         }
     }
 
-    _peer->dispatch(Login(_account.user(), _account.password()));
+    Login loginMsg(_account.user(), _account.password());
+    loginMsg.resumable = true;
+    loginMsg.resumeToken = _resumeToken;
+    loginMsg.resumeSequence = _resumeSequence;
+    _peer->dispatch(loginMsg);
 }
 
 
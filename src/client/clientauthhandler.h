@@ -42,6 +42,9 @@ public:
         Latest=Sha2_512
     };
 
+    //! Ask the core to resume the session identified by token, the last message we got from it being sequence
+    void setResumeRequest(const QByteArray &token, quint64 sequence);
+
 public slots:
     void connectToCore();
 
@@ -117,6 +120,8 @@ private:
     bool _probing;
     bool _legacy;
     quint8 _connectionFeatures;
+    QByteArray _resumeToken;
+    quint64 _resumeSequence;
 };
 
 #endif
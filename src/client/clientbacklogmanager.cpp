@@ -51,12 +51,7 @@ void ClientBacklogManager::receiveBacklog(BufferId bufferId, MsgId first, MsgId
 
     emit messagesReceived(bufferId, msgs.count());
 
-    MessageList msglist;
-    foreach(QVariant v, msgs) {
-        Message msg = v.value<Message>();
-        msg.setFlags(msg.flags() | Message::Backlog);
-        msglist << msg;
-    }
+    MessageList msglist = backlogMessages(msgs);
 
     if (isBuffering()) {
         bool lastPart = !_requester->buffer(bufferId, msglist);
@@ -72,18 +67,59 @@ void ClientBacklogManager::receiveBacklog(BufferId bufferId, MsgId first, MsgId
 }
 
 
+void ClientBacklogManager::receiveBacklogChunk(PeerPtr, BufferId bufferId, MsgId first, MsgId last, int limit, int additional, QVariantList msgs)
+{
+    Q_UNUSED(first) Q_UNUSED(last) Q_UNUSED(limit) Q_UNUSED(additional)
+
+    emit messagesReceived(bufferId, msgs.count());
+
+    // the buffer is only complete with the final receiveBacklog()
+    MessageList msglist = backlogMessages(msgs);
+    if (isBuffering())
+        _requester->bufferPart(msglist);
+    else
+        dispatchMessages(msglist);
+}
+
+
 void ClientBacklogManager::receiveBacklogAll(MsgId first, MsgId last, int limit, int additional, QVariantList msgs)
 {
     Q_UNUSED(first) Q_UNUSED(last) Q_UNUSED(limit) Q_UNUSED(additional)
 
+    dispatchMessages(backlogMessages(msgs));
+}
+
+
+void ClientBacklogManager::receiveBacklogAllChunk(PeerPtr, MsgId first, MsgId last, int limit, int additional, QVariantList msgs)
+{
+    receiveBacklogAll(first, last, limit, additional, msgs);
+}
+
+
+void ClientBacklogManager::receiveBacklogSearch(QString query, BufferId bufferId, int offset, int limit, QVariantList msgs)
+{
+    Q_UNUSED(limit)
+
+    // search results are not dispatched into the buffers, they are not part of the regular backlog
+    emit searchResultsReceived(query, bufferId, offset, backlogMessages(msgs));
+}
+
+
+void ClientBacklogManager::receiveBacklogRetention(QVariantMap rules)
+{
+    emit backlogRetentionReceived(rules);
+}
+
+
+MessageList ClientBacklogManager::backlogMessages(const QVariantList &msgs)
+{
     MessageList msglist;
     foreach(QVariant v, msgs) {
         Message msg = v.value<Message>();
         msg.setFlags(msg.flags() | Message::Backlog);
         msglist << msg;
     }
-
-    dispatchMessages(msglist);
+    return msglist;
 }
 
 
@@ -42,7 +42,11 @@ public:
 public slots:
     virtual QVariantList requestBacklog(BufferId bufferId, MsgId first = -1, MsgId last = -1, int limit = -1, int additional = 0);
     virtual void receiveBacklog(BufferId bufferId, MsgId first, MsgId last, int limit, int additional, QVariantList msgs);
+    virtual void receiveBacklogChunk(PeerPtr, BufferId bufferId, MsgId first, MsgId last, int limit, int additional, QVariantList msgs);
     virtual void receiveBacklogAll(MsgId first, MsgId last, int limit, int additional, QVariantList msgs);
+    virtual void receiveBacklogAllChunk(PeerPtr, MsgId first, MsgId last, int limit, int additional, QVariantList msgs);
+    virtual void receiveBacklogSearch(QString query, BufferId bufferId, int offset, int limit, QVariantList msgs);
+    virtual void receiveBacklogRetention(QVariantMap rules);
 
     void requestInitialBacklog();
 
@@ -53,11 +57,14 @@ signals:
     void messagesReceived(BufferId bufferId, int count) const;
     void messagesRequested(const QString &) const;
     void messagesProcessed(const QString &) const;
+    void searchResultsReceived(const QString &query, BufferId bufferId, int offset, const MessageList &messages);
+    void backlogRetentionReceived(const QVariantMap &rules);
 
     void updateProgress(int, int);
 
 private:
     bool isBuffering();
+    static MessageList backlogMessages(const QVariantList &msgs);
     BufferIdList filterNewBufferIds(const BufferIdList &bufferIds);
 
     void dispatchMessages(const MessageList &messages, bool sort = false);
@@ -40,6 +40,9 @@ CoreConnection::CoreConnection(QObject *parent)
     _state(Disconnected),
     _wantReconnect(false),
     _wasReconnect(false),
+    _suspended(false),
+    _wasResumed(false),
+    _resumeSequence(0),
     _progressMinimum(0),
     _progressMaximum(-1),
     _progressValue(-1),
@@ -234,6 +237,7 @@ void CoreConnection::coreSocketError(QAbstractSocket::SocketError error, const Q
 
 void CoreConnection::coreSocketDisconnected()
 {
+    suspendSession();
     setState(Disconnected);
     _wasReconnect = false;
     resetConnection(_wantReconnect);
@@ -256,6 +260,14 @@ void CoreConnection::disconnectFromCore(const QString &errorString, bool wantRec
     _wantReconnect = wantReconnect; // store if disconnect was requested
     _wasReconnect = false;
 
+    if (!wantReconnect) {
+        // no way back to the session we kept
+        if (state() == Disconnected)
+            discardSession();
+        else
+            _suspended = false;
+    }
+
     if (_authHandler)
         _authHandler->close();
     else if(_peer)
@@ -311,6 +323,33 @@ void CoreConnection::resetConnection(bool wantReconnect)
 }
 
 
+// If the core knows our session, it can replay what we miss while we're away, so we keep the
+// client state until we're back or give up reconnecting.
+void CoreConnection::suspendSession()
+{
+    CoreConnectionSettings s;
+    RemotePeer *peer = qobject_cast<RemotePeer *>(_peer);
+    if (state() == Synchronized && _wantReconnect && s.autoReconnect() && peer && !_resumeToken.isEmpty()) {
+        _resumeSequence = peer->receivedSequence();
+        _suspended = true;
+    }
+    else if (!_suspended) {
+        _resumeToken.clear();
+    }
+}
+
+
+void CoreConnection::discardSession()
+{
+    _resumeToken.clear();
+    _resumeSequence = 0;
+    if (_suspended) {
+        _suspended = false;
+        emit sessionDiscarded();
+    }
+}
+
+
 void CoreConnection::reconnectToCore()
 {
     if (currentAccount().isValid()) {
@@ -326,6 +365,7 @@ bool CoreConnection::connectToCore(AccountId accId)
         return false;
 
     CoreAccountSettings s;
+    AccountId previousAccount = _account.accountId();
 
     // FIXME: Don't force connection to internal core in mono client
     if (Quassel::runMode() == Quassel::Monolithic) {
@@ -354,6 +394,9 @@ bool CoreConnection::connectToCore(AccountId accId)
         }
     }
 
+    if (_account.accountId() != previousAccount)
+        discardSession();
+
     s.setLastAccount(accId);
     connectToCurrentAccount();
     return true;
@@ -384,6 +427,8 @@ void CoreConnection::connectToCurrentAccount()
     }
 
     _authHandler = new ClientAuthHandler(currentAccount(), this);
+    if (_suspended)
+        _authHandler->setResumeRequest(_resumeToken, _resumeSequence);
 
     connect(_authHandler, SIGNAL(disconnected()), SLOT(coreSocketDisconnected()));
     connect(_authHandler, SIGNAL(connectionReady()), SLOT(onConnectionReady()));
@@ -449,6 +494,14 @@ void CoreConnection::onHandshakeComplete(RemotePeer *peer, const Protocol::Sessi
     _authHandler->deleteLater();
     _authHandler = 0;
 
+    // the session we kept is either brought up to date by the core, or has to be synced anew
+    _wasResumed = _suspended && sessionState.resumed;
+    if (!_wasResumed)
+        discardSession();
+    _suspended = false;
+    _resumeToken = sessionState.resumeToken;
+    _resumeSequence = 0;
+
     _peer = peer;
     connect(peer, SIGNAL(disconnected()), SLOT(coreSocketDisconnected()));
     connect(peer, SIGNAL(statusMessage(QString)), SIGNAL(connectionMsg(QString)));
@@ -456,7 +509,16 @@ void CoreConnection::onHandshakeComplete(RemotePeer *peer, const Protocol::Sessi
 
     Client::signalProxy()->addPeer(_peer);  // sigproxy takes ownership of the peer!
 
-    syncToCore(sessionState);
+    if (_wasResumed) {
+        // the messages we missed follow right away
+        setState(Synchronized);
+        setProgressText(tr("Resumed session on %1").arg(currentAccount().accountName()));
+        setProgressMaximum(-1);
+        emit synchronized();
+    }
+    else {
+        syncToCore(sessionState);
+    }
 }
 
 
@@ -73,6 +73,12 @@ public:
     //! Check if we consider the last connect as reconnect
     bool wasReconnect() const { return _wasReconnect; }
 
+    //! Check if the last connect resumed the previous session, so the client state was kept instead of synced anew
+    bool wasResumed() const { return _wasResumed; }
+
+    //! Whether we're disconnected, but keep the client state because the core may let us resume the session
+    bool isSuspended() const { return _suspended; }
+
     QPointer<Peer> peer() { return _peer; }
 
 public slots:
@@ -92,6 +98,8 @@ signals:
     void connectionErrorPopup(const QString &errorMsg);
     void connectionMsg(const QString &msg);
     void disconnected();
+    //! The session kept while suspended can't be resumed, so the client state needs to go
+    void sessionDiscarded();
 
     void progressRangeChanged(int minimum, int maximum);
     void progressValueChanged(int value);
@@ -128,6 +136,8 @@ private slots:
     void internalSessionStateReceived(const Protocol::SessionState &sessionState);
 
     void resetConnection(bool wantReconnect = false);
+    void suspendSession();
+    void discardSession();
 
     void onConnectionReady();
     void onLoginSuccessful(const CoreAccount &account);
@@ -157,6 +167,11 @@ private:
     bool _wantReconnect;
     bool _wasReconnect;
 
+    bool _suspended;
+    bool _wasResumed;
+    QByteArray _resumeToken;
+    quint64 _resumeSequence;
+
     QSet<QObject *> _netsToSync;
     int _numNetsToSync;
     int _progressMinimum, _progressMaximum, _progressValue;
@@ -55,6 +55,47 @@ bool AuthHandler::isLocal() const
 }
 
 
+quint8 AuthHandler::supportedCompressionFeatures()
+{
+    quint8 features = Protocol::Compression;
+    if (Compressor::isSupported(Compressor::Zstd))
+        features |= Protocol::ZstdCompression;
+    if (Compressor::isSupported(Compressor::Lz4))
+        features |= Protocol::Lz4Compression;
+    return features;
+}
+
+
+Compressor::Method AuthHandler::compressionMethod(quint8 connectionFeatures)
+{
+    if (connectionFeatures & Protocol::ZstdCompression)
+        return Compressor::Zstd;
+    if (connectionFeatures & Protocol::Lz4Compression)
+        return Compressor::Lz4;
+    return Compressor::Deflate;
+}
+
+
+// Bandwidth is cheap on the local machine and network, but CPU time spent for compressing isn't
+Compressor::CompressionLevel AuthHandler::compressionLevel(quint8 connectionFeatures) const
+{
+    if (!(connectionFeatures & Protocol::Compression))
+        return Compressor::NoCompression;
+
+    if (isLocal())
+        return Compressor::BestSpeed;
+
+    QHostAddress address = socket() ? socket()->peerAddress() : QHostAddress();
+    if (address.isInSubnet(QHostAddress::parseSubnet("10.0.0.0/8"))
+        || address.isInSubnet(QHostAddress::parseSubnet("172.16.0.0/12"))
+        || address.isInSubnet(QHostAddress::parseSubnet("192.168.0.0/16"))
+        || address.isInSubnet(QHostAddress::parseSubnet("fc00::/7")))
+        return Compressor::DefaultCompression;
+
+    return Compressor::BestCompression;
+}
+
+
 // Some errors (e.g. connection refused) don't trigger a disconnected() from the socket, so send this explicitly
 // (but make sure it's only sent once!)
 void AuthHandler::onSocketError(QAbstractSocket::SocketError error)
@@ -23,6 +23,7 @@
 
 #include <QTcpSocket>
 
+#include "compressor.h"
 #include "protocol.h"
 
 class Peer;
@@ -63,6 +64,12 @@ signals:
 protected:
     void setSocket(QTcpSocket *socket);
 
+    //! The compression methods this build supports, as connection features
+    static quint8 supportedCompressionFeatures();
+    static Compressor::Method compressionMethod(quint8 connectionFeatures);
+    //! The level we compress with, depending on how close the peer is
+    Compressor::CompressionLevel compressionLevel(quint8 connectionFeatures) const;
+
 protected slots:
     virtual void onSocketError(QAbstractSocket::SocketError error);
     virtual void onSocketDisconnected();
@@ -33,3 +33,23 @@ QVariantList BacklogManager::requestBacklogAll(MsgId first, MsgId last, int limi
     REQUEST(ARG(first), ARG(last), ARG(limit), ARG(additional))
     return QVariantList();
 }
+
+
+QVariantList BacklogManager::requestBacklogSearch(QString query, BufferId bufferId, int offset, int limit)
+{
+    REQUEST(ARG(query), ARG(bufferId), ARG(offset), ARG(limit))
+    return QVariantList();
+}
+
+
+QVariantMap BacklogManager::requestBacklogRetention()
+{
+    REQUEST(NO_ARG)
+    return QVariantMap();
+}
+
+
+void BacklogManager::requestSetBacklogRetention(QVariantMap rules)
+{
+    REQUEST(ARG(rules))
+}
@@ -24,6 +24,9 @@
 #include "syncableobject.h"
 #include "types.h"
 
+class Peer;
+typedef Peer *PeerPtr; // as in peer.h, which isn't needed here otherwise
+
 class BacklogManager : public SyncableObject
 {
     SYNCABLE_OBJECT
@@ -40,6 +43,19 @@ public slots:
     virtual QVariantList requestBacklogAll(MsgId first = -1, MsgId last = -1, int limit = -1, int additional = 0);
     inline virtual void receiveBacklogAll(MsgId, MsgId, int, int, QVariantList) {};
 
+    // With Quassel::BacklogChunks, the core sends all but the last part of a backlog reply through these
+    // as soon as it has read them, the reply itself then only carries the last part
+    inline virtual void receiveBacklogChunk(PeerPtr, BufferId, MsgId, MsgId, int, int, QVariantList) {};
+    inline virtual void receiveBacklogAllChunk(PeerPtr, MsgId, MsgId, int, int, QVariantList) {};
+
+    virtual QVariantList requestBacklogSearch(QString query, BufferId bufferId = BufferId(), int offset = 0, int limit = 50);
+    inline virtual void receiveBacklogSearch(QString, BufferId, int, int, QVariantList) {};
+
+    // The user's rules for expiring backlog, cf. BacklogRetention in the core
+    virtual QVariantMap requestBacklogRetention();
+    inline virtual void receiveBacklogRetention(QVariantMap) {};
+    virtual void requestSetBacklogRetention(QVariantMap rules);
+
 signals:
     void backlogRequested(BufferId, MsgId, MsgId, int, int);
     void backlogAllRequested(MsgId, MsgId, int, int);
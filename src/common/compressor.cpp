@@ -30,15 +30,34 @@
 #    include "../../3rdparty/miniz/miniz.c"
 #endif
 
+#ifdef HAVE_ZSTD
+#    include <zstd.h>
+#endif
+
+#ifdef HAVE_LZ4
+#    include <lz4frame.h>
+#endif
+
 const int maxBufferSize = 64 * 1024 * 1024; // protect us from zip bombs
 const int ioBufferSize = 64 * 1024;         // chunk size for inflate/deflate; should not be too large as we preallocate that space!
 
-Compressor::Compressor(QTcpSocket *socket, Compressor::CompressionLevel level, QObject *parent)
+Compressor::Compressor(QTcpSocket *socket, Compressor::CompressionLevel level, Compressor::Method method, QObject *parent)
     : QObject(parent),
     _socket(socket),
     _level(level),
+    _method(method),
+    _readPos(0),
     _inflater(0),
     _deflater(0)
+#ifdef HAVE_ZSTD
+    , _zstdDecompressor(0),
+    _zstdCompressor(0)
+#endif
+#ifdef HAVE_LZ4
+    , _lz4Decompressor(0),
+    _lz4Compressor(0),
+    _lz4FrameStarted(false)
+#endif
 {
     connect(socket, SIGNAL(readyRead()), SLOT(readData()));
 
@@ -70,11 +89,80 @@ Compressor::~Compressor()
         deflateEnd(_deflater);
         delete _deflater;
     }
+#ifdef HAVE_ZSTD
+    ZSTD_freeDCtx(_zstdDecompressor);
+    ZSTD_freeCCtx(_zstdCompressor);
+#endif
+#ifdef HAVE_LZ4
+    LZ4F_freeDecompressionContext(_lz4Decompressor);
+    LZ4F_freeCompressionContext(_lz4Compressor);
+#endif
+}
+
+
+bool Compressor::isSupported(Compressor::Method method)
+{
+    switch (method) {
+        case Deflate:
+            return true;
+        case Zstd:
+#ifdef HAVE_ZSTD
+            return true;
+#else
+            return false;
+#endif
+        case Lz4:
+#ifdef HAVE_LZ4
+            return true;
+#else
+            return false;
+#endif
+    }
+    return false;
 }
 
 
 bool Compressor::initStreams()
 {
+    _inputBuffer.reserve(ioBufferSize); // pre-allocate space
+    _outputBuffer.resize(ioBufferSize); // not a typo; we never change the size of this buffer anyway (we *do* for _inputBuffer!)
+
+    // The levels are picked for a live connection, the highest ones of zstd and LZ4 are far too slow for that
+    switch (method()) {
+#ifdef HAVE_ZSTD
+        case Zstd: {
+            int zstdLevel = compressionLevel() == BestCompression ? 9 : compressionLevel() == BestSpeed ? 1 : 3;
+            _zstdDecompressor = ZSTD_createDCtx();
+            _zstdCompressor = ZSTD_createCCtx();
+            if (!_zstdDecompressor || !_zstdCompressor
+                || ZSTD_isError(ZSTD_CCtx_setParameter(_zstdCompressor, ZSTD_c_compressionLevel, zstdLevel))) {
+                qWarning() << "Could not initialize the zstd streams!";
+                return false;
+            }
+            qDebug() << "Enabling zstd compression...";
+            return true;
+        }
+#endif
+#ifdef HAVE_LZ4
+        case Lz4: {
+            if (LZ4F_isError(LZ4F_createDecompressionContext(&_lz4Decompressor, LZ4F_VERSION))
+                || LZ4F_isError(LZ4F_createCompressionContext(&_lz4Compressor, LZ4F_VERSION))) {
+                qWarning() << "Could not initialize the LZ4 streams!";
+                return false;
+            }
+            // LZ4F_compressUpdate() may need more than the input size, plus the frame header or the end mark
+            _outputBuffer.resize(LZ4F_compressBound(ioBufferSize, 0) + LZ4F_HEADER_SIZE_MAX);
+            qDebug() << "Enabling LZ4 compression...";
+            return true;
+        }
+#endif
+        case Deflate:
+            break;
+        default:
+            qWarning() << "Compression method" << method() << "is not supported by this build!";
+            return false;
+    }
+
     int zlevel;
     switch(compressionLevel()) {
         case BestCompression:
@@ -101,9 +189,6 @@ bool Compressor::initStreams()
         return false;
     }
 
-    _inputBuffer.reserve(ioBufferSize); // pre-allocate space
-    _outputBuffer.resize(ioBufferSize); // not a typo; we never change the size of this buffer anyway (we *do* for _inputBuffer!)
-
     qDebug() << "Enabling compression...";
 
     return true;
@@ -113,23 +198,24 @@ bool Compressor::initStreams()
 
 qint64 Compressor::bytesAvailable() const
 {
-    return _readBuffer.size();
+    return _readBuffer.size() - _readPos;
 }
 
 
 qint64 Compressor::read(char *data, qint64 maxSize)
 {
     if (maxSize <= 0)
-        maxSize = _readBuffer.size();
+        maxSize = bytesAvailable();
 
-    qint64 n = qMin(maxSize, (qint64)_readBuffer.size());
-    memcpy(data, _readBuffer.constData(), n);
+    qint64 n = qMin(maxSize, bytesAvailable());
+    memcpy(data, _readBuffer.constData() + _readPos, n);
 
-    // TODO: don't copy for every read
-    if (n == _readBuffer.size())
-        _readBuffer.clear();
-    else
-        _readBuffer = _readBuffer.mid(n);
+    // The read data stays in the buffer until the next readData(), so the rest doesn't get copied for every read
+    _readPos += n;
+    if (_readPos == _readBuffer.size()) {
+        _readBuffer.resize(0);
+        _readPos = 0;
+    }
 
     // If there's still data left in the socket buffer, make sure to schedule a read
     if (_socket->bytesAvailable())
@@ -139,6 +225,31 @@ qint64 Compressor::read(char *data, qint64 maxSize)
 }
 
 
+QByteArray Compressor::read(qint64 size)
+{
+    QByteArray data;
+    size = qMin(size, bytesAvailable());
+    if (_readPos == 0 && size == _readBuffer.size()) {
+        // hand out the buffer itself, it's implicitly shared
+        data = _readBuffer;
+        _readBuffer = QByteArray();
+    }
+    else {
+        data = _readBuffer.mid(_readPos, size);
+        _readPos += size;
+        if (_readPos == _readBuffer.size()) {
+            _readBuffer.resize(0);
+            _readPos = 0;
+        }
+    }
+
+    if (_socket->bytesAvailable())
+        QTimer::singleShot(0, this, SLOT(readData()));
+
+    return data;
+}
+
+
 // The usual usage pattern is to write a blocksize first, followed by the actual data.
 // By setting NoFlush, one can indicate that the write buffer should not immediately be
 // written, which should make things a bit more efficient.
@@ -161,6 +272,12 @@ void Compressor::readData()
     if (_socket->state() !=  QAbstractSocket::ConnectedState)
         return;
 
+    // drop what has been read already before appending
+    if (_readPos > 0) {
+        _readBuffer.remove(0, _readPos);
+        _readPos = 0;
+    }
+
     if (!_socket->bytesAvailable() || _readBuffer.size() >= maxBufferSize)
         return;
 
@@ -170,6 +287,25 @@ void Compressor::readData()
         return;
     }
 
+    switch (method()) {
+#ifdef HAVE_ZSTD
+        case Zstd:
+            zstdReadData();
+            return;
+#endif
+#ifdef HAVE_LZ4
+        case Lz4:
+            lz4ReadData();
+            return;
+#endif
+        default:
+            inflateData();
+    }
+}
+
+
+void Compressor::inflateData()
+{
     // We let zlib directly append to the readBuffer, which means we pre-allocate extra space for ioBufferSize.
     // Afterwards, we'll shrink the buffer appropriately. Since shrinking should not reallocate, the readBuffer's
     // capacity should over time adapt to the largest message sizes we encounter. However, this is not a bad thing
@@ -229,6 +365,25 @@ void Compressor::writeData()
         return;
     }
 
+    switch (method()) {
+#ifdef HAVE_ZSTD
+        case Zstd:
+            zstdWriteData();
+            return;
+#endif
+#ifdef HAVE_LZ4
+        case Lz4:
+            lz4WriteData();
+            return;
+#endif
+        default:
+            deflateData();
+    }
+}
+
+
+void Compressor::deflateData()
+{
     _deflater->next_in = reinterpret_cast<unsigned char *>(_writeBuffer.data());
     _deflater->avail_in = _writeBuffer.size();
 
@@ -264,6 +419,150 @@ void Compressor::writeData()
 }
 
 
+#ifdef HAVE_ZSTD
+// Same as inflateData(), but we loop as long as there's buffered input, as zstd
+// may keep some of it when running out of output space.
+void Compressor::zstdReadData()
+{
+    while ((_socket->bytesAvailable() || !_inputBuffer.isEmpty()) && _readBuffer.size() + ioBufferSize < maxBufferSize) {
+        if (_inputBuffer.size() < ioBufferSize)
+            _inputBuffer.append(_socket->read(ioBufferSize - _inputBuffer.size()));
+        _readBuffer.resize(_readBuffer.size() + ioBufferSize);
+
+        ZSTD_inBuffer in = { _inputBuffer.constData(), static_cast<size_t>(_inputBuffer.size()), 0 };
+        ZSTD_outBuffer out = { _readBuffer.data() + _readBuffer.size() - ioBufferSize, static_cast<size_t>(ioBufferSize), 0 };
+        size_t status = ZSTD_decompressStream(_zstdDecompressor, &out, &in);
+
+        // adjust input and output buffers
+        _readBuffer.resize(_readBuffer.size() - ioBufferSize + out.pos);
+        _inputBuffer.remove(0, in.pos);
+
+        if (ZSTD_isError(status)) {
+            qWarning() << "Error while decompressing stream:" << ZSTD_getErrorName(status);
+            emit error(StreamError);
+            return;
+        }
+
+        if (out.pos > 0)
+            emit readyRead();
+        else if (in.pos == 0)
+            return; // needs more input to continue
+    }
+}
+
+
+void Compressor::zstdWriteData()
+{
+    ZSTD_inBuffer in = { _writeBuffer.constData(), static_cast<size_t>(_writeBuffer.size()), 0 };
+
+    size_t remaining;
+    do {
+        ZSTD_outBuffer out = { _outputBuffer.data(), static_cast<size_t>(ioBufferSize), 0 };
+        // flushing makes sure that the peer can decompress everything we've written so far
+        remaining = ZSTD_compressStream2(_zstdCompressor, &out, &in, ZSTD_e_flush);
+        if (ZSTD_isError(remaining)) {
+            qWarning() << "Error while compressing stream:" << ZSTD_getErrorName(remaining);
+            emit error(StreamError);
+            return;
+        }
+
+        if (out.pos > 0 && !_socket->write(_outputBuffer.constData(), out.pos)) {
+            qWarning() << "Error while writing to socket:" << _socket->errorString();
+            emit error(DeviceError);
+            return;
+        }
+    } while (remaining > 0);
+
+    _writeBuffer.resize(0);
+}
+#endif
+
+
+#ifdef HAVE_LZ4
+void Compressor::lz4ReadData()
+{
+    while ((_socket->bytesAvailable() || !_inputBuffer.isEmpty()) && _readBuffer.size() + ioBufferSize < maxBufferSize) {
+        if (_inputBuffer.size() < ioBufferSize)
+            _inputBuffer.append(_socket->read(ioBufferSize - _inputBuffer.size()));
+        _readBuffer.resize(_readBuffer.size() + ioBufferSize);
+
+        // LZ4F_decompress() updates the sizes to the amount of data actually consumed and produced
+        size_t inSize = _inputBuffer.size();
+        size_t outSize = ioBufferSize;
+        size_t status = LZ4F_decompress(_lz4Decompressor, _readBuffer.data() + _readBuffer.size() - ioBufferSize, &outSize,
+                                        _inputBuffer.constData(), &inSize, 0);
+
+        _readBuffer.resize(_readBuffer.size() - ioBufferSize + outSize);
+        _inputBuffer.remove(0, inSize);
+
+        if (LZ4F_isError(status)) {
+            qWarning() << "Error while decompressing stream:" << LZ4F_getErrorName(status);
+            emit error(StreamError);
+            return;
+        }
+
+        if (outSize > 0)
+            emit readyRead();
+        else if (inSize == 0)
+            return; // needs more input to continue
+    }
+}
+
+
+void Compressor::lz4WriteData()
+{
+    char *out = _outputBuffer.data();
+    size_t outSize = _outputBuffer.size();
+
+    size_t written = 0;
+    if (!_lz4FrameStarted) {
+        LZ4F_preferences_t prefs;
+        memset(&prefs, 0, sizeof(prefs));
+        prefs.compressionLevel = compressionLevel() == BestCompression ? 9 : 0;
+        written = LZ4F_compressBegin(_lz4Compressor, out, outSize, &prefs);
+        if (LZ4F_isError(written)) {
+            qWarning() << "Error while compressing stream:" << LZ4F_getErrorName(written);
+            emit error(StreamError);
+            return;
+        }
+        _lz4FrameStarted = true;
+    }
+
+    // compress in chunks of ioBufferSize, as the output buffer is sized for that
+    int pos = 0;
+    bool flushed = false;
+    while (!flushed) {
+        size_t status;
+        if (pos < _writeBuffer.size()) {
+            int count = qMin(ioBufferSize, _writeBuffer.size() - pos);
+            status = LZ4F_compressUpdate(_lz4Compressor, out + written, outSize - written, _writeBuffer.constData() + pos, count, 0);
+            pos += count;
+        }
+        else {
+            // make sure that the peer can decompress everything we've written so far
+            status = LZ4F_flush(_lz4Compressor, out + written, outSize - written, 0);
+            flushed = true;
+        }
+        if (LZ4F_isError(status)) {
+            qWarning() << "Error while compressing stream:" << LZ4F_getErrorName(status);
+            emit error(StreamError);
+            return;
+        }
+        written += status;
+
+        if (written > 0 && !_socket->write(out, written)) {
+            qWarning() << "Error while writing to socket:" << _socket->errorString();
+            emit error(DeviceError);
+            return;
+        }
+        written = 0;
+    }
+
+    _writeBuffer.resize(0);
+}
+#endif
+
+
 void Compressor::flush()
 {
     if (compressionLevel() == NoCompression && _socket->state() == QAbstractSocket::ConnectedState)
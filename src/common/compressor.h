@@ -31,6 +31,16 @@ class QTcpSocket;
     typedef struct mz_stream_s *z_streamp;
 #endif
 
+#ifdef HAVE_ZSTD
+    typedef struct ZSTD_CCtx_s ZSTD_CCtx;
+    typedef struct ZSTD_DCtx_s ZSTD_DCtx;
+#endif
+
+#ifdef HAVE_LZ4
+    typedef struct LZ4F_cctx_s LZ4F_cctx;
+    typedef struct LZ4F_dctx_s LZ4F_dctx;
+#endif
+
 class Compressor : public QObject
 {
     Q_OBJECT
@@ -43,6 +53,13 @@ public:
         BestSpeed
     };
 
+    //! The available methods depend on the libraries found at build time, deflate is always supported
+    enum Method {
+        Deflate,
+        Zstd,
+        Lz4
+    };
+
     enum Error {
         NoError,
         StreamError,
@@ -54,14 +71,19 @@ public:
         Flush
     };
 
-    Compressor(QTcpSocket *socket, CompressionLevel level, QObject *parent = 0);
+    Compressor(QTcpSocket *socket, CompressionLevel level, Method method, QObject *parent = 0);
     ~Compressor();
 
     CompressionLevel compressionLevel() const { return _level; }
+    Method method() const { return _method; }
+
+    static bool isSupported(Method method);
 
     qint64 bytesAvailable() const;
 
     qint64 read(char *data, qint64 maxSize);
+    //! Returns the next size bytes, without copying them if they are all that's buffered
+    QByteArray read(qint64 size);
     qint64 write(const char *data, qint64 count, WriteBufferHint flush = Flush);
 
     void flush();
@@ -77,11 +99,24 @@ private:
     bool initStreams();
     void writeData();
 
+    void inflateData();
+    void deflateData();
+#ifdef HAVE_ZSTD
+    void zstdReadData();
+    void zstdWriteData();
+#endif
+#ifdef HAVE_LZ4
+    void lz4ReadData();
+    void lz4WriteData();
+#endif
+
 private:
     QTcpSocket *_socket;
     CompressionLevel _level;
+    Method _method;
 
     QByteArray _readBuffer;
+    int _readPos; // data before this position in _readBuffer has already been read
     QByteArray _writeBuffer;
 
     QByteArray _inputBuffer;
@@ -89,6 +124,15 @@ private:
 
     z_streamp _inflater;
     z_streamp _deflater;
+#ifdef HAVE_ZSTD
+    ZSTD_DCtx *_zstdDecompressor;
+    ZSTD_CCtx *_zstdCompressor;
+#endif
+#ifdef HAVE_LZ4
+    LZ4F_dctx *_lz4Decompressor;
+    LZ4F_cctx *_lz4Compressor;
+    bool _lz4FrameStarted;
+#endif
 };
 
 #endif
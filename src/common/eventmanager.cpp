@@ -23,6 +23,7 @@
 #include <QCoreApplication>
 #include <QEvent>
 #include <QDebug>
+#include <QVarLengthArray>
 
 #include "event.h"
 #include "ircevent.h"
@@ -147,6 +148,7 @@ int EventManager::findEventType(const QString &methodSignature_, const QString &
 
 void EventManager::registerObject(QObject *object, Priority priority, const QString &methodPrefix, const QString &filterPrefix)
 {
+    _dispatchTable.clear();
     for (int i = object->metaObject()->methodOffset(); i < object->metaObject()->methodCount(); i++) {
 #if QT_VERSION >= 0x050000
         QString methodSignature = object->metaObject()->method(i).methodSignature();
@@ -195,6 +197,7 @@ void EventManager::registerEventHandler(QList<EventType> events, QObject *object
         qWarning() << Q_FUNC_INFO << QString("Slot %1 not found in object %2").arg(slot).arg(object->objectName());
         return;
     }
+    _dispatchTable.clear();
     Handler handler(object, methodIndex, priority);
     foreach(EventType event, events) {
         if (isFilter) {
@@ -225,6 +228,24 @@ void EventManager::postEvent(Event *event)
 }
 
 
+void EventManager::postEvents(const QList<Event *> &events)
+{
+    if (sender() && sender()->thread() != this->thread()) {
+        foreach(Event *event, events)
+            QCoreApplication::postEvent(this, new QueuedQuasselEvent(event));
+    }
+    else if (!_eventQueue.isEmpty()) {
+        // we're currently processing events
+        _eventQueue.append(events);
+    }
+    else {
+        // events generated by one of them are still processed before the next one
+        foreach(Event *event, events)
+            processEvent(event);
+    }
+}
+
+
 void EventManager::customEvent(QEvent *event)
 {
     if (event->type() == QEvent::User) {
@@ -251,62 +272,47 @@ void EventManager::dispatchEvent(Event *event)
 {
     //qDebug() << "Dispatching" << event;
 
-    // we try handlers from specialized to generic by masking the enum
-
-    // build a list sorted by priorities that contains all eligible handlers
-    QList<Handler> handlers;
-    QHash<QObject *, Handler> filters;
-    QSet<QObject *> ignored;
     uint type = event->type();
-
-    bool checkDupes = false;
+    int num = 0;
 
     // special handling for numeric IrcEvents
     if ((type & ~IrcEventNumericMask) == IrcEventNumeric) {
         ::IrcEventNumeric *numEvent = static_cast< ::IrcEventNumeric *>(event);
         if (!numEvent)
             qWarning() << "Invalid event type for IrcEventNumeric!";
-        else {
-            int num = numEvent->number();
-            if (num > 0) {
-                insertHandlers(registeredHandlers().value(type + num), handlers, false);
-                insertFilters(registeredFilters().value(type + num), filters);
-                checkDupes = true;
-            }
-        }
+        else
+            num = numEvent->number();
     }
 
-    // exact type
-    insertHandlers(registeredHandlers().value(type), handlers, checkDupes);
-    insertFilters(registeredFilters().value(type), filters);
+    // a copy, as handlers might register new ones while we dispatch
+    DispatchChain chain = dispatchChain(type, num);
 
-    // check if we have a generic handler for the event group
-    if ((type & EventGroupMask) != type) {
-        insertHandlers(registeredHandlers().value(type & EventGroupMask), handlers, true);
-        insertFilters(registeredFilters().value(type & EventGroupMask), filters);
-    }
+    QVarLengthArray<bool, 16> ignored(chain.hasFilters ? chain.objectCount : 0);
+    for (int i = 0; i < ignored.size(); i++)
+        ignored[i] = false;
+
+    // the handlers get the event pointer by reference, as with Q_ARG(Event *, event)
+    void *param[] = { 0, &event };
+    bool result = false;
+    void *filterParam[] = { &result, &event };
 
     // now dispatch the event
-    QList<Handler>::const_iterator it;
-    for (it = handlers.begin(); it != handlers.end() && !event->isStopped(); ++it) {
+    QVector<DispatchEntry>::const_iterator it;
+    for (it = chain.entries.constBegin(); it != chain.entries.constEnd() && !event->isStopped(); ++it) {
         QObject *obj = it->object;
 
-        if (ignored.contains(obj)) // object has filtered the event
-            continue;
-
-        if (filters.contains(obj)) { // we have a filter, so let's check if we want to deliver the event
-            Handler filter = filters.value(obj);
-            bool result = false;
-            void *param[] = { Q_RETURN_ARG(bool, result).data(), Q_ARG(Event *, event).data() };
-            obj->qt_metacall(QMetaObject::InvokeMetaMethod, filter.methodIndex, param);
+        if (it->filterIndex >= 0) { // we have a filter, so let's check if we want to deliver the event
+            if (ignored[it->objectIndex]) // object has filtered the event
+                continue;
+            result = false;
+            obj->qt_metacall(QMetaObject::InvokeMetaMethod, it->filterIndex, filterParam);
             if (!result) {
-                ignored.insert(obj);
+                ignored[it->objectIndex] = true;
                 continue; // mmmh, event filter told us to not accept
             }
         }
 
         // finally, deliverance!
-        void *param[] = { 0, Q_ARG(Event *, event).data() };
         obj->qt_metacall(QMetaObject::InvokeMetaMethod, it->methodIndex, param);
     }
 
@@ -315,6 +321,57 @@ void EventManager::dispatchEvent(Event *event)
 }
 
 
+const EventManager::DispatchChain &EventManager::dispatchChain(uint type, int num)
+{
+    uint key = num > 0 ? type + num : type;
+    QHash<uint, DispatchChain>::const_iterator cached = _dispatchTable.constFind(key);
+    if (cached != _dispatchTable.constEnd())
+        return *cached;
+
+    // we try handlers from specialized to generic by masking the enum
+
+    // build a list sorted by priorities that contains all eligible handlers
+    QList<Handler> handlers;
+    QHash<QObject *, Handler> filters;
+
+    bool checkDupes = false;
+
+    // numeric IrcEvents have handlers for their number
+    if (num > 0) {
+        insertHandlers(registeredHandlers().value(type + num), handlers, false);
+        insertFilters(registeredFilters().value(type + num), filters);
+        checkDupes = true;
+    }
+
+    // exact type
+    insertHandlers(registeredHandlers().value(type), handlers, checkDupes);
+    insertFilters(registeredFilters().value(type), filters);
+
+    // check if we have a generic handler for the event group
+    if ((type & EventGroupMask) != type) {
+        insertHandlers(registeredHandlers().value(type & EventGroupMask), handlers, true);
+        insertFilters(registeredFilters().value(type & EventGroupMask), filters);
+    }
+
+    DispatchChain chain;
+    chain.hasFilters = !filters.isEmpty();
+    QHash<QObject *, int> objectIndexes;
+    foreach(const Handler &handler, handlers) {
+        DispatchEntry entry;
+        entry.object = handler.object;
+        entry.methodIndex = handler.methodIndex;
+        entry.filterIndex = filters.contains(handler.object) ? filters.value(handler.object).methodIndex : -1;
+        if (!objectIndexes.contains(handler.object))
+            objectIndexes.insert(handler.object, objectIndexes.count());
+        entry.objectIndex = objectIndexes.value(handler.object);
+        chain.entries.append(entry);
+    }
+    chain.objectCount = objectIndexes.count();
+
+    return *_dispatchTable.insert(key, chain);
+}
+
+
 void EventManager::insertHandlers(const QList<Handler> &newHandlers, QList<Handler> &existing, bool checkDupes)
 {
     foreach(const Handler &handler, newHandlers) {
@@ -336,7 +393,7 @@ void EventManager::insertHandlers(const QList<Handler> &newHandlers, QList<Handl
                 ++it;
             }
             if (insert)
-                existing.insert(it, handler);
+                existing.insert(insertpos, handler);
         }
     }
 }
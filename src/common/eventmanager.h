@@ -22,6 +22,7 @@
 #define EVENTMANAGER_H
 
 #include <QMetaEnum>
+#include <QVector>
 
 #include "types.h"
 
@@ -87,7 +88,10 @@ public :
         IrcServerParseError,
 
         IrcEvent                    = 0x00030000,
+        IrcEventAccount,
         IrcEventAuthenticate,
+        IrcEventAway,
+        IrcEventBatch,
         IrcEventCap,
         IrcEventInvite,
         IrcEventJoin,
@@ -145,6 +149,13 @@ public slots:
      */
     void postEvent(Event *event);
 
+    //! Send a batch of events to the registered handlers, in order
+    /**
+      Same as calling postEvent() for each of them, but a single call for all.
+      @param events The events to be dispatched
+     */
+    void postEvents(const QList<Event *> &events);
+
 protected:
     virtual Network *networkById(NetworkId id) const = 0;
     virtual void customEvent(QEvent *event);
@@ -165,6 +176,19 @@ private:
 
     typedef QHash<uint, QList<Handler> > HandlerHash;
 
+    // The handlers for a concrete event type, with the filters they're subject to, in the order they get called
+    struct DispatchEntry {
+        QObject *object;
+        int methodIndex;
+        int filterIndex; // -1 if the object has no filter for the event type
+        int objectIndex; // the same for all entries of an object, to keep track of objects that filtered the event
+    };
+    struct DispatchChain {
+        QVector<DispatchEntry> entries;
+        int objectCount;
+        bool hasFilters;
+    };
+
     inline const HandlerHash &registeredHandlers() const { return _registeredHandlers; }
     inline HandlerHash &registeredHandlers() { return _registeredHandlers; }
 
@@ -180,12 +204,15 @@ private:
 
     void processEvent(Event *event);
     void dispatchEvent(Event *event);
+    //! The dispatch chain for an event type, and the number for numeric IrcEvents; built on first use
+    const DispatchChain &dispatchChain(uint type, int num);
 
     //! @return the EventType enum
     static QMetaEnum eventEnum();
 
     HandlerHash _registeredHandlers;
     HandlerHash _registeredFilters;
+    QHash<uint, DispatchChain> _dispatchTable; // cleared whenever a handler is registered
     QList<Event *> _eventQueue;
     static QMetaEnum _enum;
 };
@@ -42,7 +42,8 @@ InternalPeer::InternalPeer(QObject *parent)
     _peer(0),
     _isOpen(true)
 {
-
+    // both sides are built from the same sources
+    setFeatures(Quassel::features());
 }
 
 
@@ -33,6 +33,9 @@ Event *IrcEvent::create(EventManager::EventType type, QVariantMap &map, Network
     case EventManager::IrcEventRawNotice:
         return new IrcEventRawMessage(type, map, network);
 
+    case EventManager::IrcEventBatch:
+        return new IrcEventBatch(type, map, network);
+
     default:
         return new IrcEvent(type, map, network);
     }
@@ -83,3 +86,9 @@ void IrcEventRawMessage::toVariantMap(QVariantMap &map) const
     IrcEvent::toVariantMap(map);
     map["rawMessage"] = rawMessage();
 }
+
+
+IrcEventBatch::IrcEventBatch(EventManager::EventType type, QVariantMap &map, Network *network)
+    : IrcEvent(type, map, network)
+{
+}
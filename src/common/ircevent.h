@@ -139,4 +139,43 @@ private:
 };
 
 
+//! An IRCv3 batch, holding the events parsed from the lines tagged with its reference
+/** The params are the reference tag, the batch type and the type's own params.
+  * The contained events are owned by the batch until they are taken.
+  */
+class IrcEventBatch : public IrcEvent
+{
+public:
+    explicit IrcEventBatch(Network *network, const QString &prefix, const QStringList &params = QStringList())
+        : IrcEvent(EventManager::IrcEventBatch, network, prefix, params)
+    {}
+    ~IrcEventBatch() { qDeleteAll(_events); }
+
+    inline QString reference() const { return params().value(0); }
+    inline QString batchType() const { return params().value(1).toLower(); }
+    inline QStringList batchParams() const { return params().mid(2); }
+
+    inline QList<Event *> events() const { return _events; }
+    inline void addEvent(Event *event) { _events << event; }
+    inline QList<Event *> takeEvents() { QList<Event *> events = _events; _events.clear(); return events; }
+
+protected:
+    // the contained events are not serialized, a batch recreated from a map is empty
+    explicit IrcEventBatch(EventManager::EventType type, QVariantMap &map, Network *network);
+
+    virtual inline QString className() const { return "IrcEventBatch"; }
+    virtual inline void debugInfo(QDebug &dbg) const
+    {
+        IrcEvent::debugInfo(dbg);
+        dbg << ", events = " << _events.count();
+    }
+
+
+private:
+    QList<Event *> _events;
+
+    friend class IrcEvent;
+};
+
+
 #endif
@@ -35,6 +35,7 @@ IrcUser::IrcUser(const QString &hostmask, Network *network) : SyncableObject(net
     _user(userFromMask(hostmask)),
     _host(hostFromMask(hostmask)),
     _realName(),
+    _account(),
     _awayMessage(),
     _away(false),
     _server(),
@@ -146,6 +147,15 @@ void IrcUser::setRealName(const QString &realName)
 }
 
 
+void IrcUser::setAccount(const QString &account)
+{
+    if (_account != account) {
+        _account = account;
+        SYNC(ARG(account))
+    }
+}
+
+
 void IrcUser::setAway(const bool &away)
 {
     if (away != _away) {
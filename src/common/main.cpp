@@ -159,6 +159,12 @@ int main(int argc, char **argv)
     cliParser->addOption("select-backend", 0, "Switch storage backend (migrating data if possible)", "backendidentifier");
     cliParser->addSwitch("add-user", 0, "Starts an interactive session to add a new core user");
     cliParser->addOption("change-userpass", 0, "Starts an interactive session to change the password of the user identified by <username>", "username");
+    cliParser->addOption("backlog-retention-interval", 0, "Minutes between checks for backlog that expired according to the users' retention rules", "minutes", "60");
+    cliParser->addOption("backlog-archive-dir", 0, "Write expired backlog to compressed archive files in this directory instead of just deleting it", "path");
+    cliParser->addSwitch("sqlite-wal", 0, "Switch the SQLite database to WAL mode, so reading backlog doesn't wait for writes");
+    cliParser->addOption("log-durability", 0, "How messages are committed to the database: per-message|batched|async", "mode", "per-message");
+    cliParser->addOption("log-flush-interval", 0, "Milliseconds between group commits in batched and async mode", "ms", "250");
+    cliParser->addOption("log-flush-size", 0, "Number of pending messages triggering an early group commit", "count", "500");
     cliParser->addSwitch("oidentd", 0, "Enable oidentd integration");
     cliParser->addOption("oidentd-conffile", 0, "Set path to oidentd configuration file", "file");
 #ifdef HAVE_SSL
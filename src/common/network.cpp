@@ -19,6 +19,8 @@
  ***************************************************************************/
 
 #include <QTextCodec>
+#include <QVector>
+#include <QtEndian>
 
 #include "network.h"
 
@@ -702,48 +704,58 @@ QVariantMap Network::initSupports() const
 QVariantMap Network::initIrcUsersAndChannels() const
 {
     QVariantMap usersAndChannels;
+    foreach(const QVariantMap &chunk, ircUsersAndChannelsChunks(0))
+        usersAndChannels.unite(chunk);
+    return usersAndChannels;
+}
 
-    if (_ircUsers.count()) {
-        QHash<QString, QVariantList> users;
-        QHash<QString, IrcUser *>::const_iterator it = _ircUsers.begin();
-        QHash<QString, IrcUser *>::const_iterator end = _ircUsers.end();
-        while (it != end) {
-            const QVariantMap &map = it.value()->toVariantMap();
-            QVariantMap::const_iterator mapiter = map.begin();
-            while (mapiter != map.end()) {
-                users[mapiter.key()] << mapiter.value();
-                ++mapiter;
-            }
-            ++it;
-        }
-        // Can't have a container with a value type != QVariant in a QVariant :(
-        // However, working directly on a QVariantMap is awkward for appending, thus the detour via the hash above.
-        QVariantMap userMap;
-        foreach(const QString &key, users.keys())
-            userMap[key] = users[key];
-        usersAndChannels["Users"] = userMap;
-    }
 
-    if (_ircChannels.count()) {
-        QHash<QString, QVariantList> channels;
-        QHash<QString, IrcChannel *>::const_iterator it = _ircChannels.begin();
-        QHash<QString, IrcChannel *>::const_iterator end = _ircChannels.end();
-        while (it != end) {
-            const QVariantMap &map = it.value()->toVariantMap();
-            QVariantMap::const_iterator mapiter = map.begin();
-            while (mapiter != map.end()) {
-                channels[mapiter.key()] << mapiter.value();
-                ++mapiter;
+namespace {
+
+// Appends the column maps of objects to chunks, starting a new chunk every chunkSize objects
+template<class T>
+void appendColumnChunks(QList<QVariantMap> &chunks, const QString &type, const QHash<QString, T *> &objects, int chunkSize)
+{
+    QHash<QString, QVariantList> columns;
+    int count = 0;
+    typename QHash<QString, T *>::const_iterator it = objects.begin();
+    typename QHash<QString, T *>::const_iterator end = objects.end();
+    while (it != end) {
+        const QVariantMap &map = it.value()->toVariantMap();
+        QVariantMap::const_iterator mapiter = map.begin();
+        while (mapiter != map.end()) {
+            columns[mapiter.key()] << mapiter.value();
+            ++mapiter;
+        }
+        ++it;
+
+        if (++count == chunkSize || it == end) {
+            // Can't have a container with a value type != QVariant in a QVariant :(
+            // However, working directly on a QVariantMap is awkward for appending, thus the detour via the hash above.
+            QVariantMap columnMap;
+            QHash<QString, QVariantList>::const_iterator column = columns.begin();
+            while (column != columns.end()) {
+                columnMap[column.key()] = column.value();
+                ++column;
             }
-            ++it;
+            QVariantMap chunk;
+            chunk[type] = columnMap;
+            chunks << chunk;
+            columns.clear();
+            count = 0;
         }
-        QVariantMap channelMap;
-        foreach(const QString &key, channels.keys())
-            channelMap[key] = channels[key];
-        usersAndChannels["Channels"] = channelMap;
     }
+}
 
-    return usersAndChannels;
+}
+
+
+QList<QVariantMap> Network::ircUsersAndChannelsChunks(int chunkSize) const
+{
+    QList<QVariantMap> chunks;
+    appendColumnChunks(chunks, "Users", _ircUsers, chunkSize);
+    appendColumnChunks(chunks, "Channels", _ircChannels, chunkSize);
+    return chunks;
 }
 
 
@@ -755,46 +767,159 @@ void Network::initSetIrcUsersAndChannels(const QVariantMap &usersAndChannels)
         return;
     }
 
-    // toMap() and toList() are cheap, so we can avoid copying to lists...
-    // However, we really have to make sure to never accidentally detach from the shared data!
+    addIrcUsersAndChannels(usersAndChannels);
+}
 
-    const QVariantMap &users = usersAndChannels["Users"].toMap();
 
-    // sanity check
-    int count = users["nick"].toList().count();
-    foreach(const QString &key, users.keys()) {
-        if (users[key].toList().count() != count) {
-            qWarning() << "Received invalid usersAndChannels init data, sizes of attribute lists don't match!";
-            return;
-        }
+// Also used for the remaining chunks if the init data was sent in chunks, cf. DataStreamPeer::dispatch(InitData)
+void Network::addIrcUsersAndChannels(const QVariantMap &usersAndChannels)
+{
+    // Decode every attribute list once, rather than looking it up again for each user
+    QStringList keys;
+    QList<QVariantList> columns;
+
+    int count = decodeColumns(usersAndChannels["Users"].toMap(), "nick", keys, columns);
+    if (count < 0) {
+        qWarning() << "Received invalid usersAndChannels init data, sizes of attribute lists don't match!";
+        return;
     }
 
     // now create the individual IrcUsers
+    int nickColumn = keys.indexOf("nick");
     for(int i = 0; i < count; i++) {
         QVariantMap map;
-        foreach(const QString &key, users.keys())
-            map[key] = users[key].toList().at(i);
-        newIrcUser(map["nick"].toString(), map); // newIrcUser() properly handles the hostmask being just the nick
+        for (int k = 0; k < keys.count(); k++)
+            map[keys[k]] = columns[k].at(i);
+        newIrcUser(columns[nickColumn].at(i).toString(), map); // newIrcUser() properly handles the hostmask being just the nick
     }
 
     // same thing for IrcChannels
-    const QVariantMap &channels = usersAndChannels["Channels"].toMap();
-
-    // sanity check
-    count = channels["name"].toList().count();
-    foreach(const QString &key, channels.keys()) {
-        if (channels[key].toList().count() != count) {
-            qWarning() << "Received invalid usersAndChannels init data, sizes of attribute lists don't match!";
-            return;
-        }
+    count = decodeColumns(usersAndChannels["Channels"].toMap(), "name", keys, columns);
+    if (count < 0) {
+        qWarning() << "Received invalid usersAndChannels init data, sizes of attribute lists don't match!";
+        return;
     }
+
     // now create the individual IrcChannels
+    int nameColumn = keys.indexOf("name");
     for(int i = 0; i < count; i++) {
         QVariantMap map;
-        foreach(const QString &key, channels.keys())
-            map[key] = channels[key].toList().at(i);
-        newIrcChannel(map["name"].toString(), map);
+        for (int k = 0; k < keys.count(); k++)
+            map[keys[k]] = columns[k].at(i);
+        newIrcChannel(columns[nameColumn].at(i).toString(), map);
+    }
+}
+
+
+// Columns of string attributes can be sent compacted, cf. compactIrcUsersAndChannels().
+// Returns the number of rows, or -1 if the columns don't have the same size.
+int Network::decodeColumns(const QVariantMap &attributes, const QString &countKey, QStringList &keys, QList<QVariantList> &columns)
+{
+    keys.clear();
+    columns.clear();
+    if (!attributes.contains(countKey))
+        return 0;
+
+    QVariantMap::const_iterator it = attributes.begin();
+    while (it != attributes.end()) {
+        QVariantList column;
+        if (it.value().type() == QVariant::StringList) {
+            foreach(const QString &value, it.value().toStringList())
+                column << value;
+        }
+        else if (it.value().type() == QVariant::Map) {
+            // dictionary encoded: the values, and for each row the index of its value
+            const QVariantMap &encoded = it.value().toMap();
+            const QStringList &dictionary = encoded["Dictionary"].toStringList();
+            const QByteArray &indices = encoded["Indices"].toByteArray();
+            int width = dictionary.count() > 0xffff ? 4 : 2;
+            const uchar *data = reinterpret_cast<const uchar *>(indices.constData());
+            for (int i = 0; i + width <= indices.size(); i += width) {
+                // a 32 bit index may exceed INT_MAX, so it must not be compared as an int
+                quint32 index = width == 2 ? qFromBigEndian<quint16>(data + i) : qFromBigEndian<quint32>(data + i);
+                if (index >= (quint32)dictionary.count())
+                    return -1;
+                column << dictionary.at(index);
+            }
+        }
+        else {
+            column = it.value().toList();
+        }
+        keys << it.key();
+        columns << column;
+        ++it;
+    }
+
+    int count = columns.at(keys.indexOf(countKey)).count();
+    foreach(const QVariantList &column, columns) {
+        if (column.count() != count)
+            return -1;
+    }
+    return count;
+}
+
+
+// Most attributes of users and channels are strings, which don't need to be wrapped into a QVariant
+// each. Many of them also repeat a lot (servers, hosts of cloaked or web users, empty away messages),
+// so those are replaced by a dictionary and the list of indices into it.
+QVariantMap Network::compactIrcUsersAndChannels(const QVariantMap &usersAndChannels)
+{
+    QVariantMap compacted;
+    QVariantMap::const_iterator typeIter = usersAndChannels.begin();
+    while (typeIter != usersAndChannels.end()) {
+        QVariantMap attributes = typeIter.value().toMap();
+        QVariantMap::iterator it = attributes.begin();
+        while (it != attributes.end()) {
+            const QVariantList &column = it.value().toList();
+            QStringList values;
+            foreach(const QVariant &value, column) {
+                if (value.type() != QVariant::String)
+                    break;
+                values << value.toString();
+            }
+            if (values.count() != column.count()) {
+                ++it;
+                continue;  // not a string attribute
+            }
+
+            QHash<QString, int> ids;
+            QStringList dictionary;
+            QVector<int> indices;
+            indices.reserve(values.count());
+            foreach(const QString &value, values) {
+                QHash<QString, int>::const_iterator id = ids.constFind(value);
+                if (id == ids.constEnd()) {
+                    id = ids.insert(value, dictionary.count());
+                    dictionary << value;
+                }
+                indices << id.value();
+            }
+
+            // only worth it if most values are repeated
+            if (dictionary.count() * 2 > values.count()) {
+                it.value() = values;
+            }
+            else {
+                int width = dictionary.count() > 0xffff ? 4 : 2;
+                QByteArray packed(indices.count() * width, 0);
+                uchar *data = reinterpret_cast<uchar *>(packed.data());
+                for (int i = 0; i < indices.count(); i++) {
+                    if (width == 2)
+                        qToBigEndian<quint16>(indices[i], data + i * width);
+                    else
+                        qToBigEndian<quint32>(indices[i], data + i * width);
+                }
+                QVariantMap encoded;
+                encoded["Dictionary"] = dictionary;
+                encoded["Indices"] = packed;
+                it.value() = encoded;
+            }
+            ++it;
+        }
+        compacted[typeIter.key()] = attributes;
+        ++typeIter;
     }
+    return compacted;
 }
 
 
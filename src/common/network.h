@@ -210,6 +210,11 @@ public :
     static void setDefaultCodecForEncoding(const QByteArray &name);
     static void setDefaultCodecForDecoding(const QByteArray &name);
 
+    //! Returns the result of initIrcUsersAndChannels() with its string attributes compacted
+    /** Network only accepts this format if the peer announced support for it.
+     */
+    static QVariantMap compactIrcUsersAndChannels(const QVariantMap &usersAndChannels);
+
     inline bool autoAwayActive() const { return _autoAwayActive; }
     inline void setAutoAwayActive(bool active) { _autoAwayActive = active; }
 
@@ -246,6 +251,13 @@ public slots:
 
     inline void addIrcUser(const QString &hostmask) { newIrcUser(hostmask); }
     inline void addIrcChannel(const QString &channel) { newIrcChannel(channel); }
+    //! Adds a chunk of users and channels in the format of initIrcUsersAndChannels()
+    void addIrcUsersAndChannels(const QVariantMap &usersAndChannels);
+    //! Returns the users and channels in the format of initIrcUsersAndChannels(), in chunks of at most chunkSize users or channels
+    /** Users come first, so channels never refer to users that don't exist yet. A chunkSize of 0 puts
+     *  all users into one chunk and all channels into another.
+     */
+    QList<QVariantMap> ircUsersAndChannelsChunks(int chunkSize) const;
 
     //init geters
     QVariantMap initSupports() const;
@@ -366,6 +378,8 @@ private:
     static QTextCodec *_defaultCodecForEncoding;
     static QTextCodec *_defaultCodecForDecoding;
 
+    static int decodeColumns(const QVariantMap &attributes, const QString &countKey, QStringList &keys, QList<QVariantList> &columns);
+
     bool _autoAwayActive; // when this is active handle305 and handle306 don't trigger any output
 
     friend class IrcUser;
@@ -68,7 +68,64 @@ NetworkDataEvent::NetworkDataEvent(EventManager::EventType type, QVariantMap &ma
 void NetworkDataEvent::toVariantMap(QVariantMap &map) const
 {
     NetworkEvent::toVariantMap(map);
-    map["data"] = data();
+    map["data"] = QByteArray(data().constData(), data().size()); // data may refer to a batch's buffer
+}
+
+
+/*****************************************************************************/
+
+EventArena::EventArena(int count, size_t size, const QByteArray &data)
+    : _refCount(1),
+    _block(static_cast<char *>(::operator new(count * allocationSize(size)))),
+    _capacity(count * allocationSize(size)),
+    _used(0),
+    _data(data)
+{
+}
+
+
+EventArena::~EventArena()
+{
+    ::operator delete(_block);
+}
+
+
+void EventArena::release()
+{
+    if (!_refCount.deref())
+        delete this;
+}
+
+
+void *EventArena::allocate(size_t size, EventArena *arena)
+{
+    size_t needed = allocationSize(size);
+    char *mem;
+    if (arena && arena->_capacity - arena->_used >= needed) {
+        mem = arena->_block + arena->_used;
+        arena->_used += needed;
+        arena->_refCount.ref();
+    }
+    else {
+        arena = 0;
+        mem = static_cast<char *>(::operator new(HeaderSize + size));
+    }
+    *reinterpret_cast<EventArena **>(mem) = arena;
+    return mem + HeaderSize;
+}
+
+
+void EventArena::free(void *ptr)
+{
+    if (!ptr)
+        return;
+
+    char *mem = static_cast<char *>(ptr) - HeaderSize;
+    EventArena *arena = *reinterpret_cast<EventArena **>(mem);
+    if (arena)
+        arena->release();
+    else
+        ::operator delete(mem);
 }
 
 
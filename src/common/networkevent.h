@@ -21,6 +21,7 @@
 #ifndef NETWORKEVENT_H
 #define NETWORKEVENT_H
 
+#include <QAtomicInt>
 #include <QStringList>
 #include <QVariantList>
 
@@ -84,6 +85,38 @@ private:
 };
 
 
+//! Memory shared by a batch of events, freed once the last of them is deleted
+/** Besides the events themselves, the arena keeps the buffer alive that their data refers to.
+ *  Whoever creates the arena holds a reference to it until calling release().
+ */
+class EventArena
+{
+public:
+    enum { HeaderSize = 16 }; // precedes each allocation, keeps the object aligned
+
+    //! Make room for count objects of up to size bytes
+    EventArena(int count, size_t size, const QByteArray &data);
+
+    inline const QByteArray &data() const { return _data; }
+    void release();
+
+    //! Allocate from arena, or from the heap if arena is 0 or full
+    static void *allocate(size_t size, EventArena *arena);
+    //! Free memory returned by allocate()
+    static void free(void *ptr);
+
+private:
+    ~EventArena();
+    static inline size_t allocationSize(size_t size) { return (HeaderSize + size + HeaderSize - 1) & ~size_t(HeaderSize - 1); }
+
+    QAtomicInt _refCount;
+    char *_block;
+    size_t _capacity;
+    size_t _used;
+    QByteArray _data;
+};
+
+
 class NetworkDataEvent : public NetworkEvent
 {
 public:
@@ -95,6 +128,12 @@ public:
     inline QByteArray data() const { return _data; }
     inline void setData(const QByteArray &data) { _data = data; }
 
+    // events of an incoming batch can be allocated from its arena, cf. CoreNetwork::socketHasData()
+    static inline void *operator new(size_t size) { return EventArena::allocate(size, 0); }
+    static inline void *operator new(size_t size, EventArena *arena) { return EventArena::allocate(size, arena); }
+    static inline void operator delete(void *ptr) { EventArena::free(ptr); }
+    static inline void operator delete(void *ptr, EventArena *) { EventArena::free(ptr); }
+
 protected:
     explicit NetworkDataEvent(EventManager::EventType type, QVariantMap &map, Network *network);
     void toVariantMap(QVariantMap &map) const;
@@ -19,10 +19,12 @@
  ***************************************************************************/
 
 #include "peer.h"
+#include "syncableobject.h"
 
 Peer::Peer(AuthHandler *authHandler, QObject *parent)
     : QObject(parent)
     , _authHandler(authHandler)
+    , _features(0)
 {
 
 }
@@ -34,6 +36,12 @@ AuthHandler *Peer::authHandler() const
 }
 
 
+void Peer::dispatchInitData(SyncableObject *obj)
+{
+    dispatch(Protocol::InitData(obj->syncMetaObject()->className(), obj->objectName(), obj->toVariantMap()));
+}
+
+
 // Note that we need to use a fixed-size integer instead of uintptr_t, in order
 // to avoid issues with different architectures for client and core.
 // In practice, we'll never really have to restore the real value of a PeerPtr from
@@ -27,6 +27,7 @@
 
 #include "authhandler.h"
 #include "protocol.h"
+#include "quassel.h"
 #include "signalproxy.h"
 
 class Peer : public QObject
@@ -50,6 +51,41 @@ public:
 
     virtual int lag() const = 0;
 
+    //! The Quassel::Features of the other side, as announced during the handshake
+    inline Quassel::Features features() const { return _features; }
+    inline void setFeatures(Quassel::Features features) { _features = features; }
+
+    //! Number of bytes written to the peer, but not sent yet
+    virtual qint64 queuedBytes() const { return 0; }
+    //! Whether the peer doesn't keep up with reading what we send, cf. congestionChanged()
+    virtual bool isCongested() const { return false; }
+    //! Send everything dispatched so far right away, instead of once control returns to the event loop
+    virtual void flush() {}
+
+    //! Key of the wire format the peer serializes signal proxy messages into
+    /** Peers returning the same non-zero key turn a message into identical frames, so a broadcast
+     *  is serialized only once and the frame is shared by all of them via writeFrame().
+     *  Peers that don't serialize messages return 0 and always get them via dispatch().
+     */
+    virtual int frameFormat() const { return 0; }
+
+    virtual QByteArray serialize(const Protocol::SyncMessage &) const { return QByteArray(); }
+    virtual QByteArray serialize(const Protocol::RpcCall &) const { return QByteArray(); }
+    virtual QByteArray serialize(const Protocol::InitRequest &) const { return QByteArray(); }
+
+    //! Send a message using a frame created by serialize() of a peer with the same frameFormat()
+    /** The frame may only contain the part of the message that is the same for all peers, so
+     *  the message itself is passed along for the rest.
+     */
+    virtual void writeFrame(const Protocol::SyncMessage &msg, const QByteArray &frame) { Q_UNUSED(msg) Q_UNUSED(frame) }
+    virtual void writeFrame(const Protocol::RpcCall &msg, const QByteArray &frame) { Q_UNUSED(msg) Q_UNUSED(frame) }
+    virtual void writeFrame(const Protocol::InitRequest &msg, const QByteArray &frame) { Q_UNUSED(msg) Q_UNUSED(frame) }
+
+    //! Send the state of an object the other side requested
+    /** The default implementation sends all of it as one InitData.
+     */
+    virtual void dispatchInitData(SyncableObject *obj);
+
 public slots:
     /* Handshake messages */
     virtual void dispatch(const Protocol::RegisterClient &) = 0;
@@ -75,6 +111,7 @@ signals:
     void disconnected();
     void secureStateChanged(bool secure = true);
     void lagUpdated(int msecs);
+    void congestionChanged(bool congested);
 
 protected:
     template<typename T>
@@ -82,6 +119,7 @@ protected:
 
 private:
     QPointer<AuthHandler> _authHandler;
+    Quassel::Features _features;
 };
 
 // We need to special-case Peer* in attached signals/slots, so typedef it for the meta type system
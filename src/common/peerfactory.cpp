@@ -33,23 +33,23 @@ PeerFactory::ProtoList PeerFactory::supportedProtocols()
 }
 
 
-RemotePeer *PeerFactory::createPeer(const ProtoDescriptor &protocol, AuthHandler *authHandler, QTcpSocket *socket, Compressor::CompressionLevel level, QObject *parent)
+RemotePeer *PeerFactory::createPeer(const ProtoDescriptor &protocol, AuthHandler *authHandler, QTcpSocket *socket, Compressor::CompressionLevel level, Compressor::Method method, QObject *parent)
 {
-    return createPeer(ProtoList() << protocol, authHandler, socket, level, parent);
+    return createPeer(ProtoList() << protocol, authHandler, socket, level, method, parent);
 }
 
 
-RemotePeer *PeerFactory::createPeer(const ProtoList &protocols, AuthHandler *authHandler, QTcpSocket *socket, Compressor::CompressionLevel level, QObject *parent)
+RemotePeer *PeerFactory::createPeer(const ProtoList &protocols, AuthHandler *authHandler, QTcpSocket *socket, Compressor::CompressionLevel level, Compressor::Method method, QObject *parent)
 {
     foreach(const ProtoDescriptor &protodesc, protocols) {
         Protocol::Type proto = protodesc.first;
         quint16 features = protodesc.second;
         switch(proto) {
             case Protocol::LegacyProtocol:
-                return new LegacyPeer(authHandler, socket, level, parent);
+                return new LegacyPeer(authHandler, socket, level, method, parent);
             case Protocol::DataStreamProtocol:
                 if (DataStreamPeer::acceptsFeatures(features))
-                    return new DataStreamPeer(authHandler, socket, features, level, parent);
+                    return new DataStreamPeer(authHandler, socket, features, level, method, parent);
                 break;
             default:
                 break;
@@ -38,7 +38,9 @@ enum Type {
 
 enum Feature {
     Encryption = 0x01,
-    Compression = 0x02
+    Compression = 0x02,       // deflate, unless one of the following is set as well
+    ZstdCompression = 0x04,
+    Lz4Compression = 0x08
 };
 
 
@@ -57,16 +59,20 @@ struct HandshakeMessage {
 
 struct RegisterClient : public HandshakeMessage
 {
-    inline RegisterClient(const QString &clientVersion, const QString &buildDate, bool sslSupported = false)
+    inline RegisterClient(const QString &clientVersion, const QString &buildDate, bool sslSupported = false, quint32 clientFeatures = 0)
     : clientVersion(clientVersion)
     , buildDate(buildDate)
-    , sslSupported(sslSupported) {}
+    , sslSupported(sslSupported)
+    , clientFeatures(clientFeatures) {}
 
     QString clientVersion;
     QString buildDate;
 
     // this is only used by the LegacyProtocol in compat mode
     bool sslSupported;
+
+    // Quassel::Features of the client, older clients don't send any
+    quint32 clientFeatures;
 };
 
 
@@ -129,10 +135,15 @@ struct SetupDone : public HandshakeMessage
 struct Login : public HandshakeMessage
 {
     inline Login(const QString &user, const QString &password)
-    : user(user), password(password) {}
+    : user(user), password(password), resumable(false), resumeSequence(0) {}
 
     QString user;
     QString password;
+
+    // the client can resume sessions; if it had one, these identify the session and the last message it got
+    bool resumable;
+    QByteArray resumeToken;
+    quint64 resumeSequence;
 };
 
 
@@ -154,13 +165,17 @@ struct LoginSuccess : public HandshakeMessage
 // TODO: more generic format
 struct SessionState : public HandshakeMessage
 {
-    inline SessionState() {} // needed for QMetaType (for the mono client)
+    inline SessionState() : resumed(false) {} // needed for QMetaType (for the mono client)
     inline SessionState(const QVariantList &identities, const QVariantList &bufferInfos, const QVariantList &networkIds)
-    : identities(identities), bufferInfos(bufferInfos), networkIds(networkIds) {}
+    : identities(identities), bufferInfos(bufferInfos), networkIds(networkIds), resumed(false) {}
 
     QVariantList identities;
     QVariantList bufferInfos;
     QVariantList networkIds;
+
+    // token for resuming this session later; if resumed, the lists are empty and the missed messages follow
+    QByteArray resumeToken;
+    bool resumed;
 };
 
 /*** handled by SignalProxy ***/
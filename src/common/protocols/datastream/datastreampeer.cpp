@@ -24,19 +24,27 @@
 #include <QTcpSocket>
 
 #include "datastreampeer.h"
+#include "network.h"
 
 using namespace Protocol;
 
-DataStreamPeer::DataStreamPeer(::AuthHandler *authHandler, QTcpSocket *socket, quint16 features, Compressor::CompressionLevel level, QObject *parent)
-    : RemotePeer(authHandler, socket, level, parent)
+// Once this many ids are in use, ids are assigned from the start again. The peer simply
+// overwrites its entries when they are redefined, so both tables stay bounded.
+int DataStreamPeer::_maxInternedIds = 0x10000;
+
+// Number of users or channels sent in one chunk of a Network's init data
+int DataStreamPeer::_initChunkSize = 1000;
+
+DataStreamPeer::DataStreamPeer(::AuthHandler *authHandler, QTcpSocket *socket, quint16 features, Compressor::CompressionLevel level, Compressor::Method method, QObject *parent)
+    : RemotePeer(authHandler, socket, level, method, parent),
+    _features(features & supportedFeatures())
 {
-    Q_UNUSED(features);
 }
 
 
 quint16 DataStreamPeer::supportedFeatures()
 {
-    return 0;
+    return InternedIds | ChunkedInitData | CompactInitData;
 }
 
 
@@ -49,7 +57,7 @@ bool DataStreamPeer::acceptsFeatures(quint16 peerFeatures)
 
 quint16 DataStreamPeer::enabledFeatures() const
 {
-    return 0;
+    return _features;
 }
 
 
@@ -57,9 +65,45 @@ void DataStreamPeer::processMessage(const QByteArray &msg)
 {
     QDataStream stream(msg);
     stream.setVersion(QDataStream::Qt_4_2);
+
+    // Messages are QVariantLists, but we decode them item by item. This way we know the request type and
+    // the target of sync calls before decoding the rest, and don't decode what nobody would receive.
+    quint32 count;
+    stream >> count;
     QVariantList list;
-    stream >> list;
-    if (stream.status() != QDataStream::Ok) {
+    if (signalProxy() && count > 0) {
+        QVariant requestType;
+        stream >> requestType;
+        if (stream.status() != QDataStream::Ok) {
+            close("Peer sent corrupt data, closing down!");
+            return;
+        }
+        RequestType type = (RequestType)requestType.value<qint16>();
+        switch (type) {
+            case Sync:
+            case DefineSync:
+            case InternedSync:
+                countReceived();
+                if (!handleSyncMessage(type, stream, count - 1))
+                    close("Peer sent corrupt data, closing down!");
+                return;
+            case RpcCall:
+                countReceived();
+                break;
+            case InitRequest:
+            case InitData:
+            case HeartBeat:
+            case HeartBeatReply:
+                break;
+            default:
+                qWarning() << Q_FUNC_INFO << "Received unknown request type:" << type;
+                return;
+        }
+        list << requestType;
+        --count;
+    }
+
+    if (!readItems(stream, count, list)) {
         close("Peer sent corrupt data, closing down!");
         return;
     }
@@ -72,6 +116,20 @@ void DataStreamPeer::processMessage(const QByteArray &msg)
 }
 
 
+// Same as streaming into a QVariantList, except for the count that has been read already
+bool DataStreamPeer::readItems(QDataStream &stream, quint32 count, QVariantList &items)
+{
+    for (quint32 i = 0; i < count; i++) {
+        QVariant item;
+        stream >> item;
+        if (stream.status() != QDataStream::Ok)
+            return false;
+        items << item;
+    }
+    return stream.status() == QDataStream::Ok;
+}
+
+
 void DataStreamPeer::writeMessage(const QVariantMap &handshakeMsg)
 {
     QVariantList list;
@@ -86,13 +144,18 @@ void DataStreamPeer::writeMessage(const QVariantMap &handshakeMsg)
 
 
 void DataStreamPeer::writeMessage(const QVariantList &sigProxyMsg)
+{
+    writeMessage(serializeMessage(sigProxyMsg));
+}
+
+
+QByteArray DataStreamPeer::serializeMessage(const QVariantList &sigProxyMsg)
 {
     QByteArray data;
     QDataStream msgStream(&data, QIODevice::WriteOnly);
     msgStream.setVersion(QDataStream::Qt_4_2);
     msgStream << sigProxyMsg;
-
-    writeMessage(data);
+    return data;
 }
 
 
@@ -116,7 +179,7 @@ void DataStreamPeer::handleHandshakeMessage(const QVariantList &mapData)
     }
 
     if (msgType == "ClientInit") {
-        handle(RegisterClient(m["ClientVersion"].toString(), m["ClientDate"].toString(), false)); // UseSsl obsolete
+        handle(RegisterClient(m["ClientVersion"].toString(), m["ClientDate"].toString(), false, m["ClientFeatures"].toUInt())); // UseSsl obsolete
     }
 
     else if (msgType == "ClientInitReject") {
@@ -141,7 +204,14 @@ void DataStreamPeer::handleHandshakeMessage(const QVariantList &mapData)
     }
 
     else if (msgType == "ClientLogin") {
-        handle(Login(m["User"].toString(), m["Password"].toString()));
+        Login login(m["User"].toString(), m["Password"].toString());
+        if (m.contains("Resume")) {
+            QVariantMap resume = m["Resume"].toMap();
+            login.resumable = true;
+            login.resumeToken = resume["Token"].toByteArray();
+            login.resumeSequence = resume["Sequence"].toULongLong();
+        }
+        handle(login);
     }
 
     else if (msgType == "ClientLoginReject") {
@@ -154,7 +224,10 @@ void DataStreamPeer::handleHandshakeMessage(const QVariantList &mapData)
 
     else if (msgType == "SessionInit") {
         QVariantMap map = m["SessionState"].toMap();
-        handle(SessionState(map["Identities"].toList(), map["BufferInfos"].toList(), map["NetworkIds"].toList()));
+        SessionState state(map["Identities"].toList(), map["BufferInfos"].toList(), map["NetworkIds"].toList());
+        state.resumeToken = map["ResumeToken"].toByteArray();
+        state.resumed = map["Resumed"].toBool();
+        handle(state);
     }
 
     else {
@@ -168,6 +241,7 @@ void DataStreamPeer::dispatch(const RegisterClient &msg) {
     m["MsgType"] = "ClientInit";
     m["ClientVersion"] = msg.clientVersion;
     m["ClientDate"] = msg.buildDate;
+    m["ClientFeatures"] = msg.clientFeatures;
 
     writeMessage(m);
 }
@@ -236,6 +310,12 @@ void DataStreamPeer::dispatch(const Login &msg)
     m["MsgType"] = "ClientLogin";
     m["User"] = msg.user;
     m["Password"] = msg.password;
+    if (msg.resumable) {
+        QVariantMap resume;
+        resume["Token"] = msg.resumeToken;
+        resume["Sequence"] = msg.resumeSequence;
+        m["Resume"] = resume;
+    }
 
     writeMessage(m);
 }
@@ -271,6 +351,10 @@ void DataStreamPeer::dispatch(const SessionState &msg)
     map["BufferInfos"] = msg.bufferInfos;
     map["NetworkIds"] = msg.networkIds;
     map["Identities"] = msg.identities;
+    if (!msg.resumeToken.isEmpty()) {
+        map["ResumeToken"] = msg.resumeToken;
+        map["Resumed"] = msg.resumed;
+    }
     m["SessionState"] = map;
 
     writeMessage(m);
@@ -279,6 +363,61 @@ void DataStreamPeer::dispatch(const SessionState &msg)
 
 /*** Standard messages ***/
 
+// Sync calls are decoded from the stream directly. The params are only decoded if there is a receiver.
+// Returns false if the data is corrupt.
+bool DataStreamPeer::handleSyncMessage(RequestType requestType, QDataStream &stream, quint32 count)
+{
+    quint32 headerCount = requestType == Sync ? 3 : requestType == DefineSync ? 4 : 1;
+    QVariantList header;
+    if (count < headerCount) {
+        qWarning() << Q_FUNC_INFO << "Received invalid sync call of type" << requestType;
+        return true;
+    }
+    if (!readItems(stream, headerCount, header))
+        return false;
+
+    SyncTarget target;
+    switch (requestType) {
+        case Sync:
+            target = SyncTarget(header[0].toByteArray(), QString::fromUtf8(header[1].toByteArray()), header[2].toByteArray());
+            break;
+        case DefineSync: {
+            int id = header[0].toInt();
+            if (id < 0 || id >= _maxInternedIds) {
+                qWarning() << Q_FUNC_INFO << "Received sync definition with invalid id:" << id;
+                return true;
+            }
+            if (id >= _receivedIds.count())
+                _receivedIds.resize(id + 1);
+            target = SyncTarget(header[1].toByteArray(), QString::fromUtf8(header[2].toByteArray()), header[3].toByteArray());
+            _receivedIds[id] = target;
+            break;
+        }
+        default: {
+            int id = header[0].toInt();
+            if (id < 0 || id >= _receivedIds.count() || _receivedIds.at(id).className.isEmpty()) {
+                qWarning() << Q_FUNC_INFO << "Received sync call for undefined id:" << id;
+                return true;
+            }
+            // the names are shared with the table, no need to decode them again
+            target = _receivedIds.at(id);
+        }
+    }
+
+    if (!signalProxy()->isSyncTarget(target.className, target.objectName)) {
+        qWarning() << QString("no registered receiver for sync call: %1::%2 (objectName=\"%3\")").arg(target.className, target.slotName, target.objectName);
+        return true;
+    }
+
+    QVariantList params;
+    if (!readItems(stream, count - headerCount, params))
+        return false;
+
+    handle(Protocol::SyncMessage(target.className, target.objectName, target.slotName, params));
+    return true;
+}
+
+
 void DataStreamPeer::handlePackedFunc(const QVariantList &packedFunc)
 {
     QVariantList params(packedFunc);
@@ -288,20 +427,9 @@ void DataStreamPeer::handlePackedFunc(const QVariantList &packedFunc)
         return;
     }
 
-    // TODO: make sure that this is a valid request type
+    // processMessage() only passes on known request types, and handles sync calls itself
     RequestType requestType = (RequestType)params.takeFirst().value<qint16>();
     switch (requestType) {
-        case Sync: {
-            if (params.count() < 3) {
-                qWarning() << Q_FUNC_INFO << "Received invalid sync call:" << params;
-                return;
-            }
-            QByteArray className = params.takeFirst().toByteArray();
-            QString objectName = QString::fromUtf8(params.takeFirst().toByteArray());
-            QByteArray slotName = params.takeFirst().toByteArray();
-            handle(Protocol::SyncMessage(className, objectName, slotName, params));
-            break;
-        }
         case RpcCall: {
             if (params.empty()) {
                 qWarning() << Q_FUNC_INFO << "Received empty RPC call!";
@@ -352,26 +480,28 @@ void DataStreamPeer::handlePackedFunc(const QVariantList &packedFunc)
             handle(Protocol::HeartBeatReply(params[0].toDateTime()));
             break;
         }
-
+        default:
+            qWarning() << Q_FUNC_INFO << "Received unexpected request type:" << requestType;
+            break;
     }
 }
 
 
 void DataStreamPeer::dispatch(const Protocol::SyncMessage &msg)
 {
-    dispatchPackedFunc(QVariantList() << (qint16)Sync << msg.className << msg.objectName.toUtf8() << msg.slotName << msg.params);
+    writeFrame(msg, serialize(msg));
 }
 
 
 void DataStreamPeer::dispatch(const Protocol::RpcCall &msg)
 {
-    dispatchPackedFunc(QVariantList() << (qint16)RpcCall << msg.slotName << msg.params);
+    writeFrame(msg, serialize(msg));
 }
 
 
 void DataStreamPeer::dispatch(const Protocol::InitRequest &msg)
 {
-    dispatchPackedFunc(QVariantList() << (qint16)InitRequest << msg.className << msg.objectName.toUtf8());
+    writeMessage(serialize(msg));
 }
 
 
@@ -387,6 +517,40 @@ void DataStreamPeer::dispatch(const Protocol::InitData &msg)
 }
 
 
+void DataStreamPeer::dispatchInitData(SyncableObject *obj)
+{
+    Network *net = qobject_cast<Network *>(obj);
+    if (!net || !(_features & (ChunkedInitData | CompactInitData))) {
+        RemotePeer::dispatchInitData(obj);
+        return;
+    }
+
+    // Serializing all users and channels of a big network at once stalls both sides, so the InitData only carries
+    // the first chunk. The others are added by sync calls, which are guaranteed to arrive before any later update.
+    // The chunks are taken from the network directly, the whole map of users and channels is never built.
+    QList<QVariantMap> chunks;
+    if (_features & ChunkedInitData)
+        chunks = net->ircUsersAndChannelsChunks(_initChunkSize);
+    else
+        chunks << net->initIrcUsersAndChannels();
+    if (chunks.isEmpty())
+        chunks << QVariantMap();
+
+    if (_features & CompactInitData) {
+        for (int i = 0; i < chunks.count(); i++)
+            chunks[i] = Network::compactIrcUsersAndChannels(chunks[i]);
+    }
+
+    QByteArray className(net->syncMetaObject()->className());
+    QVariantMap initData = net->toVariantMap(QStringList() << "IrcUsersAndChannels");
+    initData["IrcUsersAndChannels"] = chunks.takeFirst();
+    dispatch(Protocol::InitData(className, net->objectName(), initData));
+
+    foreach(const QVariantMap &chunk, chunks)
+        dispatch(Protocol::SyncMessage(className, net->objectName(), "addIrcUsersAndChannels", QVariantList() << chunk));
+}
+
+
 void DataStreamPeer::dispatch(const Protocol::HeartBeat &msg)
 {
     dispatchPackedFunc(QVariantList() << (qint16)HeartBeat << msg.timestamp);
@@ -403,3 +567,77 @@ void DataStreamPeer::dispatchPackedFunc(const QVariantList &packedFunc)
 {
     writeMessage(packedFunc);
 }
+
+
+/*** Shared frames for broadcasts ***/
+
+int DataStreamPeer::frameFormat() const
+{
+    // the enabled features may change the encoding
+    return (Protocol::DataStreamProtocol << 16) | enabledFeatures();
+}
+
+
+// For sync messages the frame only holds the params, the names are added by writeSyncFrame().
+// This way the frame can be shared even if each peer uses its own ids for the names.
+QByteArray DataStreamPeer::serialize(const Protocol::SyncMessage &msg) const
+{
+    return serializeParams(msg.params);
+}
+
+
+QByteArray DataStreamPeer::serialize(const Protocol::RpcCall &msg) const
+{
+    return serializeMessage(QVariantList() << (qint16)RpcCall << msg.slotName << msg.params);
+}
+
+
+QByteArray DataStreamPeer::serialize(const Protocol::InitRequest &msg) const
+{
+    return serializeMessage(QVariantList() << (qint16)InitRequest << msg.className << msg.objectName.toUtf8());
+}
+
+
+void DataStreamPeer::writeSyncFrame(const Protocol::SyncMessage &msg, const QByteArray &frame)
+{
+    QVariantList header;
+    if (_features & InternedIds) {
+        SyncTarget target(msg.className, msg.objectName, msg.slotName);
+        QHash<SyncTarget, int>::const_iterator iter = _sentIds.constFind(target);
+        if (iter != _sentIds.constEnd()) {
+            header << (qint16)InternedSync << iter.value();
+        }
+        else {
+            if (_sentIds.count() >= _maxInternedIds)
+                _sentIds.clear();
+            int id = _sentIds.count();
+            _sentIds.insert(target, id);
+            header << (qint16)DefineSync << id << msg.className << msg.objectName.toUtf8() << msg.slotName;
+        }
+    }
+    else {
+        header << (qint16)Sync << msg.className << msg.objectName.toUtf8() << msg.slotName;
+    }
+
+    // this is exactly what streaming header + params as one QVariantList would give
+    QByteArray data;
+    QDataStream msgStream(&data, QIODevice::WriteOnly);
+    msgStream.setVersion(QDataStream::Qt_4_2);
+    msgStream << (quint32)(header.count() + msg.params.count());
+    foreach(const QVariant &item, header)
+        msgStream << item;
+    data.append(frame);
+
+    writeMessage(data);
+}
+
+
+QByteArray DataStreamPeer::serializeParams(const QVariantList &params)
+{
+    QByteArray data;
+    QDataStream paramStream(&data, QIODevice::WriteOnly);
+    paramStream.setVersion(QDataStream::Qt_4_2);
+    foreach(const QVariant &param, params)
+        paramStream << param;
+    return data;
+}
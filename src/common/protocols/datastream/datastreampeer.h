@@ -21,6 +21,9 @@
 #ifndef DATASTREAMPEER_H
 #define DATASTREAMPEER_H
 
+#include <QHash>
+#include <QVector>
+
 #include "../../remotepeer.h"
 
 class QDataStream;
@@ -36,10 +39,18 @@ public:
         InitRequest,
         InitData,
         HeartBeat,
-        HeartBeatReply
+        HeartBeatReply,
+        DefineSync,   // sync message that also assigns an id to its class, object and slot name
+        InternedSync  // sync message addressed by a previously defined id
+    };
+
+    enum Feature {
+        InternedIds = 0x0001,
+        ChunkedInitData = 0x0002,  // Network's users and channels follow the InitData in chunks
+        CompactInitData = 0x0004   // Network's users and channels are sent as Network::compactIrcUsersAndChannels()
     };
 
-    DataStreamPeer(AuthHandler *authHandler, QTcpSocket *socket, quint16 features, Compressor::CompressionLevel level, QObject *parent = 0);
+    DataStreamPeer(AuthHandler *authHandler, QTcpSocket *socket, quint16 features, Compressor::CompressionLevel level, Compressor::Method method, QObject *parent = 0);
 
     Protocol::Type protocol() const { return Protocol::DataStreamProtocol; }
     QString protocolName() const { return "the DataStream protocol"; }
@@ -48,6 +59,11 @@ public:
     static bool acceptsFeatures(quint16 peerFeatures);
     quint16 enabledFeatures() const;
 
+    int frameFormat() const;
+    QByteArray serialize(const Protocol::SyncMessage &msg) const;
+    QByteArray serialize(const Protocol::RpcCall &msg) const;
+    QByteArray serialize(const Protocol::InitRequest &msg) const;
+
     void dispatch(const Protocol::RegisterClient &msg);
     void dispatch(const Protocol::ClientDenied &msg);
     void dispatch(const Protocol::ClientRegistered &msg);
@@ -63,6 +79,7 @@ public:
     void dispatch(const Protocol::RpcCall &msg);
     void dispatch(const Protocol::InitRequest &msg);
     void dispatch(const Protocol::InitData &msg);
+    void dispatchInitData(SyncableObject *obj);
 
     void dispatch(const Protocol::HeartBeat &msg);
     void dispatch(const Protocol::HeartBeatReply &msg);
@@ -74,11 +91,37 @@ private:
     using RemotePeer::writeMessage;
     void writeMessage(const QVariantMap &handshakeMsg);
     void writeMessage(const QVariantList &sigProxyMsg);
+    void writeSyncFrame(const Protocol::SyncMessage &msg, const QByteArray &frame);
+    static QByteArray serializeMessage(const QVariantList &sigProxyMsg);
     void processMessage(const QByteArray &msg);
 
     void handleHandshakeMessage(const QVariantList &mapData);
     void handlePackedFunc(const QVariantList &packedFunc);
+    bool handleSyncMessage(RequestType requestType, QDataStream &stream, quint32 count);
+    static bool readItems(QDataStream &stream, quint32 count, QVariantList &items);
     void dispatchPackedFunc(const QVariantList &packedFunc);
+
+    static QByteArray serializeParams(const QVariantList &params);
+
+    // the names addressed by a sync message
+    struct SyncTarget {
+        QByteArray className;
+        QString objectName;
+        QByteArray slotName;
+
+        SyncTarget() {}
+        SyncTarget(const QByteArray &className, const QString &objectName, const QByteArray &slotName)
+            : className(className), objectName(objectName), slotName(slotName) {}
+        inline bool operator==(const SyncTarget &other) const { return slotName == other.slotName && objectName == other.objectName && className == other.className; }
+        friend inline uint qHash(const SyncTarget &target) { return qHash(target.objectName) ^ qHash(target.slotName) ^ (qHash(target.className) << 1); }
+    };
+
+    quint16 _features;
+    // ids we assigned to the targets of our sync messages, and those the peer assigned to theirs
+    QHash<SyncTarget, int> _sentIds;
+    QVector<SyncTarget> _receivedIds;
+    static int _maxInternedIds;
+    static int _initChunkSize;
 };
 
 #endif
@@ -31,8 +31,8 @@ const uint clientNeedsProtocol = protocolVersion;
 
 using namespace Protocol;
 
-LegacyPeer::LegacyPeer(::AuthHandler *authHandler, QTcpSocket *socket, Compressor::CompressionLevel level, QObject *parent)
-    : RemotePeer(authHandler, socket, level, parent),
+LegacyPeer::LegacyPeer(::AuthHandler *authHandler, QTcpSocket *socket, Compressor::CompressionLevel level, Compressor::Method method, QObject *parent)
+    : RemotePeer(authHandler, socket, level, method, parent),
     _useCompression(false)
 {
 
@@ -97,6 +97,12 @@ void LegacyPeer::processMessage(const QByteArray &msg)
 
 
 void LegacyPeer::writeMessage(const QVariant &item)
+{
+    writeMessage(serializeMessage(item));
+}
+
+
+QByteArray LegacyPeer::serializeMessage(const QVariant &item) const
 {
     QByteArray block;
     QDataStream out(&block, QIODevice::WriteOnly);
@@ -116,7 +122,7 @@ void LegacyPeer::writeMessage(const QVariant &item)
         out << item;
     }
 
-    writeMessage(block);
+    return block;
 }
 
 
@@ -151,7 +157,7 @@ void LegacyPeer::handleHandshakeMessage(const QVariant &msg)
             socket()->setProperty("UseCompression", true);
         }
 #endif
-        handle(RegisterClient(m["ClientVersion"].toString(), m["ClientDate"].toString(), m["UseSsl"].toBool()));
+        handle(RegisterClient(m["ClientVersion"].toString(), m["ClientDate"].toString(), m["UseSsl"].toBool(), m["ClientFeatures"].toUInt()));
     }
 
     else if (msgType == "ClientInitReject") {
@@ -214,6 +220,7 @@ void LegacyPeer::dispatch(const RegisterClient &msg) {
     m["MsgType"] = "ClientInit";
     m["ClientVersion"] = msg.clientVersion;
     m["ClientDate"] = msg.buildDate;
+    m["ClientFeatures"] = msg.clientFeatures;
 
     // FIXME only in compat mode
     m["ProtocolVersion"] = protocolVersion;
@@ -430,19 +437,19 @@ void LegacyPeer::handlePackedFunc(const QVariant &packedFunc)
 
 void LegacyPeer::dispatch(const Protocol::SyncMessage &msg)
 {
-    dispatchPackedFunc(QVariantList() << (qint16)Sync << msg.className << msg.objectName << msg.slotName << msg.params);
+    writeFrame(msg, serialize(msg));
 }
 
 
 void LegacyPeer::dispatch(const Protocol::RpcCall &msg)
 {
-    dispatchPackedFunc(QVariantList() << (qint16)RpcCall << msg.slotName << msg.params);
+    writeFrame(msg, serialize(msg));
 }
 
 
 void LegacyPeer::dispatch(const Protocol::InitRequest &msg)
 {
-    dispatchPackedFunc(QVariantList() << (qint16)InitRequest << msg.className << msg.objectName);
+    writeMessage(serialize(msg));
 }
 
 
@@ -477,6 +484,33 @@ void LegacyPeer::dispatchPackedFunc(const QVariantList &packedFunc)
 }
 
 
+/*** Shared frames for broadcasts ***/
+
+int LegacyPeer::frameFormat() const
+{
+    // the legacy protocol compresses each message on its own, if at all
+    return (Protocol::LegacyProtocol << 16) | (_useCompression ? 1 : 0);
+}
+
+
+QByteArray LegacyPeer::serialize(const Protocol::SyncMessage &msg) const
+{
+    return serializeMessage(QVariant(QVariantList() << (qint16)Sync << msg.className << msg.objectName << msg.slotName << msg.params));
+}
+
+
+QByteArray LegacyPeer::serialize(const Protocol::RpcCall &msg) const
+{
+    return serializeMessage(QVariant(QVariantList() << (qint16)RpcCall << msg.slotName << msg.params));
+}
+
+
+QByteArray LegacyPeer::serialize(const Protocol::InitRequest &msg) const
+{
+    return serializeMessage(QVariant(QVariantList() << (qint16)InitRequest << msg.className << msg.objectName));
+}
+
+
 // Handle the changed format for Network's initData
 // cf. Network::initIrcUsersAndChannels()
 void LegacyPeer::fromLegacyIrcUsersAndChannels(QVariantMap &initData)
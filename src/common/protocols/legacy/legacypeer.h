@@ -37,13 +37,18 @@ public:
         HeartBeatReply
     };
 
-    LegacyPeer(AuthHandler *authHandler, QTcpSocket *socket, Compressor::CompressionLevel level, QObject *parent = 0);
+    LegacyPeer(AuthHandler *authHandler, QTcpSocket *socket, Compressor::CompressionLevel level, Compressor::Method method, QObject *parent = 0);
 
     Protocol::Type protocol() const { return Protocol::LegacyProtocol; }
     QString protocolName() const { return "the legacy protocol"; }
 
     void setSignalProxy(SignalProxy *proxy);
 
+    int frameFormat() const;
+    QByteArray serialize(const Protocol::SyncMessage &msg) const;
+    QByteArray serialize(const Protocol::RpcCall &msg) const;
+    QByteArray serialize(const Protocol::InitRequest &msg) const;
+
     void dispatch(const Protocol::RegisterClient &msg);
     void dispatch(const Protocol::ClientDenied &msg);
     void dispatch(const Protocol::ClientRegistered &msg);
@@ -72,6 +77,7 @@ signals:
 private:
     using RemotePeer::writeMessage;
     void writeMessage(const QVariant &item);
+    QByteArray serializeMessage(const QVariant &item) const;
     void processMessage(const QByteArray &msg);
 
     void handleHandshakeMessage(const QVariant &msg);
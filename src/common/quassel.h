@@ -72,8 +72,12 @@ public:
         SaslExternal = 0x0004,
         HideInactiveNetworks = 0x0008,
         PasswordChange = 0x0010,
+        BacklogSearch = 0x0020,
+        BacklogChunks = 0x0040,         // Backlog replies are preceded by receiveBacklogChunk() calls
+        BacklogRetentionRules = 0x0080, // The core expires backlog according to requestSetBacklogRetention()
+        IrcUserAccount = 0x0100,        // IrcUser knows the setAccount() sync call
 
-        NumFeatures = 0x0010
+        NumFeatures = 0x0100
     };
     Q_DECLARE_FLAGS(Features, Feature);
 
@@ -35,20 +35,35 @@ using namespace Protocol;
 
 const quint32 maxMessageSize = 64 * 1024 * 1024; // This is uncompressed size. 64 MB should be enough for any sort of initData or backlog chunk
 
-RemotePeer::RemotePeer(::AuthHandler *authHandler, QTcpSocket *socket, Compressor::CompressionLevel level, QObject *parent)
+// Once this much data waits to be sent, the peer counts as congested until it's down to the low watermark again
+const qint64 RemotePeer::_highWatermark = 8 * 1024 * 1024;
+const qint64 RemotePeer::_lowWatermark = 1024 * 1024;
+const qint64 RemotePeer::_maxOutputBytes = 64 * 1024 * 1024;
+
+const int RemotePeer::Journal::maxSize = 10000;
+
+RemotePeer::RemotePeer(::AuthHandler *authHandler, QTcpSocket *socket, Compressor::CompressionLevel level, Compressor::Method method, QObject *parent)
     : Peer(authHandler, parent),
     _socket(socket),
-    _compressor(new Compressor(socket, level, this)),
+    _compressor(new Compressor(socket, level, method, this)),
     _signalProxy(0),
     _heartBeatTimer(new QTimer(this)),
     _heartBeatCount(0),
     _lag(0),
-    _msgSize(0)
+    _msgSize(0),
+    _congested(false),
+    _syncFlushTimer(new QTimer(this)),
+    _syncQueueBytes(0),
+    _journaling(false),
+    _resumable(false),
+    _resumeSequence(0),
+    _receivedSequence(0)
 {
     socket->setParent(this);
     connect(socket, SIGNAL(stateChanged(QAbstractSocket::SocketState)), SLOT(onSocketStateChanged(QAbstractSocket::SocketState)));
     connect(socket, SIGNAL(error(QAbstractSocket::SocketError)), SLOT(onSocketError(QAbstractSocket::SocketError)));
     connect(socket, SIGNAL(disconnected()), SIGNAL(disconnected()));
+    connect(socket, SIGNAL(bytesWritten(qint64)), SLOT(onBytesWritten()));
 
 #ifdef HAVE_SSL
     QSslSocket *sslSocket = qobject_cast<QSslSocket *>(socket);
@@ -60,6 +75,11 @@ RemotePeer::RemotePeer(::AuthHandler *authHandler, QTcpSocket *socket, Compresso
     connect(_compressor, SIGNAL(error(Compressor::Error)), SLOT(onCompressionError(Compressor::Error)));
 
     connect(_heartBeatTimer, SIGNAL(timeout()), SLOT(sendHeartBeat()));
+
+    // sync messages are collected until control returns to the event loop
+    _syncFlushTimer->setSingleShot(true);
+    _syncFlushTimer->setInterval(0);
+    connect(_syncFlushTimer, SIGNAL(timeout()), SLOT(onSyncFlushTimeout()));
 }
 
 
@@ -140,6 +160,32 @@ int RemotePeer::lag() const
 }
 
 
+qint64 RemotePeer::queuedBytes() const
+{
+    return socket() ? socket()->bytesToWrite() : 0;
+}
+
+
+bool RemotePeer::isCongested() const
+{
+    return _congested;
+}
+
+
+void RemotePeer::onBytesWritten()
+{
+    if (_congested && queuedBytes() <= _lowWatermark) {
+        _congested = false;
+        qDebug() << "Peer" << description() << "caught up with reading";
+        emit congestionChanged(false);
+
+        // sync messages have been held back in the meantime
+        if (!_syncQueue.isEmpty())
+            flushSyncQueue();
+    }
+}
+
+
 QTcpSocket *RemotePeer::socket() const
 {
     return _socket;
@@ -184,6 +230,7 @@ void RemotePeer::close(const QString &reason)
     }
 
     if (socket() && socket()->state() != QTcpSocket::UnconnectedState) {
+        flushSyncQueue();
         socket()->disconnectFromHost();
     }
 }
@@ -223,9 +270,8 @@ bool RemotePeer::readMessage(QByteArray &msg)
 
     emit transferProgress(_msgSize, _msgSize);
 
-    msg.resize(_msgSize);
-    qint64 bytesRead = _compressor->read(msg.data(), _msgSize);
-    if (bytesRead != _msgSize) {
+    msg = _compressor->read(_msgSize);
+    if (msg.size() != (int)_msgSize) {
         close("Premature end of data stream!");
         return false;
     }
@@ -237,9 +283,205 @@ bool RemotePeer::readMessage(QByteArray &msg)
 
 void RemotePeer::writeMessage(const QByteArray &msg)
 {
+    if (!isOpen())
+        return;
+
+    // queued sync messages have to go out first to keep the order of messages, so while they are
+    // held back for a congested peer, this message has to wait behind them
+    if (!_syncQueue.isEmpty()) {
+        if (_congested) {
+            _syncQueue.append(QueuedSync(msg));
+            _syncQueueBytes += msg.size();
+            checkOutputLimit();
+            return;
+        }
+        flushSyncQueue();
+    }
+
     quint32 size = qToBigEndian<quint32>(msg.size());
     _compressor->write((const char*)&size, 4, Compressor::NoFlush);
     _compressor->write(msg.constData(), msg.size());
+
+    if (!_congested && queuedBytes() > _highWatermark) {
+        _congested = true;
+        qDebug() << "Peer" << description() << "doesn't keep up with reading," << queuedBytes() << "bytes are waiting to be sent";
+        emit congestionChanged(true);
+    }
+    checkOutputLimit();
+}
+
+
+// Like one that stopped sending heartbeats, a peer that stopped reading is given up on before we run out of memory
+void RemotePeer::checkOutputLimit()
+{
+    qint64 bytes = _syncQueueBytes + queuedBytes();
+    if (bytes <= _maxOutputBytes || !isOpen())
+        return;
+
+    qWarning() << "Disconnecting peer:" << description() << "(" << bytes << "bytes are waiting to be sent)";
+    // what is still queued goes to the journal, so the client can resume after all
+    socket()->abort();
+}
+
+
+template<class T>
+void RemotePeer::journal(const T &msg)
+{
+    if (!_journaling)
+        return;
+
+    _journal.append(msg);
+}
+
+
+void RemotePeer::setJournaling(bool enabled)
+{
+    _journaling = enabled;
+    if (!enabled)
+        _journal = Journal();
+}
+
+
+RemotePeer::Journal RemotePeer::takeJournal()
+{
+    // sync messages still in the queue never made it to the client either
+    foreach(const QueuedSync &queued, _syncQueue) {
+        if (!queued.superseded && !queued.raw)
+            journal(queued.msg);
+    }
+    _syncQueue.clear();
+    _queuedSetters.clear();
+    _syncQueueBytes = 0;
+
+    Journal result = _journal;
+    _journal = Journal();
+    return result;
+}
+
+
+bool RemotePeer::isResumable() const
+{
+    return _resumable;
+}
+
+
+QByteArray RemotePeer::resumeToken() const
+{
+    return _resumeToken;
+}
+
+
+quint64 RemotePeer::resumeSequence() const
+{
+    return _resumeSequence;
+}
+
+
+void RemotePeer::setResumeRequest(const QByteArray &token, quint64 sequence)
+{
+    _resumable = true;
+    _resumeToken = token;
+    _resumeSequence = sequence;
+}
+
+
+quint64 RemotePeer::receivedSequence() const
+{
+    return _receivedSequence;
+}
+
+
+void RemotePeer::writeFrame(const SyncMessage &msg, const QByteArray &frame)
+{
+    if (isSupersedable(msg)) {
+        // the older value will never be seen by the peer, so the update can move to the end of the queue
+        SetterKey key(msg);
+        QHash<SetterKey, int>::iterator iter = _queuedSetters.find(key);
+        if (iter != _queuedSetters.end()) {
+            _syncQueue[iter.value()].superseded = true;
+            iter.value() = _syncQueue.count();
+        }
+        else {
+            _queuedSetters.insert(key, _syncQueue.count());
+        }
+    }
+    _syncQueue.append(QueuedSync(msg, frame));
+    _syncQueueBytes += frame.size();
+
+    if (!_syncFlushTimer->isActive())
+        _syncFlushTimer->start();
+    checkOutputLimit();
+}
+
+
+// Needed by whoever sends a lot of messages without returning to the event loop, as neither the queued sync
+// messages nor the socket's write buffer would be sent on before.
+void RemotePeer::flush()
+{
+    if (!_syncQueue.isEmpty() && !_congested)
+        flushSyncQueue();
+    if (socket())
+        socket()->flush();
+}
+
+
+void RemotePeer::writeSyncFrame(const SyncMessage &msg, const QByteArray &frame)
+{
+    Q_UNUSED(msg)
+    writeMessage(frame);
+}
+
+
+// While the peer is congested, sync messages stay in the queue so superseded updates are dropped, rather than
+// sent late. They are only written along with other messages, or once the peer caught up.
+void RemotePeer::onSyncFlushTimeout()
+{
+    if (!_congested)
+        flushSyncQueue();
+}
+
+
+void RemotePeer::flushSyncQueue()
+{
+    _syncFlushTimer->stop();
+
+    // writeMessage() flushes the queue as well, so take it out first
+    QList<QueuedSync> queue;
+    queue.swap(_syncQueue);
+    _queuedSetters.clear();
+    _syncQueueBytes = 0;
+
+    foreach(const QueuedSync &queued, queue) {
+        if (queued.raw) {
+            writeMessage(queued.frame);
+        }
+        else if (!queued.superseded) {
+            journal(queued.msg);
+            writeSyncFrame(queued.msg, queued.frame);
+        }
+    }
+}
+
+
+// A property's WRITE accessor replaces the whole value, so a later call for the same object supersedes an
+// earlier one. Other slots, even if they are called set-something, may have side effects and are never dropped.
+bool RemotePeer::isSupersedable(const SyncMessage &msg) const
+{
+    return msg.params.count() == 1 && signalProxy() && signalProxy()->isPropertyWriter(msg.className, msg.slotName);
+}
+
+
+void RemotePeer::writeFrame(const RpcCall &msg, const QByteArray &frame)
+{
+    journal(msg);
+    writeMessage(frame);
+}
+
+
+void RemotePeer::writeFrame(const InitRequest &msg, const QByteArray &frame)
+{
+    Q_UNUSED(msg)
+    writeMessage(frame);
 }
 
 
@@ -21,7 +21,11 @@
 #ifndef REMOTEPEER_H
 #define REMOTEPEER_H
 
+#include <functional>
+
 #include <QDateTime>
+#include <QHash>
+#include <QList>
 
 #include "compressor.h"
 #include "peer.h"
@@ -41,7 +45,7 @@ public:
     using Peer::handle;
     using Peer::dispatch;
 
-    RemotePeer(AuthHandler *authHandler, QTcpSocket *socket, Compressor::CompressionLevel level, QObject *parent = 0);
+    RemotePeer(AuthHandler *authHandler, QTcpSocket *socket, Compressor::CompressionLevel level, Compressor::Method method, QObject *parent = 0);
 
     void setSignalProxy(SignalProxy *proxy);
 
@@ -55,11 +59,50 @@ public:
 
     int lag() const;
 
+    qint64 queuedBytes() const;
+    bool isCongested() const;
+    void flush();
+
     bool compressionEnabled() const;
     void setCompressionEnabled(bool enabled);
 
     QTcpSocket *socket() const;
 
+    //! Queue a sync message, superseded property updates are dropped before the queue is flushed
+    void writeFrame(const Protocol::SyncMessage &msg, const QByteArray &frame);
+
+    // by default the frame is the complete message
+    virtual void writeFrame(const Protocol::RpcCall &msg, const QByteArray &frame);
+    virtual void writeFrame(const Protocol::InitRequest &msg, const QByteArray &frame);
+
+    //! The sync calls and RPCs written to a client, so they can be replayed when the client resumes its session
+    //! As a broadcast sink, it keeps recording what a disconnected client misses until the client is back
+    struct Journal : public SignalProxy::BroadcastSink {
+        quint64 sequence; // number of messages journaled, including the ones that no longer fit into entries
+        QList<std::function<void(Peer *)> > entries; // the latest messages, each one dispatches itself to the given peer
+        Journal() : sequence(0) {}
+
+        template<class T>
+        void append(const T &msg);
+        void record(const Protocol::SyncMessage &msg) { append(msg); }
+        void record(const Protocol::RpcCall &msg) { append(msg); }
+
+        //! Clients that were away for longer than it takes to send this many messages need a full sync
+        static const int maxSize;
+    };
+
+    void setJournaling(bool enabled);
+    Journal takeJournal();
+
+    //! The session the client asked to resume when logging in, cf. CoreSession::addClient()
+    bool isResumable() const;
+    QByteArray resumeToken() const;
+    quint64 resumeSequence() const;
+    void setResumeRequest(const QByteArray &token, quint64 sequence);
+
+    //! Number of sync calls and RPCs received since the handshake, the client's counterpart to Journal::sequence
+    quint64 receivedSequence() const;
+
 public slots:
     void close(const QString &reason = QString());
 
@@ -72,7 +115,9 @@ protected:
     SignalProxy *signalProxy() const;
 
     void writeMessage(const QByteArray &msg);
+    virtual void writeSyncFrame(const Protocol::SyncMessage &msg, const QByteArray &frame);
     virtual void processMessage(const QByteArray &msg) = 0;
+    inline void countReceived() { _receivedSequence++; }
 
     // These protocol messages get handled internally and won't reach SignalProxy
     void handle(const Protocol::HeartBeat &heartBeat);
@@ -91,8 +136,42 @@ private slots:
     void sendHeartBeat();
     void changeHeartBeatInterval(int secs);
 
+    void onSyncFlushTimeout();
+    void onBytesWritten();
+
 private:
+    void flushSyncQueue();
+    template<class T>
+    void journal(const T &msg);
+
     bool readMessage(QByteArray &msg);
+    bool isSupersedable(const Protocol::SyncMessage &msg) const;
+
+    struct SetterKey {
+        QByteArray className;
+        QString objectName;
+        QByteArray slotName;
+        SetterKey(const Protocol::SyncMessage &msg) : className(msg.className), objectName(msg.objectName), slotName(msg.slotName) {}
+        inline bool operator==(const SetterKey &other) const { return slotName == other.slotName && objectName == other.objectName && className == other.className; }
+        friend inline uint qHash(const SetterKey &key)
+        {
+            // mix the parts in, so equal or swapped ones don't cancel out
+            uint h = qHash(key.className);
+            h ^= qHash(key.objectName) + 0x9e3779b9 + (h << 6) + (h >> 2);
+            h ^= qHash(key.slotName) + 0x9e3779b9 + (h << 6) + (h >> 2);
+            return h;
+        }
+    };
+
+    struct QueuedSync {
+        Protocol::SyncMessage msg;
+        QByteArray frame;
+        bool superseded;
+        bool raw; // frame is a complete message other than a sync call, held back behind the sync calls
+        QueuedSync(const Protocol::SyncMessage &msg, const QByteArray &frame) : msg(msg), frame(frame), superseded(false), raw(false) {}
+        explicit QueuedSync(const QByteArray &frame) : msg(QByteArray(), QString(), QByteArray(), QVariantList()), frame(frame), superseded(false), raw(true) {}
+    };
+    void checkOutputLimit();
 
 private:
     QTcpSocket *_socket;
@@ -102,6 +181,36 @@ private:
     int _heartBeatCount;
     int _lag;
     quint32 _msgSize;
+
+    bool _congested;
+    static const qint64 _highWatermark;
+    static const qint64 _lowWatermark;
+    static const qint64 _maxOutputBytes;
+
+    QTimer *_syncFlushTimer;
+    QList<QueuedSync> _syncQueue;
+    QHash<SetterKey, int> _queuedSetters; // index of the latest update in _syncQueue
+    qint64 _syncQueueBytes;
+
+    bool _journaling;
+    Journal _journal;
+
+    bool _resumable;
+    QByteArray _resumeToken;
+    quint64 _resumeSequence;
+    quint64 _receivedSequence;
 };
 
+
+// inlines
+template<class T>
+void RemotePeer::Journal::append(const T &msg)
+{
+    entries.append([msg](Peer *peer) { peer->dispatch(msg); });
+    sequence++;
+    if (entries.count() > maxSize)
+        entries.removeFirst();
+}
+
+
 #endif
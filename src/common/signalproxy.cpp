@@ -19,6 +19,7 @@
  ***************************************************************************/
 
 #include <QCoreApplication>
+#include <QDataStream>
 #include <QHostAddress>
 #include <QMetaMethod>
 #include <QMetaProperty>
@@ -171,6 +172,9 @@ int SignalProxy::SignalRelay::qt_metacall(QMetaObject::Call _c, int _id, void **
 // ==================================================
 //  SignalProxy
 // ==================================================
+// A peer that keeps on requesting while it doesn't even read the replies is disconnected
+const int SignalProxy::_maxDeferredRequests = 1000;
+
 SignalProxy::SignalProxy(QObject *parent)
     : QObject(parent)
 {
@@ -228,6 +232,7 @@ void SignalProxy::init()
     setHeartBeatInterval(30);
     setMaxHeartBeatCount(2);
     _secure = false;
+    _sourcePeer = 0;
     updateSecureState();
 }
 
@@ -284,6 +289,7 @@ bool SignalProxy::addPeer(Peer *peer)
 
     connect(peer, SIGNAL(disconnected()), SLOT(removePeerBySender()));
     connect(peer, SIGNAL(secureStateChanged(bool)), SLOT(updateSecureState()));
+    connect(peer, SIGNAL(congestionChanged(bool)), SLOT(onPeerCongestionChanged(bool)));
 
     if (!peer->parent())
         peer->setParent(this);
@@ -332,6 +338,7 @@ void SignalProxy::removePeer(Peer *peer)
     peer->setSignalProxy(0);
 
     _peers.remove(peer);
+    _deferredRequests.remove(peer);
     emit peerRemoved(peer);
 
     if (peer->parent() == this)
@@ -350,6 +357,23 @@ void SignalProxy::removePeerBySender()
 }
 
 
+void SignalProxy::onPeerCongestionChanged(bool congested)
+{
+    Peer *peer = qobject_cast<Peer *>(sender());
+    if (congested || !peer)
+        return;
+
+    // stop as soon as the replies congest the peer again
+    while (_deferredRequests.contains(peer) && !peer->isCongested()) {
+        QList<DeferredRequest> &requests = _deferredRequests[peer];
+        SyncMessage request = requests.takeFirst().msg;
+        if (requests.isEmpty())
+            _deferredRequests.remove(peer);
+        handleSync(peer, request, false);
+    }
+}
+
+
 void SignalProxy::renameObject(const SyncableObject *obj, const QString &newname, const QString &oldname)
 {
     if (proxyMode() == Client)
@@ -503,14 +527,93 @@ void SignalProxy::stopSynchronize(SyncableObject *obj)
 }
 
 
+bool SignalProxy::isSyncTarget(const QByteArray &className, const QString &objectName) const
+{
+    QHash<QByteArray, ObjectId>::const_iterator classIter = _syncSlave.constFind(className);
+    return classIter != _syncSlave.constEnd() && classIter->contains(objectName);
+}
+
+
+bool SignalProxy::isPropertyWriter(const QByteArray &className, const QByteArray &slotName) const
+{
+    QHash<QByteArray, ObjectId>::const_iterator classIter = _syncSlave.constFind(className);
+    if (classIter == _syncSlave.constEnd() || classIter->isEmpty())
+        return false;
+
+    // all objects of the class share the ExtendedMetaObject
+    ExtendedMetaObject *eMeta = extendedMetaObject(classIter->constBegin().value());
+    return eMeta && eMeta->isPropertyWriter(slotName);
+}
+
+
+void SignalProxy::setRequiredFeature(const QByteArray &className, const QByteArray &slotName, Quassel::Feature feature)
+{
+    _requiredFeatures[qMakePair(className, slotName)] = feature;
+}
+
+
+bool SignalProxy::isSupported(Peer *peer, const SyncMessage &syncMessage) const
+{
+    if (_requiredFeatures.isEmpty())
+        return true;
+
+    QHash<QPair<QByteArray, QByteArray>, Quassel::Feature>::const_iterator iter = _requiredFeatures.constFind(qMakePair(syncMessage.className, syncMessage.slotName));
+    return iter == _requiredFeatures.constEnd() || peer->features() & iter.value();
+}
+
+
+void SignalProxy::addBroadcastSink(BroadcastSink *sink)
+{
+    if (!_broadcastSinks.contains(sink))
+        _broadcastSinks.append(sink);
+}
+
+
+void SignalProxy::removeBroadcastSink(BroadcastSink *sink)
+{
+    _broadcastSinks.removeAll(sink);
+}
+
+
+void SignalProxy::record(const SyncMessage &syncMessage)
+{
+    foreach(BroadcastSink *sink, _broadcastSinks)
+        sink->record(syncMessage);
+}
+
+
+void SignalProxy::record(const RpcCall &rpcCall)
+{
+    foreach(BroadcastSink *sink, _broadcastSinks)
+        sink->record(rpcCall);
+}
+
+
 template<class T>
 void SignalProxy::dispatch(const T &protoMessage)
 {
+    record(protoMessage);
+
+    // serialize the message once per wire format, the (implicitly shared) frame is reused for all peers
+    QHash<int, QByteArray> frames;
     foreach (Peer *peer, _peers) {
-        if (peer->isOpen())
-            peer->dispatch(protoMessage);
-        else
+        if (!peer->isOpen()) {
             QCoreApplication::postEvent(this, new ::RemovePeerEvent(peer));
+            continue;
+        }
+        if (!isSupported(peer, protoMessage))
+            continue;
+
+        int format = peer->frameFormat();
+        if (!format) {
+            peer->dispatch(protoMessage);
+            continue;
+        }
+
+        QHash<int, QByteArray>::iterator frame = frames.find(format);
+        if (frame == frames.end())
+            frame = frames.insert(format, peer->serialize(protoMessage));
+        peer->writeFrame(protoMessage, frame.value());
     }
 }
 
@@ -527,26 +630,58 @@ void SignalProxy::dispatch(Peer *peer, const T &protoMessage)
 
 void SignalProxy::handle(Peer *peer, const SyncMessage &syncMessage)
 {
-    if (!_syncSlave.contains(syncMessage.className) || !_syncSlave[syncMessage.className].contains(syncMessage.objectName)) {
+    handleSync(peer, syncMessage, true);
+}
+
+
+void SignalProxy::handleSync(Peer *peer, const SyncMessage &syncMessage, bool deferrable)
+{
+    // look up every name only once, this is called for each sync message
+    QHash<QByteArray, ObjectId>::const_iterator classIter = _syncSlave.constFind(syncMessage.className);
+    ObjectId::const_iterator objIter;
+    if (classIter == _syncSlave.constEnd() || (objIter = classIter->constFind(syncMessage.objectName)) == classIter->constEnd()) {
         qWarning() << QString("no registered receiver for sync call: %1::%2 (objectName=\"%3\"). Params are:").arg(syncMessage.className, syncMessage.slotName, syncMessage.objectName)
                    << syncMessage.params;
         return;
     }
 
-    SyncableObject *receiver = _syncSlave[syncMessage.className][syncMessage.objectName];
+    SyncableObject *receiver = objIter.value();
     ExtendedMetaObject *eMeta = extendedMetaObject(receiver);
-    if (!eMeta->slotMap().contains(syncMessage.slotName)) {
+    QHash<QByteArray, int>::const_iterator slotIter = eMeta->slotMap().constFind(syncMessage.slotName);
+    if (slotIter == eMeta->slotMap().constEnd()) {
         qWarning() << QString("no matching slot for sync call: %1::%2 (objectName=\"%3\"). Params are:").arg(syncMessage.className, syncMessage.slotName, syncMessage.objectName)
                    << syncMessage.params;
         return;
     }
 
-    int slotId = eMeta->slotMap()[syncMessage.slotName];
+    int slotId = slotIter.value();
     if (proxyMode() != eMeta->receiverMode(slotId)) {
         qWarning("SignalProxy::handleSync(): invokeMethod for \"%s\" failed. Wrong ProxyMode!", eMeta->methodName(slotId).constData());
         return;
     }
 
+    // Requests with a reply, like fetching backlog, can produce lots of data. Don't pile that onto a peer
+    // that doesn't keep up with reading, but handle them in order once it caught up.
+    if (deferrable && eMeta->receiveMap().contains(slotId) && (peer->isCongested() || _deferredRequests.contains(peer))) {
+        QByteArray key;
+        QDataStream keyStream(&key, QIODevice::WriteOnly);
+        keyStream << syncMessage.className << syncMessage.objectName << syncMessage.slotName << syncMessage.params;
+
+        // the same reply would be sent twice, so the same request only needs to wait once
+        QList<DeferredRequest> &requests = _deferredRequests[peer];
+        foreach(const DeferredRequest &request, requests) {
+            if (request.key == key)
+                return;
+        }
+        if (requests.count() >= _maxDeferredRequests) {
+            qWarning() << "Disconnecting peer:" << peer->description() << "(too many requests while congested)";
+            peer->close(tr("Too many requests"));
+            return;
+        }
+        requests << DeferredRequest(syncMessage, key);
+        return;
+    }
+
     // We can no longer construct a QVariant from QMetaType::Void
     QVariant returnValue;
     int returnType = eMeta->returnType(slotId);
@@ -587,7 +722,7 @@ void SignalProxy::handle(Peer *peer, const InitRequest &initRequest)
     }
 
     SyncableObject *obj = _syncSlave[initRequest.className][initRequest.objectName];
-    peer->dispatch(InitData(initRequest.className, initRequest.objectName, initData(obj)));
+    peer->dispatchInitData(obj);
 }
 
 
@@ -677,7 +812,12 @@ bool SignalProxy::invokeSlot(QObject *receiver, int methodId, const QVariantList
                               : Qt::QueuedConnection;
 
     if (type == Qt::DirectConnection) {
-        return receiver->qt_metacall(QMetaObject::InvokeMetaMethod, methodId, _a) < 0;
+        // slots may call into other peers' handlers, so restore the outer source peer afterwards
+        Peer *outerPeer = _sourcePeer;
+        _sourcePeer = peer;
+        bool result = receiver->qt_metacall(QMetaObject::InvokeMetaMethod, methodId, _a) < 0;
+        _sourcePeer = outerPeer;
+        return result;
     }
     else {
         qWarning() << "Queued Connections are not implemented yet";
@@ -703,12 +843,6 @@ void SignalProxy::requestInit(SyncableObject *obj)
 }
 
 
-QVariantMap SignalProxy::initData(SyncableObject *obj) const
-{
-    return obj->toVariantMap();
-}
-
-
 void SignalProxy::setInitData(SyncableObject *obj, const QVariantMap &properties)
 {
     if (obj->isInitialized())
@@ -737,7 +871,7 @@ void SignalProxy::customEvent(QEvent *event)
 }
 
 
-void SignalProxy::sync_call__(const SyncableObject *obj, SignalProxy::ProxyMode modeType, const char *funcname, va_list ap)
+void SignalProxy::sync_call__(const SyncableObject *obj, SignalProxy::ProxyMode modeType, const char *funcname, const void *const *argv, int argc)
 {
     // qDebug() << obj << modeType << "(" << _proxyMode << ")" << funcname;
     if (modeType != _proxyMode)
@@ -747,7 +881,11 @@ void SignalProxy::sync_call__(const SyncableObject *obj, SignalProxy::ProxyMode
 
     QVariantList params;
 
-    const QList<int> &argTypes = eMeta->argTypes(eMeta->methodId(QByteArray(funcname)));
+    const QList<int> &argTypes = eMeta->argTypes(eMeta->syncMethodId(funcname));
+    if (argc < argTypes.size()) {
+        qWarning() << Q_FUNC_INFO << "got" << argc << "arguments instead of" << argTypes.size() << "for" << QString("%1::%2").arg(eMeta->metaObject()->className()).arg(funcname);
+        return;
+    }
 
     for (int i = 0; i < argTypes.size(); i++) {
         if (argTypes[i] == 0) {
@@ -755,7 +893,7 @@ void SignalProxy::sync_call__(const SyncableObject *obj, SignalProxy::ProxyMode
             qWarning() << "        - make sure all your data types are known by the Qt MetaSystem";
             return;
         }
-        params << QVariant(argTypes[i], va_arg(ap, void *));
+        params << QVariant(argTypes[i], argv[i]);
     }
 
     if (argTypes.size() >= 1 && argTypes[0] == qMetaTypeId<PeerPtr>() && proxyMode() == SignalProxy::Server) {
@@ -794,6 +932,16 @@ void SignalProxy::dumpProxyStats()
     qDebug() << "          attached Slots:" << _attachedSlots.count();
     qDebug() << " number of synced Slaves:" << slaveCount;
     qDebug() << "number of Classes cached:" << _extendedMetaObjects.count();
+
+    int deferredCount = 0;
+    foreach(const QList<DeferredRequest> &requests, _deferredRequests)
+        deferredCount += requests.count();
+    qDebug() << "       deferred Requests:" << deferredCount;
+
+    foreach(Peer *peer, _peers) {
+        qDebug() << "            queued Bytes:" << peer->queuedBytes() << (peer->isCongested() ? "(congested)" : "")
+                 << "for" << peer->description();
+    }
 }
 
 
@@ -865,6 +1013,36 @@ SignalProxy::ExtendedMetaObject::ExtendedMetaObject(const QMetaObject *meta, boo
         }
         _methodIds[method] = i;
     }
+
+    // Qt doesn't tell the name of a WRITE accessor, so go by the setFoo() convention and make sure the slot
+    // takes exactly the property's type
+    for (int i = 0; i < _meta->propertyCount(); i++) {
+        QMetaProperty property = _meta->property(i);
+        if (!property.isWritable())
+            continue;
+
+        QByteArray name(property.name());
+        QByteArray setter = "set" + name.left(1).toUpper() + name.mid(1);
+        int setterId = _methodIds.value(setter, -1);
+        if (setterId == -1)
+            continue;
+
+        QList<QByteArray> paramTypes = _meta->method(setterId).parameterTypes();
+        if (paramTypes.count() == 1 && paramTypes.first() == property.typeName())
+            _propertyWriters.insert(setter);
+    }
+}
+
+
+int SignalProxy::ExtendedMetaObject::syncMethodId(const char *funcname)
+{
+    QHash<const char *, int>::const_iterator iter = _syncMethodIds.constFind(funcname);
+    if (iter != _syncMethodIds.constEnd())
+        return iter.value();
+
+    int id = methodId(QByteArray(funcname));
+    _syncMethodIds.insert(funcname, id);
+    return id;
 }
 
 
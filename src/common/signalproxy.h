@@ -25,6 +25,7 @@
 #include <QSet>
 
 #include "protocol.h"
+#include "quassel.h"
 
 struct QMetaObject;
 class QIODevice;
@@ -67,6 +68,12 @@ public:
 
     void synchronize(SyncableObject *obj);
     void stopSynchronize(SyncableObject *obj);
+    //! Whether there is a synchronized object that would receive sync calls for className and objectName
+    bool isSyncTarget(const QByteArray &className, const QString &objectName) const;
+    //! Whether slotName is the WRITE accessor of a property of the synchronized class className
+    bool isPropertyWriter(const QByteArray &className, const QByteArray &slotName) const;
+    //! Broadcast sync calls of className::slotName only reach peers that announced feature
+    void setRequiredFeature(const QByteArray &className, const QByteArray &slotName, Quassel::Feature feature);
 
     class ExtendedMetaObject;
     ExtendedMetaObject *extendedMetaObject(const QMetaObject *meta) const;
@@ -75,10 +82,26 @@ public:
     inline ExtendedMetaObject *createExtendedMetaObject(const QObject *obj, bool checkConflicts = false) { return createExtendedMetaObject(metaObject(obj), checkConflicts); }
 
     bool isSecure() const { return _secure; }
+
+    //! The peer whose sync or rpc call is currently being handled, 0 outside of that
+    inline Peer *sourcePeer() const { return _sourcePeer; }
     void dumpProxyStats();
     void dumpSyncMap(SyncableObject *object);
     inline int peerCount() const { return _peers.size(); }
 
+    //! Gets a copy of every sync call and RPC that is broadcast to all peers
+    class BroadcastSink
+    {
+    public:
+        virtual ~BroadcastSink() {}
+        virtual void record(const Protocol::SyncMessage &msg) = 0;
+        virtual void record(const Protocol::RpcCall &msg) = 0;
+    };
+
+    //! Broadcasts are recorded into sink until it is removed again, without it being a peer
+    void addBroadcastSink(BroadcastSink *sink);
+    void removeBroadcastSink(BroadcastSink *sink);
+
 public slots:
     void detachObject(QObject *obj);
     void detachSignals(QObject *sender);
@@ -86,11 +109,12 @@ public slots:
 
 protected:
     void customEvent(QEvent *event);
-    void sync_call__(const SyncableObject *obj, ProxyMode modeType, const char *funcname, va_list ap);
+    void sync_call__(const SyncableObject *obj, ProxyMode modeType, const char *funcname, const void *const *argv, int argc);
     void renameObject(const SyncableObject *obj, const QString &newname, const QString &oldname);
 
 private slots:
     void removePeerBySender();
+    void onPeerCongestionChanged(bool congested);
     void objectRenamed(const QByteArray &classname, const QString &newname, const QString &oldname);
     void updateSecureState();
 
@@ -122,7 +146,19 @@ private:
     template<class T>
     void dispatch(Peer *peer, const T &protoMessage);
 
+    // whether a peer knows what to do with a broadcast message
+    bool isSupported(Peer *peer, const Protocol::SyncMessage &syncMessage) const;
+    template<class T>
+    bool isSupported(Peer *, const T &) const { return true; }
+
+    // only sync calls and RPCs are recorded by the broadcast sinks
+    void record(const Protocol::SyncMessage &syncMessage);
+    void record(const Protocol::RpcCall &rpcCall);
+    template<class T>
+    void record(const T &) {}
+
     void handle(Peer *peer, const Protocol::SyncMessage &syncMessage);
+    void handleSync(Peer *peer, const Protocol::SyncMessage &syncMessage, bool deferrable);
     void handle(Peer *peer, const Protocol::RpcCall &rpcCall);
     void handle(Peer *peer, const Protocol::InitRequest &initRequest);
     void handle(Peer *peer, const Protocol::InitData &initData);
@@ -134,12 +170,12 @@ private:
     bool invokeSlot(QObject *receiver, int methodId, const QVariantList &params = QVariantList(), Peer *peer = 0);
 
     void requestInit(SyncableObject *obj);
-    QVariantMap initData(SyncableObject *obj) const;
     void setInitData(SyncableObject *obj, const QVariantMap &properties);
 
     static void disconnectDevice(QIODevice *dev, const QString &reason = QString());
 
     QSet<Peer *> _peers;
+    QList<BroadcastSink *> _broadcastSinks;
 
     // containg a list of argtypes for fast access
     QHash<const QMetaObject *, ExtendedMetaObject *> _extendedMetaObjects;
@@ -156,12 +192,26 @@ private:
     typedef QHash<QString, SyncableObject *> ObjectId;
     QHash<QByteArray, ObjectId> _syncSlave;
 
+    // sync calls older clients don't know, by class and slot name
+    QHash<QPair<QByteArray, QByteArray>, Quassel::Feature> _requiredFeatures;
+
+    // requests that have a reply, held back while their peer is congested
+    struct DeferredRequest {
+        Protocol::SyncMessage msg;
+        QByteArray key; // the serialized message, to recognize a request that is already waiting
+        DeferredRequest(const Protocol::SyncMessage &msg, const QByteArray &key) : msg(msg), key(key) {}
+    };
+    QHash<Peer *, QList<DeferredRequest> > _deferredRequests;
+    static const int _maxDeferredRequests;
+
     ProxyMode _proxyMode;
     int _heartBeatInterval;
     int _maxHeartBeatCount;
 
     bool _secure; // determines if all connections are in a secured state (using ssl or internal connections)
 
+    Peer *_sourcePeer;
+
     friend class SignalRelay;
     friend class SyncableObject;
     friend class Peer;
@@ -203,11 +253,14 @@ public:
     inline int minArgCount(int methodId) { return methodDescriptor(methodId).minArgCount(); }
     inline SignalProxy::ProxyMode receiverMode(int methodId) { return methodDescriptor(methodId).receiverMode(); }
 
-    inline int methodId(const QByteArray &methodName) { return _methodIds.contains(methodName) ? _methodIds[methodName] : -1; }
+    inline int methodId(const QByteArray &methodName) { return _methodIds.value(methodName, -1); }
+    // same as methodId(), but cached by the address of the name as used by SYNC() and REQUEST()
+    int syncMethodId(const char *funcname);
 
     inline int updatedRemotelyId() { return _updatedRemotelyId; }
 
     inline const QHash<QByteArray, int> &slotMap() { return _methodIds; }
+    inline bool isPropertyWriter(const QByteArray &slotName) const { return _propertyWriters.contains(slotName); }
     const QHash<int, int> &receiveMap();
 
     const QMetaObject *metaObject() const { return _meta; }
@@ -223,7 +276,9 @@ private:
 
     QHash<int, MethodDescriptor> _methods;
     QHash<QByteArray, int> _methodIds;
+    QHash<const char *, int> _syncMethodIds;
     QHash<int, int> _receiveMap; // if slot x is called then hand over the result to slot y
+    QSet<QByteArray> _propertyWriters;
 };
 
 #endif
@@ -89,6 +89,12 @@ void SyncableObject::setInitialized()
 
 
 QVariantMap SyncableObject::toVariantMap()
+{
+    return toVariantMap(QStringList());
+}
+
+
+QVariantMap SyncableObject::toVariantMap(const QStringList &excluded)
 {
     QVariantMap properties;
 
@@ -100,7 +106,7 @@ QVariantMap SyncableObject::toVariantMap()
     for (int i = 0; i < meta->propertyCount(); i++) {
         prop = meta->property(i);
         propName = QString(prop.name());
-        if (propName == "objectName")
+        if (propName == "objectName" || excluded.contains(propName))
             continue;
         properties[propName] = prop.read(this);
     }
@@ -111,6 +117,9 @@ QVariantMap SyncableObject::toVariantMap()
         QString methodname(SignalProxy::ExtendedMetaObject::methodName(method));
         if (!methodname.startsWith("init") || methodname.startsWith("initSet") || methodname.startsWith("initDone"))
             continue;
+        QString baseName = SignalProxy::ExtendedMetaObject::methodBaseName(method);
+        if (excluded.contains(baseName))
+            continue;
 
         QVariant::Type variantType = QVariant::nameToType(method.typeName());
         if (variantType == QVariant::Invalid && !QByteArray(method.typeName()).isEmpty()) {
@@ -126,7 +135,7 @@ QVariantMap SyncableObject::toVariantMap()
         QGenericReturnArgument genericvalue = QGenericReturnArgument(method.typeName(), value.data());
         QMetaObject::invokeMethod(this, methodname.toLatin1(), genericvalue);
 
-        properties[SignalProxy::ExtendedMetaObject::methodBaseName(method)] = value;
+        properties[baseName] = value;
     }
     return properties;
 }
@@ -206,14 +215,11 @@ void SyncableObject::requestUpdate(const QVariantMap &properties)
 }
 
 
-void SyncableObject::sync_call__(SignalProxy::ProxyMode modeType, const char *funcname, ...) const
+void SyncableObject::syncCall(SignalProxy::ProxyMode modeType, const char *funcname, const void *const *argv, int argc) const
 {
     //qDebug() << Q_FUNC_INFO << modeType << funcname;
     foreach(SignalProxy *proxy, _signalProxies) {
-        va_list ap;
-        va_start(ap, funcname);
-        proxy->sync_call__(this, modeType, funcname, ap);
-        va_end(ap);
+        proxy->sync_call__(this, modeType, funcname, argv, argc);
     }
 }
 
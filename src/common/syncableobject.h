@@ -24,6 +24,7 @@
 #include <QDataStream>
 #include <QMetaType>
 #include <QObject>
+#include <QStringList>
 #include <QVariantMap>
 
 #include "signalproxy.h"
@@ -42,8 +43,8 @@
 #define SYNC_OTHER(x, ...) sync_call__(SignalProxy::Server, #x, __VA_ARGS__);
 #define REQUEST_OTHER(x, ...) sync_call__(SignalProxy::Client, #x, __VA_ARGS__);
 
-#define ARG(x) const_cast<void *>(reinterpret_cast<const void *>(&x))
-#define NO_ARG 0
+#define ARG(x) x
+#define NO_ARG SyncableObject::NoArg()
 
 class SyncableObject : public QObject
 {
@@ -69,6 +70,11 @@ public:
      */
     virtual QVariantMap toVariantMap();
 
+    //! Like the default toVariantMap(), but leaves out the given properties and init getters
+    /** Saves computing parts of the state that the caller sends by other means.
+     */
+    QVariantMap toVariantMap(const QStringList &excluded);
+
     //! Initialize the object's state from a given QVariantMap.
     /** \see toVariantMap() for important information concerning this method.
      */
@@ -87,7 +93,26 @@ public slots:
     virtual void update(const QVariantMap &properties);
 
 protected:
-    void sync_call__(SignalProxy::ProxyMode modeType, const char *funcname, ...) const;
+    struct NoArg {};
+
+    //! Relay a call of a synced method to the SignalProxies, use the SYNC and REQUEST macros instead
+    /** funcname has to stay valid, the proxies cache the method id by its address.
+     */
+    template<typename... Args>
+    inline void sync_call__(SignalProxy::ProxyMode modeType, const char *funcname, const Args &... args) const
+    {
+        // most objects aren't synchronized most of the time, don't touch the arguments then
+        if (_signalProxies.isEmpty())
+            return;
+        const void *argv[] = { 0, static_cast<const void *>(&args)... };
+        syncCall(modeType, funcname, argv + 1, sizeof...(Args));
+    }
+
+    inline void sync_call__(SignalProxy::ProxyMode modeType, const char *funcname, NoArg) const
+    {
+        if (!_signalProxies.isEmpty())
+            syncCall(modeType, funcname, 0, 0);
+    }
 
     void renameObject(const QString &newName);
     SyncableObject &operator=(const SyncableObject &other);
@@ -98,6 +123,8 @@ signals:
     void updated();
 
 private:
+    void syncCall(SignalProxy::ProxyMode modeType, const char *funcname, const void *const *argv, int argc) const;
+
     void synchronize(SignalProxy *proxy);
     void stopSynchronize(SignalProxy *proxy);
 
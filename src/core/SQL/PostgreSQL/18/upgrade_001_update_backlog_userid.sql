@@ -0,0 +1,4 @@
+UPDATE backlog
+SET userid = buffer.userid
+FROM buffer
+WHERE backlog.bufferid = buffer.bufferid
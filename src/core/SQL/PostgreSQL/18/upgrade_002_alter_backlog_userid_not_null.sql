@@ -0,0 +1 @@
+ALTER TABLE backlog ALTER COLUMN userid SET NOT NULL
@@ -0,0 +1,5 @@
+DELETE FROM backlog
+WHERE bufferid = :bufferid
+    AND userid = :userid
+    AND messageid <= :maxmsg
+    AND (messageid <= :lastmsg OR time < :time)
@@ -0,0 +1,3 @@
+INSERT INTO backlog (time, bufferid, type, flags, senderid, message, userid)
+VALUES ($1, $2, $3, $4, $5, $6, (SELECT userid FROM buffer WHERE bufferid = $2))
+RETURNING messageid
@@ -0,0 +1,2 @@
+INSERT INTO backlog (messageid, time, bufferid, type, flags, senderid, message, userid)
+VALUES (?, ?, ?, ?, ?, ?, ?, (SELECT userid FROM buffer WHERE bufferid = ?))
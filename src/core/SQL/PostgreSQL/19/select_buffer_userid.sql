@@ -0,0 +1,3 @@
+SELECT userid
+FROM buffer
+WHERE bufferid = $1
@@ -0,0 +1,9 @@
+SELECT messageid, bufferid, time,  type, flags, sender, message
+FROM backlog
+JOIN sender ON backlog.senderid = sender.senderid,
+    plainto_tsquery('simple', :query) AS query
+WHERE to_tsvector('simple', message) @@ query
+    AND backlog.userid = :userid
+    AND (:allbuffers OR backlog.bufferid = :bufferid)
+ORDER BY ts_rank(to_tsvector('simple', message), query) DESC, messageid DESC
+LIMIT :limit OFFSET :offset
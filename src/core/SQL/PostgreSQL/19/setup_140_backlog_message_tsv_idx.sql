@@ -0,0 +1 @@
+CREATE INDEX backlog_message_tsv_idx ON backlog USING gin(to_tsvector('simple', message))
@@ -0,0 +1 @@
+ALTER TABLE backlog ADD COLUMN userid INTEGER NOT NULL DEFAULT 0
@@ -0,0 +1,2 @@
+UPDATE backlog
+SET userid = (SELECT userid FROM buffer WHERE buffer.bufferid = backlog.bufferid)
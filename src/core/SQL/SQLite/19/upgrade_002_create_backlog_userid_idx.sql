@@ -0,0 +1 @@
+CREATE INDEX backlog_userid_idx ON backlog(userid)
@@ -0,0 +1,3 @@
+DELETE FROM sender
+WHERE senderid > :first AND senderid <= :last
+    AND NOT EXISTS (SELECT 1 FROM backlog WHERE backlog.senderid = sender.senderid)
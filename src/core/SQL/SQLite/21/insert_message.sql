@@ -0,0 +1,4 @@
+INSERT INTO backlog (time, bufferid, type, flags, senderid, message, userid)
+SELECT :time, bufferid, :type, :flags, :senderid, :message, userid
+FROM buffer
+WHERE bufferid = :bufferid
@@ -0,0 +1,6 @@
+SELECT messageid
+FROM backlog
+WHERE bufferid = :bufferid
+    AND userid = :userid
+ORDER BY messageid DESC
+LIMIT 1 OFFSET :keepcount
@@ -0,0 +1,8 @@
+SELECT messageid, time,  type, flags, sender, message
+FROM backlog
+LEFT JOIN sender ON backlog.senderid = sender.senderid
+WHERE bufferid = :bufferid
+    AND userid = :userid
+    AND (messageid <= :lastmsg OR time < :time)
+ORDER BY messageid ASC
+LIMIT :limit
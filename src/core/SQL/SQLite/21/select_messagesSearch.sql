@@ -0,0 +1,9 @@
+SELECT messageid, bufferid, time,  type, flags, sender, message
+FROM backlog_fts
+JOIN backlog ON backlog.messageid = backlog_fts.docid
+JOIN sender ON backlog.senderid = sender.senderid
+WHERE backlog_fts MATCH :query
+    AND backlog.userid = :userid
+    AND (:allbuffers OR backlog.bufferid = :bufferid)
+ORDER BY messageid DESC
+LIMIT :limit OFFSET :offset
@@ -0,0 +1,6 @@
+SELECT max(senderid)
+FROM (SELECT senderid
+    FROM sender
+    WHERE senderid > :senderid
+    ORDER BY senderid
+    LIMIT :limit) AS batch
@@ -5,4 +5,5 @@ CREATE TABLE backlog (
 	type INTEGER NOT NULL,
 	flags INTEGER NOT NULL,
 	senderid INTEGER NOT NULL,
-	message TEXT)
+	message TEXT,
+	userid INTEGER NOT NULL)
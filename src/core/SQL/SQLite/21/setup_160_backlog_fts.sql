@@ -0,0 +1 @@
+CREATE VIRTUAL TABLE backlog_fts USING fts4(content="backlog", message)
@@ -0,0 +1,4 @@
+CREATE TRIGGER backlog_fts_insert AFTER INSERT ON backlog
+BEGIN
+    INSERT INTO backlog_fts (docid, message) VALUES (new.messageid, new.message);
+END
@@ -0,0 +1,4 @@
+CREATE TRIGGER backlog_fts_delete BEFORE DELETE ON backlog
+BEGIN
+    DELETE FROM backlog_fts WHERE docid = old.messageid;
+END
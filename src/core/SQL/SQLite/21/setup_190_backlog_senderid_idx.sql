@@ -0,0 +1 @@
+CREATE INDEX backlog_senderid_idx ON backlog(senderid)
@@ -23,17 +23,25 @@
 
 #include "logger.h"
 
+#include <QElapsedTimer>
 #include <QMutexLocker>
+#include <QQueue>
 #include <QSqlDriver>
 #include <QSqlError>
 #include <QSqlField>
 #include <QSqlQuery>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <functional>
 
 int AbstractSqlStorage::_nextConnectionId = 0;
 AbstractSqlStorage::AbstractSqlStorage(QObject *parent)
     : Storage(parent),
     _schemaVersion(0)
 {
+    // enough for the hostmasks a busy core sees in a day
+    _senderCache.setMaxCost(20000);
 }
 
 
@@ -42,6 +50,7 @@ AbstractSqlStorage::~AbstractSqlStorage()
     // disconnect the connections, so their deletion is no longer interessting for us
     QHash<QThread *, Connection *>::iterator conIter;
     for (conIter = _connectionPool.begin(); conIter != _connectionPool.end(); ++conIter) {
+        conIter.value()->queryCache().clear();
         QSqlDatabase::removeDatabase(conIter.value()->name());
         disconnect(conIter.value(), 0, this, 0);
     }
@@ -57,6 +66,8 @@ QSqlDatabase AbstractSqlStorage::logDb()
 
     if (!db.isOpen()) {
         qWarning() << "Database connection" << displayName() << "for thread" << QThread::currentThread() << "was lost, attempting to reconnect...";
+        // the prepared statements died with the old connection
+        _connectionPool[QThread::currentThread()]->queryCache().clear();
         dbConnect(db);
     }
 
@@ -64,6 +75,49 @@ QSqlDatabase AbstractSqlStorage::logDb()
 }
 
 
+QSqlQuery AbstractSqlStorage::cachedQuery(const QString &queryName, QSqlDatabase &db)
+{
+    QHash<QString, QSqlQuery> &queryCache = _connectionPool[QThread::currentThread()]->queryCache();
+    QHash<QString, QSqlQuery>::iterator iter = queryCache.find(queryName);
+    if (iter != queryCache.end()) {
+        // release whatever is left of the previous result
+        iter.value().finish();
+        return iter.value();
+    }
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    // don't cache a failed prepare, exec() will report the error to the caller
+    if (query.prepare(queryString(queryName)))
+        queryCache[queryName] = query;
+    return query;
+}
+
+
+int AbstractSqlStorage::cachedSenderId(const QString &sender)
+{
+    QMutexLocker locker(&_senderCacheMutex);
+    int *senderId = _senderCache.object(sender);
+    return senderId ? *senderId : -1;
+}
+
+
+void AbstractSqlStorage::cacheSenderIds(const QHash<QString, int> &senderIds)
+{
+    QMutexLocker locker(&_senderCacheMutex);
+    QHash<QString, int>::const_iterator iter;
+    for (iter = senderIds.constBegin(); iter != senderIds.constEnd(); ++iter)
+        _senderCache.insert(iter.key(), new int(iter.value()));
+}
+
+
+void AbstractSqlStorage::clearSenderCache()
+{
+    QMutexLocker locker(&_senderCacheMutex);
+    _senderCache.clear();
+}
+
+
 void AbstractSqlStorage::addConnectionToPool()
 {
     QMutexLocker locker(&_connectionPoolMutex);
@@ -101,6 +155,22 @@ void AbstractSqlStorage::addConnectionToPool()
 }
 
 
+// A connection is usually deleted along with its thread, which needs an event loop for that
+void AbstractSqlStorage::removeConnectionFromPool()
+{
+    Connection *connection;
+    {
+        QMutexLocker locker(&_connectionPoolMutex);
+        connection = _connectionPool.take(QThread::currentThread());
+    }
+    if (!connection)
+        return;
+
+    disconnect(connection, 0, this, 0);
+    delete connection;
+}
+
+
 void AbstractSqlStorage::dbConnect(QSqlDatabase &db)
 {
     if (!db.open()) {
@@ -332,6 +402,7 @@ AbstractSqlStorage::Connection::Connection(const QString &name, QObject *parent)
 
 AbstractSqlStorage::Connection::~Connection()
 {
+    _queryCache.clear();
     {
         QSqlDatabase db = QSqlDatabase::database(name(), false);
         if (db.isOpen()) {
@@ -433,54 +504,88 @@ void AbstractSqlMigrator::dumpStatus()
 // ========================================
 AbstractSqlMigrationReader::AbstractSqlMigrationReader()
     : AbstractSqlMigrator(),
-    _writer(0)
+    _writer(0),
+    _resumeId(0)
 {
 }
 
 
+int AbstractSqlMigrationReader::_batchSize = 10000;
+int AbstractSqlMigrationReader::_maxQueuedBatches = 4;
+
 bool AbstractSqlMigrationReader::migrateTo(AbstractSqlMigrationWriter *writer)
 {
     if (!transaction()) {
         qWarning() << "AbstractSqlMigrationReader::migrateTo(): unable to start reader's transaction!";
         return false;
     }
-    if (!writer->transaction()) {
-        qWarning() << "AbstractSqlMigrationReader::migrateTo(): unable to start writer's transaction!";
-        rollback(); // close the reader transaction;
-        return false;
-    }
 
     _writer = writer;
 
-    // due to the incompatibility across Migration objects we can't run this in a loop... :/
-    QuasselUserMO quasselUserMo;
-    if (!transferMo(QuasselUser, quasselUserMo))
+    // a checkpoint means that a previous migration into this backend was interrupted
+    MigrationObject resumeMo = QuasselUser;
+    _resumeId = 0;
+    if (_writer->loadCheckpoint(resumeMo, _resumeId)) {
+        qDebug() << qPrintable(QString("Resuming interrupted migration at %1 after id %2...").arg(AbstractSqlMigrator::migrationObject(resumeMo)).arg(_resumeId));
+    }
+    else if (!_writer->transaction() || !_writer->saveCheckpoint(QuasselUser, 0) || !_writer->commit()) {
+        // mark the migration as started, so we notice if it is interrupted before the first batch
+        abortMigration("AbstractSqlMigrationReader::migrateTo(): unable to store the initial checkpoint!");
         return false;
+    }
 
-    IdentityMO identityMo;
-    if (!transferMo(Identity, identityMo))
-        return false;
+    // due to the incompatibility across Migration objects we can't run this in a loop... :/
+    if (resumeMo == QuasselUser) {
+        if (!_writer->transaction()) {
+            abortMigration("AbstractSqlMigrationReader::migrateTo(): unable to start writer's transaction!");
+            return false;
+        }
 
-    IdentityNickMO identityNickMo;
-    if (!transferMo(IdentityNick, identityNickMo))
-        return false;
+        QuasselUserMO quasselUserMo;
+        if (!transferMo(QuasselUser, quasselUserMo))
+            return false;
 
-    NetworkMO networkMo;
-    if (!transferMo(Network, networkMo))
-        return false;
+        IdentityMO identityMo;
+        if (!transferMo(Identity, identityMo))
+            return false;
 
-    BufferMO bufferMo;
-    if (!transferMo(Buffer, bufferMo))
-        return false;
+        IdentityNickMO identityNickMo;
+        if (!transferMo(IdentityNick, identityNickMo))
+            return false;
 
-    SenderMO senderMo;
-    if (!transferMo(Sender, senderMo))
-        return false;
+        NetworkMO networkMo;
+        if (!transferMo(Network, networkMo))
+            return false;
+
+        BufferMO bufferMo;
+        if (!transferMo(Buffer, bufferMo))
+            return false;
+
+        if (!_writer->saveCheckpoint(Sender, 0) || !_writer->commit()) {
+            abortMigration("AbstractSqlMigrationReader::migrateTo(): unable to commit users, identities, networks and buffers!");
+            return false;
+        }
+        resumeMo = Sender;
+    }
+
+    if (resumeMo == Sender) {
+        SenderMO senderMo;
+        senderMo.senderId = _resumeId;
+        if (!transferMoBatched(Sender, senderMo))
+            return false;
+        _resumeId = 0;
+    }
 
     BacklogMO backlogMo;
-    if (!transferMo(Backlog, backlogMo))
+    backlogMo.messageid = _resumeId;
+    if (!transferMoBatched(Backlog, backlogMo))
         return false;
 
+    if (!_writer->transaction()) {
+        abortMigration("AbstractSqlMigrationReader::migrateTo(): unable to start writer's transaction!");
+        return false;
+    }
+
     IrcServerMO ircServerMo;
     if (!transferMo(IrcServer, ircServerMo))
         return false;
@@ -489,8 +594,10 @@ bool AbstractSqlMigrationReader::migrateTo(AbstractSqlMigrationWriter *writer)
     if (!transferMo(UserSetting, userSettingMo))
         return false;
 
-    if (!_writer->postProcess())
+    if (!_writer->postProcess() || !_writer->clearCheckpoint()) {
         abortMigration();
+        return false;
+    }
     return finalizeMigration();
 }
 
@@ -571,3 +678,144 @@ bool AbstractSqlMigrationReader::transferMo(MigrationObject moType, T &mo)
     qDebug() << "Done.";
     return true;
 }
+
+
+namespace {
+// runs the reading side of a batched transfer
+class MigrationReaderThread : public QThread
+{
+public:
+    MigrationReaderThread(std::function<void()> run) : _run(run) {}
+
+protected:
+    virtual void run() { _run(); }
+
+private:
+    std::function<void()> _run;
+};
+}
+
+template<typename T>
+bool AbstractSqlMigrationReader::transferMoBatched(MigrationObject moType, T &mo)
+{
+    resetQuery();
+    _writer->resetQuery();
+    _resumeId = moId(mo);
+
+    if (!_writer->prepareQuery(moType)) {
+        abortMigration(QString("AbstractSqlMigrationReader::migrateTo(): unable to prepare writer query of type %1!").arg(AbstractSqlMigrator::migrationObject(moType)));
+        return false;
+    }
+
+    qDebug() << qPrintable(QString("Transferring %1...").arg(AbstractSqlMigrator::migrationObject(moType)));
+
+    QMutex mutex;
+    QWaitCondition batchQueued;
+    QWaitCondition batchTaken;
+    QQueue<QList<T> > batches;
+    bool readerDone = false;
+    bool writerFailed = false;
+    QString readerError;
+
+    // The reader gets a database connection of its own in its thread. It stays at most
+    // _maxQueuedBatches ahead of the writer, so memory use is bounded.
+    std::function<void()> readBatches = [&]() {
+        if (!prepareQuery(moType)) {
+            resetQuery();
+            closeThreadConnection();
+            QMutexLocker locker(&mutex);
+            readerError = QString("AbstractSqlMigrationReader::migrateTo(): unable to prepare reader query of type %1!").arg(AbstractSqlMigrator::migrationObject(moType));
+            readerDone = true;
+            batchQueued.wakeAll();
+            return;
+        }
+
+        T readerMo = mo;
+        QList<T> batch;
+        forever {
+            bool haveMo = readMo(readerMo);
+            if (haveMo) {
+                batch << readerMo;
+                if (batch.count() < _batchSize)
+                    continue;
+            }
+
+            QMutexLocker locker(&mutex);
+            while (!writerFailed && batches.count() >= _maxQueuedBatches)
+                batchTaken.wait(&mutex);
+            if (writerFailed)
+                break;
+            if (!batch.isEmpty()) {
+                batches.enqueue(batch);
+                batch.clear();
+                batchQueued.wakeAll();
+            }
+            if (!haveMo)
+                break;
+        }
+
+        QMutexLocker locker(&mutex);
+        // readMo() returns false at the end of the data as well as on errors
+        if (lastError().isValid())
+            readerError = QString("AbstractSqlMigrationReader::transferMo(): unable to read Migratable Object of type %1: %2").arg(AbstractSqlMigrator::migrationObject(moType), lastError().text());
+        resetQuery();
+        // the thread has no event loop to clean up after it, and the next one may get the same address
+        closeThreadConnection();
+        readerDone = true;
+        batchQueued.wakeAll();
+    };
+
+    MigrationReaderThread readerThread(readBatches);
+    readerThread.start();
+
+    QElapsedTimer timer;
+    timer.start();
+    qint64 lastReport = 0;
+    qint64 count = 0;
+    int lastId = _resumeId;
+    bool writeError = false;
+    forever {
+        QList<T> batch;
+        {
+            QMutexLocker locker(&mutex);
+            while (batches.isEmpty() && !readerDone)
+                batchQueued.wait(&mutex);
+            if (batches.isEmpty())
+                break;
+            batch = batches.dequeue();
+            batchTaken.wakeAll();
+        }
+
+        writeError = !_writer->transaction();
+        for (int i = 0; !writeError && i < batch.count(); i++)
+            writeError = !_writer->writeMo(batch.at(i));
+        if (!writeError)
+            writeError = !_writer->saveCheckpoint(moType, moId(batch.last())) || !_writer->commit();
+        if (writeError) {
+            QMutexLocker locker(&mutex);
+            writerFailed = true;
+            batchTaken.wakeAll();
+            break;
+        }
+
+        count += batch.count();
+        lastId = moId(batch.last());
+        if (timer.elapsed() - lastReport >= 5000) {
+            lastReport = timer.elapsed();
+            qDebug() << qPrintable(QString("  %1 rows, up to id %2 (%3 rows/sec)").arg(count).arg(lastId).arg(count * 1000 / qMax(lastReport, qint64(1))));
+        }
+    }
+    readerThread.wait();
+
+    if (writeError) {
+        abortMigration(QString("AbstractSqlMigrationReader::transferMo(): unable to transfer Migratable Object of type %1! The migration can be resumed after id %2.").arg(AbstractSqlMigrator::migrationObject(moType)).arg(lastId));
+        return false;
+    }
+    if (!readerError.isNull()) {
+        abortMigration(readerError);
+        return false;
+    }
+
+    qDebug() << qPrintable(QString("Done. %1 rows in %2 seconds (%3 rows/sec)").arg(count).arg(timer.elapsed() / 1000).arg(count * 1000 / qMax(timer.elapsed(), qint64(1))));
+    return true;
+}
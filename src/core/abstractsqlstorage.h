@@ -23,6 +23,8 @@
 
 #include "storage.h"
 
+#include <QCache>
+#include <QMutex>
 #include <QSqlDatabase>
 #include <QSqlQuery>
 #include <QSqlError>
@@ -49,10 +51,22 @@ protected:
     inline virtual void sync() {};
 
     QSqlDatabase logDb();
+    //! Close the calling thread's connection, for threads without an event loop that are about to finish
+    void removeConnectionFromPool();
 
     QString queryString(const QString &queryName, int version);
     inline QString queryString(const QString &queryName) { return queryString(queryName, 0); }
 
+    //! Get a query of the calling thread's connection that has already been prepared
+    /** The query is prepared from queryString() on first use and kept until the connection is
+     *  closed, so later calls neither load the SQL from the resources nor parse it again.
+     *  The returned query is forward only and shares its statement with the cache. Call finish()
+     *  on it before ending the transaction if its results haven't been read up to the end.
+     *  \param queryName  The name of the query, see queryString()
+     *  \param db         The connection returned by logDb() in the calling thread
+     */
+    QSqlQuery cachedQuery(const QString &queryName, QSqlDatabase &db);
+
     QStringList setupQueries();
 
     QStringList upgradeQueries(int ver);
@@ -82,6 +96,25 @@ protected:
      */
     inline virtual bool initDbSession(QSqlDatabase & /* db */) { return true; }
 
+    //! Look up a sender in the senderid cache shared by all threads
+    /** \note This method is threadsafe.
+     *  \return The senderid, or -1 if the sender isn't cached
+     */
+    int cachedSenderId(const QString &sender);
+
+    //! Add senderids to the cache
+    /** Only call this after the transaction that looked up or created the senders has been
+     *  committed, otherwise a rollback could leave ids in the cache that don't exist.
+     *  \note This method is threadsafe.
+     */
+    void cacheSenderIds(const QHash<QString, int> &senderIds);
+
+    //! Forget all cached senderids
+    /** Has to be called whenever senders are deleted from the database.
+     *  \note This method is threadsafe.
+     */
+    void clearSenderCache();
+
 private slots:
     void connectionDestroyed();
 
@@ -99,6 +132,9 @@ private:
     // which allows us thread safe termination of a connection
     class Connection;
     QHash<QThread *, Connection *> _connectionPool;
+
+    QMutex _senderCacheMutex;
+    QCache<QString, int> _senderCache;
 };
 
 
@@ -115,8 +151,12 @@ public:
 
     inline QLatin1String name() const { return QLatin1String(_name); }
 
+    // prepared queries of this connection, only to be used from the connection's thread
+    inline QHash<QString, QSqlQuery> &queryCache() { return _queryCache; }
+
 private:
     QByteArray _name;
+    QHash<QString, QSqlQuery> _queryCache;
 };
 
 
@@ -303,13 +343,32 @@ public:
 
     bool migrateTo(AbstractSqlMigrationWriter *writer);
 
+protected:
+    //! The id after which the transfer of senders and backlog starts
+    /** Non-zero if an interrupted migration is resumed. Readers have to skip all objects with
+     *  an id up to and including this one when preparing the query for those objects.
+     */
+    inline int resumeId() const { return _resumeId; }
+
+    //! Close the database connection of the calling thread, the reader thread of a batched transfer calls this when it is done
+    virtual void closeThreadConnection() = 0;
+
 private:
     void abortMigration(const QString &errorMsg = QString());
     bool finalizeMigration();
 
     template<typename T> bool transferMo(MigrationObject moType, T &mo);
+    // reads in a separate thread and commits every batch together with a checkpoint
+    template<typename T> bool transferMoBatched(MigrationObject moType, T &mo);
+
+    static inline int moId(const SenderMO &sender) { return sender.senderId; }
+    static inline int moId(const BacklogMO &backlog) { return backlog.messageid.toInt(); }
 
     AbstractSqlMigrationWriter *_writer;
+    int _resumeId;
+
+    static int _batchSize;
+    static int _maxQueuedBatches;
 };
 
 
@@ -330,6 +389,24 @@ public:
 
     // called after migration process
     virtual inline bool postProcess() { return true; }
+
+    //! Store how far the migration got
+    /** Senders and backlog are committed in batches. Each batch is committed together with a
+     *  checkpoint naming the last object it contains, so an interrupted migration can continue
+     *  from there. Called within the writer's transaction.
+     */
+    virtual bool saveCheckpoint(MigrationObject mo, int lastId) = 0;
+
+    //! Get the checkpoint of an interrupted migration
+    /** \return true if there is a checkpoint, i.e. a migration into this backend is unfinished
+     */
+    virtual bool loadCheckpoint(MigrationObject &mo, int &lastId) = 0;
+
+    //! Remove the checkpoint once the migration is complete. Called within the writer's transaction.
+    virtual bool clearCheckpoint() = 0;
+
+    inline bool hasCheckpoint() { MigrationObject mo; int lastId; return loadCheckpoint(mo, lastId); }
+
     friend class AbstractSqlMigrationReader;
 };
 
@@ -0,0 +1,242 @@
+/***************************************************************************
+ *   Copyright (C) 2005-2015 by the Quassel Project                        *
+ *   devel@quassel-irc.org                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include "backlogretention.h"
+
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+
+#include "core.h"
+#include "quassel.h"
+
+const int BacklogRetention::_batchSize = 1000;
+const int BacklogRetention::_senderBatchSize = 10000;
+QMutex BacklogRetention::_senderCleanupMutex;
+QDateTime BacklogRetention::_lastSenderCleanup;
+
+namespace {
+
+//! Writes every batch of expired messages into its own compressed archive file
+class ArchiveWriter : public MessageVisitor
+{
+public:
+    ArchiveWriter(const QString &dirPath, int chunkSize) : MessageVisitor(chunkSize), _dirPath(dirPath) {}
+
+protected:
+    bool visit(const MessageList &messages)
+    {
+        const Message &first = messages.first();
+        QDir dir(_dirPath);
+        if (!dir.mkpath(".")) {
+            qWarning() << "BacklogRetention: unable to create archive directory" << _dirPath;
+            return false;
+        }
+
+        QByteArray data;
+        QDataStream out(&data, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_4_2);
+        out << (quint32)messages.count();
+        foreach(const Message &msg, messages)
+            out << msg;
+
+        QFile file(dir.filePath(QString("%1-%2-%3.qarchive")
+                                .arg(first.bufferInfo().bufferId().toInt())
+                                .arg(first.msgId().toInt())
+                                .arg(messages.last().msgId().toInt())));
+        if (!file.open(QIODevice::WriteOnly) || file.write(qCompress(data)) == -1 || !file.flush()) {
+            qWarning() << "BacklogRetention: unable to write archive" << file.fileName() << "-" << file.errorString();
+            file.remove();
+            return false;
+        }
+        return true;
+    }
+
+private:
+    QString _dirPath;
+};
+
+}
+
+
+BacklogRetention::BacklogRetention(UserId user)
+    : QObject(0),
+    _user(user),
+    _passTimer(this),
+    _batchTimer(this),
+    _expiredCount(0),
+    _senderId(-1)
+{
+    if (Quassel::isOptionSet("backlog-archive-dir"))
+        _archiveDir = QDir(Quassel::optionValue("backlog-archive-dir")).filePath(QString::number(user.toInt()));
+
+    {
+        // removing senders scans the whole backlog, so the first run is due a day after the core started
+        // rather than right after every restart
+        QMutexLocker locker(&_senderCleanupMutex);
+        if (!_lastSenderCleanup.isValid())
+            _lastSenderCleanup = QDateTime::currentDateTime().toUTC();
+    }
+
+    connect(&_passTimer, SIGNAL(timeout()), this, SLOT(startPass()));
+    _passTimer.start(qMax(1, Quassel::optionValue("backlog-retention-interval").toInt()) * 60 * 1000);
+
+    // give the database some air between two batches
+    _batchTimer.setInterval(100);
+    connect(&_batchTimer, SIGNAL(timeout()), this, SLOT(processBatch()));
+
+    // expiring and archiving is disk I/O, keep it away from the session's thread
+    moveToThread(&_thread);
+    _thread.start();
+}
+
+
+BacklogRetention::~BacklogRetention()
+{
+    if (_thread.isRunning()) {
+        // a batch that is in progress finishes first
+        QMetaObject::invokeMethod(this, "stop", Qt::BlockingQueuedConnection);
+        _thread.quit();
+        _thread.wait();
+    }
+}
+
+
+void BacklogRetention::stop()
+{
+    _passTimer.stop();
+    _batchTimer.stop();
+}
+
+
+BacklogRetention::Rule BacklogRetention::rule(const BufferInfo &buffer, const QVariantMap &settings)
+{
+    QVariant ruleData = settings["Buffers"].toMap().value(QString::number(buffer.bufferId().toInt()));
+    if (!ruleData.isValid())
+        ruleData = settings["Networks"].toMap().value(QString::number(buffer.networkId().toInt()));
+    if (!ruleData.isValid())
+        ruleData = settings["Default"];
+
+    QVariantMap ruleMap = ruleData.toMap();
+    return Rule(ruleMap["MaxAge"].toInt(), ruleMap["MaxCount"].toInt());
+}
+
+
+void BacklogRetention::startPass()
+{
+    if (_batchTimer.isActive())
+        return; // the previous pass is still running
+
+    QVariantMap settings = Core::getUserSetting(_user, "BacklogRetention").toMap();
+    if (settings.isEmpty())
+        return;
+
+    QDateTime now = QDateTime::currentDateTime().toUTC();
+    foreach(const BufferInfo &buffer, Core::requestBuffers(_user)) {
+        Job job;
+        job.buffer = buffer;
+        job.rule = rule(buffer, settings);
+        if (!job.rule.isValid())
+            continue;
+        if (job.rule.maxAge > 0)
+            job.before = now.addDays(-job.rule.maxAge);
+        _jobs << job;
+    }
+
+    _expiredCount = 0;
+    if (!_jobs.isEmpty())
+        _batchTimer.start();
+}
+
+
+void BacklogRetention::processBatch()
+{
+    if (!_jobs.isEmpty())
+        expireBatch();
+    else if (_senderId != -1)
+        removeSendersBatch();
+    else
+        _batchTimer.stop();
+}
+
+
+void BacklogRetention::expireBatch()
+{
+    const Job &job = _jobs.first();
+    int count;
+    if (_archiveDir.isEmpty()) {
+        count = Core::expireMsgs(_user, job.buffer, job.before, job.rule.maxCount, _batchSize);
+    }
+    else {
+        ArchiveWriter archive(_archiveDir, _batchSize);
+        count = Core::expireMsgs(_user, job.buffer, job.before, job.rule.maxCount, _batchSize, &archive);
+    }
+
+    if (count == -1)
+        qWarning() << "BacklogRetention: unable to expire backlog of buffer" << job.buffer.bufferName() << "for user" << _user.toInt();
+    else
+        _expiredCount += count;
+
+    // a full batch means there is probably more to do in this buffer
+    if (count < _batchSize)
+        _jobs.removeFirst();
+
+    if (_jobs.isEmpty())
+        finishPass();
+}
+
+
+void BacklogRetention::finishPass()
+{
+    if (!_expiredCount) {
+        _batchTimer.stop();
+        return;
+    }
+
+    qDebug() << "BacklogRetention: expired" << _expiredCount << "messages for user" << _user.toInt();
+    _expiredCount = 0;
+
+    // removing senders means scanning the whole backlog, so it's done at most once a day for all sessions
+    QMutexLocker locker(&_senderCleanupMutex);
+    QDateTime now = QDateTime::currentDateTime().toUTC();
+    if (_lastSenderCleanup.secsTo(now) < 24 * 60 * 60) {
+        _batchTimer.stop();
+        return;
+    }
+    _lastSenderCleanup = now;
+    _senderId = 0; // the batch timer keeps running for the cleanup
+}
+
+
+void BacklogRetention::removeSendersBatch()
+{
+    int lastSenderId = _senderId;
+    if (Core::removeUnusedSenders(_senderId, _senderBatchSize) == -1) {
+        qWarning() << "BacklogRetention: unable to remove unused senders";
+        _senderId = -1;
+    }
+    else if (_senderId == lastSenderId) {
+        _senderId = -1; // all senders checked
+    }
+
+    if (_senderId == -1)
+        _batchTimer.stop();
+}
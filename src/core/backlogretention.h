@@ -0,0 +1,101 @@
+/***************************************************************************
+ *   Copyright (C) 2005-2015 by the Quassel Project                        *
+ *   devel@quassel-irc.org                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef BACKLOGRETENTION_H
+#define BACKLOGRETENTION_H
+
+#include <QDateTime>
+#include <QMutex>
+#include <QThread>
+#include <QTimer>
+#include <QVariant>
+
+#include "bufferinfo.h"
+#include "types.h"
+
+//! Expires old backlog of a user according to the user's retention rules
+/** The rules are stored in the user setting "BacklogRetention", a map of the form
+ *  \code
+ *  "Default"  => { "MaxAge" => days, "MaxCount" => messages }
+ *  "Networks" => { "<networkId>" => { "MaxAge" => ..., "MaxCount" => ... }, ... }
+ *  "Buffers"  => { "<bufferId>" => { "MaxAge" => ..., "MaxCount" => ... }, ... }
+ *  \endcode
+ *  A buffer rule takes precedence over its network's rule, which in turn takes precedence over
+ *  the default. A value of 0 disables the respective limit. Clients edit the rules through
+ *  BacklogManager::requestSetBacklogRetention().
+ *
+ *  Once every --backlog-retention-interval minutes all buffers are checked. The work is done in
+ *  the retention's own thread, in small batches, so a large cleanup never blocks the session or
+ *  the database for long. If --backlog-archive-dir is set, every batch is written to a
+ *  compressed archive file before it is deleted.
+ */
+class BacklogRetention : public QObject
+{
+    Q_OBJECT
+
+public:
+    BacklogRetention(UserId user);
+    ~BacklogRetention();
+
+    struct Rule {
+        int maxAge;   ///< in days
+        int maxCount;
+        Rule(int maxAge = 0, int maxCount = 0) : maxAge(maxAge), maxCount(maxCount) {}
+        inline bool isValid() const { return maxAge > 0 || maxCount > 0; }
+    };
+
+    static Rule rule(const BufferInfo &buffer, const QVariantMap &settings);
+
+public slots:
+    //! Check all buffers of the user for expired messages
+    void startPass();
+
+private slots:
+    void processBatch();
+    void stop();
+
+private:
+    struct Job {
+        BufferInfo buffer;
+        Rule rule;
+        QDateTime before;
+    };
+
+    void expireBatch();
+    void removeSendersBatch();
+    void finishPass();
+
+    UserId _user;
+    QString _archiveDir;
+    QThread _thread;
+    QTimer _passTimer;
+    QTimer _batchTimer;
+    QList<Job> _jobs;
+    int _expiredCount;
+    int _senderId;  ///< last sender checked by a running sender cleanup, -1 if none is running
+
+    static const int _batchSize;
+    static const int _senderBatchSize;
+    static QMutex _senderCleanupMutex;
+    static QDateTime _lastSenderCleanup;
+};
+
+
+#endif
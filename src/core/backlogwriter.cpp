@@ -0,0 +1,174 @@
+/***************************************************************************
+ *   Copyright (C) 2005-2015 by the Quassel Project                        *
+ *   devel@quassel-irc.org                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include "backlogwriter.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+
+#include "storage.h"
+
+const int BacklogWriter::MessagesStoredEventId = QEvent::registerEventType();
+
+BacklogWriter::BacklogWriter(Storage *storage, Durability durability, int flushInterval, int flushSize)
+    : QObject(0),
+    _storage(storage),
+    _durability(durability),
+    _flushSize(qMax(1, flushSize)),
+    _flushTimer(this),
+    _pendingCount(0),
+    _flushRequested(false)
+{
+    if (!isDeferred())
+        return;
+
+    _flushTimer.setInterval(qMax(1, flushInterval));
+    connect(&_flushTimer, SIGNAL(timeout()), this, SLOT(flush()));
+
+    moveToThread(&_thread);
+    connect(&_thread, SIGNAL(started()), this, SLOT(start()));
+    _thread.start();
+}
+
+
+BacklogWriter::~BacklogWriter()
+{
+    if (_thread.isRunning()) {
+        // commit whatever is still pending from within the writer thread
+        QMetaObject::invokeMethod(this, "stop", Qt::BlockingQueuedConnection);
+        _thread.quit();
+        _thread.wait();
+    }
+}
+
+
+BacklogWriter::Durability BacklogWriter::durabilityFromString(const QString &durability, bool *ok)
+{
+    if (ok)
+        *ok = true;
+
+    QString mode = durability.toLower();
+    if (mode == "batched")
+        return Batched;
+    if (mode == "async")
+        return Async;
+    if (mode != "per-message" && ok)
+        *ok = false;
+    return PerMessage;
+}
+
+
+void BacklogWriter::start()
+{
+    if (_durability == Async)
+        _storage->setAsyncCommit(true);
+    _flushTimer.start();
+}
+
+
+void BacklogWriter::stop()
+{
+    _flushTimer.stop();
+    flush();
+}
+
+
+void BacklogWriter::addReceiver(QObject *receiver)
+{
+    QMutexLocker locker(&_mutex);
+    _receivers.insert(receiver);
+}
+
+
+void BacklogWriter::removeReceiver(QObject *receiver)
+{
+    QMutexLocker locker(&_mutex);
+    _receivers.remove(receiver);
+}
+
+
+void BacklogWriter::enqueue(QObject *receiver, const MessageList &messages)
+{
+    if (messages.isEmpty())
+        return;
+
+    QMutexLocker locker(&_mutex);
+    Batch batch;
+    batch.receiver = receiver;
+    batch.messages = messages;
+    _pending << batch;
+    _pendingCount += messages.count();
+
+    if (_pendingCount >= _flushSize && !_flushRequested) {
+        _flushRequested = true;
+        QMetaObject::invokeMethod(this, "flush", Qt::QueuedConnection);
+    }
+}
+
+
+void BacklogWriter::flush()
+{
+    QList<Batch> batches;
+    {
+        QMutexLocker locker(&_mutex);
+        batches.swap(_pending);
+        _pendingCount = 0;
+        _flushRequested = false;
+    }
+    if (batches.isEmpty())
+        return;
+
+    MessageList messages;
+    for (int i = 0; i < batches.count(); i++)
+        messages += batches[i].messages;
+
+    if (_storage->logMessages(messages)) {
+        // hand the msgIds back to the batches they belong to
+        int offset = 0;
+        for (int i = 0; i < batches.count(); i++) {
+            MessageList &batchMessages = batches[i].messages;
+            for (int j = 0; j < batchMessages.count(); j++)
+                batchMessages[j].setMsgId(messages[offset + j].msgId());
+            offset += batchMessages.count();
+        }
+        deliver(batches);
+        return;
+    }
+
+    // the group commit failed as a whole, don't let a single bad batch take the others with it
+    qWarning() << "BacklogWriter: group commit of" << messages.count() << "messages failed, storing batches separately";
+    QList<Batch> stored;
+    for (int i = 0; i < batches.count(); i++) {
+        if (_storage->logMessages(batches[i].messages))
+            stored << batches[i];
+    }
+    deliver(stored);
+}
+
+
+void BacklogWriter::deliver(const QList<Batch> &batches)
+{
+    QMutexLocker locker(&_mutex);
+    for (int i = 0; i < batches.count(); i++) {
+        const Batch &batch = batches.at(i);
+        if (_receivers.contains(batch.receiver))
+            QCoreApplication::postEvent(batch.receiver, new MessagesStoredEvent(batch.messages));
+    }
+}
@@ -0,0 +1,121 @@
+/***************************************************************************
+ *   Copyright (C) 2005-2015 by the Quassel Project                        *
+ *   devel@quassel-irc.org                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef BACKLOGWRITER_H
+#define BACKLOGWRITER_H
+
+#include <QEvent>
+#include <QMutex>
+#include <QPointer>
+#include <QSet>
+#include <QThread>
+#include <QTimer>
+
+#include "message.h"
+
+class Storage;
+
+//! Coalesces messages of all sessions into group commits
+/** Sessions hand their messages to the writer instead of storing them one transaction
+ *  at a time. The writer collects them in its own thread and stores everything that
+ *  accumulated either every flushInterval milliseconds or as soon as flushSize messages
+ *  are pending, whichever comes first. Once a batch is committed, the stored messages
+ *  (now carrying their msgIds) are posted back to the session as a MessagesStoredEvent.
+ *
+ *  In PerMessage mode the writer is not used at all and sessions store synchronously.
+ */
+class BacklogWriter : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Durability {
+        PerMessage,  ///< Every batch of a session is committed synchronously (default)
+        Batched,     ///< Group commit, committed batches are durable
+        Async        ///< Group commit without waiting for the commit to reach the disk
+    };
+
+    BacklogWriter(Storage *storage, Durability durability, int flushInterval, int flushSize);
+    ~BacklogWriter();
+
+    static Durability durabilityFromString(const QString &durability, bool *ok = 0);
+
+    inline Durability durability() const { return _durability; }
+    inline bool isDeferred() const { return _durability != PerMessage; }
+
+    //! Register a receiver for MessagesStoredEvents
+    /** \note This method is threadsafe.
+     */
+    void addReceiver(QObject *receiver);
+
+    //! Stop delivering events to the receiver
+    /** Messages already queued for the receiver are still stored.
+     *  \note This method is threadsafe. After it returns, no further events are posted to the receiver.
+     */
+    void removeReceiver(QObject *receiver);
+
+    //! Queue messages for storage
+    /** \note This method is threadsafe.
+     *  \param receiver The object the stored messages are posted back to
+     *  \param messages The messages to store, in order
+     */
+    void enqueue(QObject *receiver, const MessageList &messages);
+
+    static const int MessagesStoredEventId;
+
+    class MessagesStoredEvent : public QEvent
+    {
+    public:
+        MessagesStoredEvent(const MessageList &msgs) : QEvent(QEvent::Type(MessagesStoredEventId)), messages(msgs) {}
+        MessageList messages;
+    };
+
+public slots:
+    //! Commit all pending messages in one transaction
+    void flush();
+
+private slots:
+    void start();
+    void stop();
+
+private:
+    struct Batch {
+        QObject *receiver;
+        MessageList messages;
+    };
+
+    void deliver(const QList<Batch> &batches);
+
+    Storage *_storage;
+    Durability _durability;
+    int _flushSize;
+
+    QThread _thread;
+    QTimer _flushTimer;
+
+    QMutex _mutex;
+    QList<Batch> _pending;
+    int _pendingCount;
+    bool _flushRequested;
+    QSet<QObject *> _receivers;
+};
+
+
+#endif
@@ -83,7 +83,8 @@ void Core::destroy()
 
 Core::Core()
     : QObject(),
-      _storage(0)
+      _storage(0),
+      _backlogWriter(0)
 {
 #ifdef HAVE_UMASK
     umask(S_IRWXG | S_IRWXO);
@@ -223,6 +224,7 @@ Core::~Core()
         handler->deleteLater(); // disconnect non authed clients
     }
     qDeleteAll(_sessions);
+    delete _backlogWriter; // commits everything the sessions left behind
     qDeleteAll(_storageBackends);
 }
 
@@ -392,10 +394,27 @@ bool Core::initStorage(const QString &backend, const QVariantMap &settings, bool
         connect(storage, SIGNAL(bufferInfoUpdated(UserId, const BufferInfo &)), this, SIGNAL(bufferInfoUpdated(UserId, const BufferInfo &)));
     }
     _storage = storage;
+    initBacklogWriter();
     return true;
 }
 
 
+// Called whenever the storage is (re)initialized, which happens before any session is created
+void Core::initBacklogWriter()
+{
+    bool ok;
+    BacklogWriter::Durability durability = BacklogWriter::durabilityFromString(Quassel::optionValue("log-durability"), &ok);
+    if (!ok)
+        qWarning() << qPrintable(tr("Invalid log durability \"%1\", using \"per-message\"").arg(Quassel::optionValue("log-durability")));
+
+    int flushInterval = Quassel::optionValue("log-flush-interval").toInt();
+    int flushSize = Quassel::optionValue("log-flush-size").toInt();
+
+    delete _backlogWriter;
+    _backlogWriter = new BacklogWriter(_storage, durability, flushInterval, flushSize);
+}
+
+
 void Core::syncStorage()
 {
     if (_storage)
@@ -680,6 +699,10 @@ bool Core::selectBackend(const QString &backend)
     Storage::State storageState = storage->init(settings);
     switch (storageState) {
     case Storage::IsReady:
+        if (hasPendingMigration(storage)) {
+            qWarning() << "Resuming interrupted migration to:" << qPrintable(backend);
+            break;
+        }
         saveBackendSettings(backend, settings);
         qWarning() << "Switched backend to:" << qPrintable(backend);
         qWarning() << "Backend already initialized. Skipping Migration";
@@ -697,9 +720,8 @@ bool Core::selectBackend(const QString &backend)
             qWarning() << qPrintable(QString("Core::migrateBackend(): unable to initialize backend: %1").arg(backend));
             return false;
         }
-
-        saveBackendSettings(backend, settings);
-        qWarning() << "Switched backend to:" << qPrintable(backend);
+        // the settings are saved once we know whether there is something to migrate, so an
+        // interrupted migration can be resumed from the old backend
         break;
     }
 
@@ -717,6 +739,7 @@ bool Core::selectBackend(const QString &backend)
             saveBackendSettings(backend, settings);
             return true;
         }
+        qWarning() << "Migration was not completed. Select the same backend again to resume it.";
         return false;
         qWarning() << qPrintable(QString("Core::migrateDb(): unable to migrate storage backend! (No migration writer for %1)").arg(backend));
     }
@@ -733,6 +756,8 @@ bool Core::selectBackend(const QString &backend)
     }
 
     // so we were unable to merge, but let's create a user \o/
+    saveBackendSettings(backend, settings);
+    qWarning() << "Switched backend to:" << qPrintable(backend);
     _storage = storage;
     createUser();
     return true;
@@ -846,6 +871,18 @@ AbstractSqlMigrationReader *Core::getMigrationReader(Storage *storage)
 }
 
 
+bool Core::hasPendingMigration(Storage *storage)
+{
+    AbstractSqlMigrationWriter *writer = getMigrationWriter(storage);
+    if (!writer)
+        return false;
+
+    bool pending = writer->hasCheckpoint();
+    delete writer;
+    return pending;
+}
+
+
 AbstractSqlMigrationWriter *Core::getMigrationWriter(Storage *storage)
 {
     if (!storage)
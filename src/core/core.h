@@ -34,6 +34,7 @@
 #  include <QTcpServer>
 #endif
 
+#include "backlogwriter.h"
 #include "bufferinfo.h"
 #include "message.h"
 #include "oidentdconfiggenerator.h"
@@ -348,6 +349,15 @@ public:
     }
 
 
+    //! The write-behind stage shared by all sessions
+    /** The writer is created together with the storage backend and lives until the core is destroyed,
+     *  after all sessions. Since sessions only exist on a configured core, they can always use it.
+     *  \note Sessions should only hand messages to the writer if BacklogWriter::isDeferred() is set.
+     *  \return The writer, or 0 if the core is not configured yet
+     */
+    static inline BacklogWriter *backlogWriter() { return instance()->_backlogWriter; }
+
+
     //! Request a certain number messages stored in a given buffer.
     /** \param buffer   The buffer we request messages from
      *  \param first    if != -1 return only messages with a MsgId >= first
@@ -373,6 +383,80 @@ public:
     }
 
 
+    //! Stream a certain number messages stored in a given buffer into a visitor.
+    /** \note This method is threadsafe.
+     *
+     *  \param visitor  The visitor receiving the messages in chunks
+     *  \sa requestMsgs()
+     *  \return true if the query succeeded
+     */
+    static inline bool visitMsgs(UserId user, BufferId bufferId, MessageVisitor &visitor, MsgId first = -1, MsgId last = -1, int limit = -1)
+    {
+        return instance()->_storage->visitMsgs(user, bufferId, visitor, first, last, limit);
+    }
+
+
+    //! Stream a certain number of messages across all buffers into a visitor.
+    /** \note This method is threadsafe.
+     *
+     *  \param visitor  The visitor receiving the messages in chunks
+     *  \sa requestAllMsgs()
+     *  \return true if the query succeeded
+     */
+    static inline bool visitAllMsgs(UserId user, MessageVisitor &visitor, MsgId first = -1, MsgId last = -1, int limit = -1)
+    {
+        return instance()->_storage->visitAllMsgs(user, visitor, first, last, limit);
+    }
+
+
+    //! Stream the messages matching a full-text search into a visitor.
+    /** \note This method is threadsafe.
+     *
+     *  \param user      The owner of the messages
+     *  \param query     The words to search for
+     *  \param bufferId  If valid, only messages of this buffer are searched
+     *  \param visitor   The visitor receiving the matching messages
+     *  \param offset    Number of matches to skip
+     *  \param limit     Max amount of messages
+     *  \return true if the query succeeded
+     */
+    static inline bool searchMsgs(UserId user, const QString &query, BufferId bufferId, MessageVisitor &visitor, int offset, int limit)
+    {
+        return instance()->_storage->searchMsgs(user, query, bufferId, visitor, offset, limit);
+    }
+
+
+    //! Delete a batch of expired messages from a buffer
+    /** \note This method is threadsafe.
+     *
+     *  \param user       The owner of the buffer
+     *  \param buffer     The buffer to clean up
+     *  \param before     Messages older than this are expired. Ignored if invalid.
+     *  \param keepCount  Number of newest messages to keep. Ignored if 0.
+     *  \param batchSize  Maximum number of messages to delete
+     *  \param archive    Receives the messages before they are deleted, may be 0
+     *  \return The number of deleted messages, or -1 on error
+     */
+    static inline int expireMsgs(UserId user, const BufferInfo &buffer, const QDateTime &before, int keepCount, int batchSize, MessageVisitor *archive = 0)
+    {
+        return instance()->_storage->expireMsgs(user, buffer, before, keepCount, batchSize, archive);
+    }
+
+
+    //! Delete the senders of a batch that are no longer referenced by any message
+    /** \note This method is threadsafe.
+     *
+     *  \param senderId   The last sender checked by the previous batch, 0 to start. Is set to the last
+     *                    sender checked by this batch, and left unchanged once all senders are checked.
+     *  \param batchSize  Maximum number of senders to check
+     *  \return The number of deleted senders, or -1 on error
+     */
+    static inline int removeUnusedSenders(int &senderId, int batchSize)
+    {
+        return instance()->_storage->removeUnusedSenders(senderId, batchSize);
+    }
+
+
     //! Request a list of all buffers known to a user.
     /** This method is used to get a list of all buffers we have stored a backlog from.
      *  \note This method is threadsafe.
@@ -553,12 +637,14 @@ private:
     bool selectBackend(const QString &backend);
     bool createUser();
     void saveBackendSettings(const QString &backend, const QVariantMap &settings);
+    void initBacklogWriter();
     QVariantMap promptForSettings(const Storage *storage);
 
 private:
     QSet<CoreAuthHandler *> _connectingClients;
     QHash<UserId, SessionThread *> _sessions;
     Storage *_storage;
+    BacklogWriter *_backlogWriter;
     QTimer _storageSyncTimer;
 
 #ifdef HAVE_SSL
@@ -577,6 +663,8 @@ private:
 
     static AbstractSqlMigrationReader *getMigrationReader(Storage *storage);
     static AbstractSqlMigrationWriter *getMigrationWriter(Storage *storage);
+    // true if a migration into storage was interrupted and can be resumed
+    static bool hasPendingMigration(Storage *storage);
     static void stdInEcho(bool on);
     static inline void enableStdInEcho() { stdInEcho(true); }
     static inline void disableStdInEcho() { stdInEcho(false); }
@@ -63,7 +63,7 @@ void CoreAuthHandler::onReadyRead()
             // no magic, assume legacy protocol
             qDebug() << "Legacy client detected, switching to compatibility mode";
             _legacy = true;
-            RemotePeer *peer = PeerFactory::createPeer(PeerFactory::ProtoDescriptor(Protocol::LegacyProtocol, 0), this, socket(), Compressor::NoCompression, this);
+            RemotePeer *peer = PeerFactory::createPeer(PeerFactory::ProtoDescriptor(Protocol::LegacyProtocol, 0), this, socket(), Compressor::NoCompression, Compressor::Deflate, this);
             connect(peer, SIGNAL(protocolVersionMismatch(int,int)), SLOT(onProtocolVersionMismatch(int,int)));
             setPeer(peer);
             return;
@@ -74,8 +74,14 @@ void CoreAuthHandler::onReadyRead()
         // figure out which connection features we'll use based on the client's support
         if (Core::sslSupported() && (features & Protocol::Encryption))
             _connectionFeatures |= Protocol::Encryption;
-        if (features & Protocol::Compression)
+        if (features & Protocol::Compression) {
             _connectionFeatures |= Protocol::Compression;
+            // prefer the faster methods if both sides have them
+            if ((features & Protocol::ZstdCompression) && Compressor::isSupported(Compressor::Zstd))
+                _connectionFeatures |= Protocol::ZstdCompression;
+            else if ((features & Protocol::Lz4Compression) && Compressor::isSupported(Compressor::Lz4))
+                _connectionFeatures |= Protocol::Lz4Compression;
+        }
 
         socket()->read((char*)&magic, 4); // read the 4 bytes we've just peeked at
     }
@@ -91,13 +97,8 @@ void CoreAuthHandler::onReadyRead()
         _supportedProtos.append(PeerFactory::ProtoDescriptor(type, protoFeatures));
 
         if (data >= 0x80000000) { // last protocol
-            Compressor::CompressionLevel level;
-            if (_connectionFeatures & Protocol::Compression)
-                level = Compressor::BestCompression;
-            else
-                level = Compressor::NoCompression;
-
-            RemotePeer *peer = PeerFactory::createPeer(_supportedProtos, this, socket(), level, this);
+            RemotePeer *peer = PeerFactory::createPeer(_supportedProtos, this, socket(), compressionLevel(_connectionFeatures),
+                                                       compressionMethod(_connectionFeatures), this);
             if (peer->protocol() == Protocol::LegacyProtocol) {
                 _legacy = true;
                 connect(peer, SIGNAL(protocolVersionMismatch(int,int)), SLOT(onProtocolVersionMismatch(int,int)));
@@ -152,6 +153,8 @@ bool CoreAuthHandler::checkClientRegistered()
 
 void CoreAuthHandler::handle(const RegisterClient &msg)
 {
+    _peer->setFeatures(Quassel::Features(msg.clientFeatures));
+
     bool useSsl;
     if (_legacy)
         useSsl = Core::sslSupported() && msg.sslSupported;
@@ -218,6 +221,9 @@ void CoreAuthHandler::handle(const Login &msg)
 
     quInfo() << qPrintable(tr("Client %1 initialized and authenticated successfully as \"%2\" (UserId: %3).").arg(socket()->peerAddress().toString(), msg.user, QString::number(uid.toInt())));
 
+    if (msg.resumable)
+        _peer->setResumeRequest(msg.resumeToken, msg.resumeSequence);
+
     disconnect(socket(), 0, this, 0);
     disconnect(_peer, 0, this, 0);
     _peer->setParent(0); // Core needs to take care of this one now!
@@ -24,7 +24,51 @@
 
 #include <QDebug>
 
+// Converts the messages read from storage straight into the QVariantList that is sent to the
+// client, so we don't have to keep an intermediate QList<Message> of the whole backlog around.
+// With a chunk sink, every chunk but the last is sent on as soon as the next one has been read,
+// so only a single chunk is held at any time and the client gets the first ones during the query.
+class CoreBacklogManager::BacklogVisitor : public MessageVisitor
+{
+public:
+    BacklogVisitor(QVariantList &backlog, const ChunkSink &sendChunk = ChunkSink())
+        : _backlog(backlog), _sendChunk(sendChunk), _count(0) {}
+
+    inline int count() const { return _count; }
+    inline MsgId oldestMsgId() const { return _oldestMsgId; }
+
+protected:
+    bool visit(const MessageList &messages)
+    {
+        if (_sendChunk && !_backlog.isEmpty()) {
+            _sendChunk(_backlog);
+            _backlog.clear();
+        }
+
+        MessageList::const_iterator msgIter = messages.constBegin();
+        MessageList::const_iterator msgListEnd = messages.constEnd();
+        while (msgIter != msgListEnd) {
+            if (!_oldestMsgId.isValid() || msgIter->msgId() < _oldestMsgId)
+                _oldestMsgId = msgIter->msgId();
+            _backlog << qVariantFromValue(*msgIter);
+            ++msgIter;
+        }
+        _count += messages.count();
+        return true;
+    }
+
+private:
+    QVariantList &_backlog;
+    ChunkSink _sendChunk;
+    int _count;
+    MsgId _oldestMsgId;
+};
+
+
 INIT_SYNCABLE_OBJECT(CoreBacklogManager)
+
+int CoreBacklogManager::_maxSearchResults = 500;
+
 CoreBacklogManager::CoreBacklogManager(CoreSession *coreSession)
     : BacklogManager(coreSession),
     _coreSession(coreSession)
@@ -32,27 +76,35 @@ CoreBacklogManager::CoreBacklogManager(CoreSession *coreSession)
 }
 
 
+// Only clients announcing Quassel::BacklogChunks know receiveBacklogChunk() and receiveBacklogAllChunk()
+Peer *CoreBacklogManager::chunkedPeer() const
+{
+    Peer *peer = _coreSession ? _coreSession->signalProxy()->sourcePeer() : 0;
+    if (peer && peer->features() & Quassel::BacklogChunks)
+        return peer;
+    return 0;
+}
+
+
 QVariantList CoreBacklogManager::requestBacklog(BufferId bufferId, MsgId first, MsgId last, int limit, int additional)
 {
-    QVariantList backlog;
-    QList<Message> msgList;
-    msgList = Core::requestMsgs(coreSession()->user(), bufferId, first, last, limit);
-
-    QList<Message>::const_iterator msgIter = msgList.constBegin();
-    QList<Message>::const_iterator msgListEnd = msgList.constEnd();
-    while (msgIter != msgListEnd) {
-        backlog << qVariantFromValue(*msgIter);
-        ++msgIter;
+    ChunkSink sendChunk;
+    if (Peer *peer = chunkedPeer()) {
+        sendChunk = [=](const QVariantList &chunk) {
+            PeerPtr peerPtr = peer;
+            SYNC_OTHER(receiveBacklogChunk, ARG(peerPtr), ARG(bufferId), ARG(first), ARG(last), ARG(limit), ARG(additional), ARG(chunk));
+            peer->flush(); // don't let the chunks pile up while we are still reading the backlog
+        };
     }
 
+    QVariantList backlog;
+    BacklogVisitor visitor(backlog, sendChunk);
+    Core::visitMsgs(coreSession()->user(), bufferId, visitor, first, last, limit);
+
     if (additional && limit != 0) {
         MsgId oldestMessage = first;
-        if (!msgList.isEmpty()) {
-            if (msgList.first().msgId() < msgList.last().msgId())
-                oldestMessage = msgList.first().msgId();
-            else
-                oldestMessage = msgList.last().msgId();
-        }
+        if (visitor.count())
+            oldestMessage = visitor.oldestMsgId();
 
         if (first != -1) {
             last = first;
@@ -64,13 +116,8 @@ QVariantList CoreBacklogManager::requestBacklog(BufferId bufferId, MsgId first,
         // only fetch additional messages if they continue seemlessly
         // that is, if the list of messages is not truncated by the limit
         if (last == oldestMessage) {
-            msgList = Core::requestMsgs(coreSession()->user(), bufferId, -1, last, additional);
-            msgIter = msgList.constBegin();
-            msgListEnd = msgList.constEnd();
-            while (msgIter != msgListEnd) {
-                backlog << qVariantFromValue(*msgIter);
-                ++msgIter;
-            }
+            BacklogVisitor additionalVisitor(backlog, sendChunk);
+            Core::visitMsgs(coreSession()->user(), bufferId, additionalVisitor, -1, last, additional);
         }
     }
 
@@ -80,38 +127,59 @@ QVariantList CoreBacklogManager::requestBacklog(BufferId bufferId, MsgId first,
 
 QVariantList CoreBacklogManager::requestBacklogAll(MsgId first, MsgId last, int limit, int additional)
 {
-    QVariantList backlog;
-    QList<Message> msgList;
-    msgList = Core::requestAllMsgs(coreSession()->user(), first, last, limit);
-
-    QList<Message>::const_iterator msgIter = msgList.constBegin();
-    QList<Message>::const_iterator msgListEnd = msgList.constEnd();
-    while (msgIter != msgListEnd) {
-        backlog << qVariantFromValue(*msgIter);
-        ++msgIter;
+    ChunkSink sendChunk;
+    if (Peer *peer = chunkedPeer()) {
+        sendChunk = [=](const QVariantList &chunk) {
+            PeerPtr peerPtr = peer;
+            SYNC_OTHER(receiveBacklogAllChunk, ARG(peerPtr), ARG(first), ARG(last), ARG(limit), ARG(additional), ARG(chunk));
+            peer->flush(); // don't let the chunks pile up while we are still reading the backlog
+        };
     }
 
+    QVariantList backlog;
+    BacklogVisitor visitor(backlog, sendChunk);
+    Core::visitAllMsgs(coreSession()->user(), visitor, first, last, limit);
+
     if (additional) {
         if (first != -1) {
             last = first;
         }
         else {
             last = -1;
-            if (!msgList.isEmpty()) {
-                if (msgList.first().msgId() < msgList.last().msgId())
-                    last = msgList.first().msgId();
-                else
-                    last = msgList.last().msgId();
-            }
-        }
-        msgList = Core::requestAllMsgs(coreSession()->user(), -1, last, additional);
-        msgIter = msgList.constBegin();
-        msgListEnd = msgList.constEnd();
-        while (msgIter != msgListEnd) {
-            backlog << qVariantFromValue(*msgIter);
-            ++msgIter;
+            if (visitor.count())
+                last = visitor.oldestMsgId();
         }
+        BacklogVisitor additionalVisitor(backlog, sendChunk);
+        Core::visitAllMsgs(coreSession()->user(), additionalVisitor, -1, last, additional);
     }
 
     return backlog;
 }
+
+
+QVariantList CoreBacklogManager::requestBacklogSearch(QString query, BufferId bufferId, int offset, int limit)
+{
+    // a single page must not grow into a full backlog dump
+    if (limit <= 0 || limit > _maxSearchResults)
+        limit = _maxSearchResults;
+    if (offset < 0)
+        offset = 0;
+
+    QVariantList results;
+    BacklogVisitor visitor(results);
+    Core::searchMsgs(coreSession()->user(), query, bufferId, visitor, offset, limit);
+    return results;
+}
+
+
+QVariantMap CoreBacklogManager::requestBacklogRetention()
+{
+    return Core::getUserSetting(coreSession()->user(), "BacklogRetention").toMap();
+}
+
+
+void CoreBacklogManager::requestSetBacklogRetention(QVariantMap rules)
+{
+    // BacklogRetention reads the rules at the start of every pass
+    Core::setUserSetting(coreSession()->user(), "BacklogRetention", rules);
+}
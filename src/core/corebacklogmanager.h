@@ -21,6 +21,8 @@
 #ifndef COREBACKLOGMANAGER_H
 #define COREBACKLOGMANAGER_H
 
+#include <functional>
+
 #include "backlogmanager.h"
 
 class CoreSession;
@@ -38,8 +40,18 @@ public:
 public slots:
     virtual QVariantList requestBacklog(BufferId bufferId, MsgId first = -1, MsgId last = -1, int limit = -1, int additional = 0);
     virtual QVariantList requestBacklogAll(MsgId first = -1, MsgId last = -1, int limit = -1, int additional = 0);
+    virtual QVariantList requestBacklogSearch(QString query, BufferId bufferId = BufferId(), int offset = 0, int limit = 50);
+    virtual QVariantMap requestBacklogRetention();
+    virtual void requestSetBacklogRetention(QVariantMap rules);
 
 private:
+    class BacklogVisitor;
+    typedef std::function<void(const QVariantList &)> ChunkSink;
+
+    Peer *chunkedPeer() const;
+
+    static int _maxSearchResults;
+
     CoreSession *_coreSession;
 };
 
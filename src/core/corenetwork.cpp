@@ -43,6 +43,8 @@ CoreNetwork::CoreNetwork(const NetworkId &networkid, CoreSession *session)
     _lastPingTime(0),
     _pingCount(0),
     _sendPings(false),
+    _capNegotiationActive(false),
+    _saslPending(false),
     _requestedUserModes('-')
 {
     _autoReconnectTimer.setSingleShot(true);
@@ -79,6 +81,7 @@ CoreNetwork::CoreNetwork(const NetworkId &networkid, CoreSession *session)
     connect(&socket, SIGNAL(sslErrors(const QList<QSslError> &)), this, SLOT(sslErrors(const QList<QSslError> &)));
 #endif
     connect(this, SIGNAL(newEvent(Event *)), coreSession()->eventManager(), SLOT(postEvent(Event *)));
+    connect(this, SIGNAL(newEvents(QList<Event *>)), coreSession()->eventManager(), SLOT(postEvents(QList<Event *>)));
 
     if (Quassel::isOptionSet("oidentd")) {
         connect(this, SIGNAL(socketInitialized(const CoreIdentity*, QHostAddress, quint16, QHostAddress, quint16)), Core::instance()->oidentdConfigGenerator(), SLOT(addSocket(const CoreIdentity*, QHostAddress, quint16, QHostAddress, quint16)), Qt::BlockingQueuedConnection);
@@ -417,18 +420,42 @@ void CoreNetwork::setMyNick(const QString &mynick)
 }
 
 
+// Everything available is read at once. Each line becomes an event that refers to the buffer instead of
+// copying it, the events share one allocation, and they're posted as one batch.
 void CoreNetwork::socketHasData()
 {
-    while (socket.canReadLine()) {
-        QByteArray s = socket.readLine();
-        if (s.endsWith("\r\n"))
-            s.chop(2);
-        else if (s.endsWith("\n"))
-            s.chop(1);
-        NetworkDataEvent *event = new NetworkDataEvent(EventManager::NetworkIncoming, this, s);
-        event->setTimestamp(QDateTime::currentDateTimeUtc());
-        emit newEvent(event);
+    QByteArray buffer = socket.readAll();
+    if (!_incompleteLine.isEmpty()) {
+        buffer.prepend(_incompleteLine);
+        _incompleteLine.clear();
     }
+
+    int lineCount = buffer.count('\n');
+    if (!lineCount) {
+        _incompleteLine = buffer;
+        return;
+    }
+
+    EventArena *arena = new EventArena(lineCount, sizeof(NetworkDataEvent), buffer);
+    const char *data = arena->data().constData();
+    QDateTime timestamp = QDateTime::currentDateTimeUtc();
+    QList<Event *> events;
+    int pos = 0;
+    int end;
+    while ((end = buffer.indexOf('\n', pos)) >= 0) {
+        int length = end - pos;
+        if (length > 0 && data[end - 1] == '\r')
+            length--;
+        NetworkDataEvent *event = new (arena) NetworkDataEvent(EventManager::NetworkIncoming, this, QByteArray::fromRawData(data + pos, length));
+        event->setTimestamp(timestamp);
+        events << event;
+        pos = end + 1;
+    }
+    if (pos < buffer.size())
+        _incompleteLine = buffer.mid(pos);
+    arena->release();
+
+    emit newEvents(events);
 }
 
 
@@ -482,9 +509,14 @@ void CoreNetwork::socketInitialized()
     _tokenBucket = _burstSize; // init with a full bucket
     _tokenBucketTimer.start(_messageDelay);
 
-    if (networkInfo().useSasl) {
-        putRawLine(serverEncode(QString("CAP REQ :sasl")));
-    }
+    // registration is held back until we're done negotiating capabilities, cf. capsListed()
+    _capsAvailable.clear();
+    _capsEnabled.clear();
+    _capsPending.clear();
+    _saslPending = false;
+    _capNegotiationActive = true;
+    putRawLine(serverEncode(QString("CAP LS 302")));
+
     if (!server.password.isEmpty()) {
         putRawLine(serverEncode(QString("PASS %1").arg(server.password)));
     }
@@ -505,6 +537,7 @@ void CoreNetwork::socketDisconnected()
 {
     disablePingTimeout();
     _msgQueue.clear();
+    _incompleteLine.clear();
 
     _autoWhoCycleTimer.stop();
     _autoWhoTimer.stop();
@@ -859,6 +892,127 @@ void CoreNetwork::setPingInterval(int interval)
 }
 
 
+/******** IRCv3 capabilities ********/
+
+// The capabilities we request if the server offers them, besides sasl
+static const char *supportedCaps[] = {
+    "away-notify",
+    "account-notify",
+    "batch",
+    "extended-join",
+    "multi-prefix",
+    "userhost-in-names"
+};
+
+
+void CoreNetwork::capsListed(const QStringList &caps, bool complete)
+{
+    // caps may come with a value, as in "sasl=PLAIN,EXTERNAL"
+    foreach(const QString &cap, caps) {
+        QString name = cap.section('=', 0, 0).toLower();
+        if (!name.isEmpty() && !_capsAvailable.contains(name))
+            _capsAvailable << name;
+    }
+    if (!complete)
+        return; // more to come
+
+    QStringList wanted;
+    for (uint i = 0; i < sizeof(supportedCaps) / sizeof(supportedCaps[0]); i++)
+        wanted << supportedCaps[i];
+    if (networkInfo().useSasl && _capNegotiationActive) // no point in authenticating after registration
+        wanted << "sasl";
+
+    QStringList request;
+    foreach(const QString &cap, wanted) {
+        if (_capsAvailable.contains(cap) && !_capsEnabled.contains(cap) && !_capsPending.contains(cap))
+            request << cap;
+    }
+
+    if (!request.isEmpty())
+        requestCaps(request);
+    else if (_capsPending.isEmpty() && !_saslPending)
+        endCapNegotiation();
+}
+
+
+void CoreNetwork::capsAcknowledged(const QStringList &caps)
+{
+    foreach(QString cap, caps) {
+        // modifiers: '-' means the cap got disabled, '~' and '=' are obsolete
+        bool disabled = cap.startsWith('-');
+        while (cap.startsWith('-') || cap.startsWith('~') || cap.startsWith('='))
+            cap.remove(0, 1);
+        cap = cap.toLower();
+
+        _capsPending.removeAll(cap);
+        if (disabled) {
+            _capsEnabled.remove(cap);
+        }
+        else {
+            _capsEnabled.insert(cap);
+            if (cap == "sasl")
+                _saslPending = true; // CoreSessionEventProcessor authenticates, then calls saslFinished()
+        }
+    }
+    updateAutoWhoCycle();
+
+    if (_capsPending.isEmpty() && !_saslPending)
+        endCapNegotiation();
+}
+
+
+void CoreNetwork::capsRejected(const QStringList &caps)
+{
+    foreach(const QString &cap, caps)
+        _capsPending.removeAll(cap.toLower());
+
+    // a request is rejected as a whole, so retry the caps one by one to get those the server does support
+    if (caps.count() > 1) {
+        foreach(const QString &cap, caps)
+            requestCaps(QStringList() << cap.toLower());
+    }
+
+    if (_capsPending.isEmpty() && !_saslPending)
+        endCapNegotiation();
+}
+
+
+void CoreNetwork::capsRemoved(const QStringList &caps)
+{
+    foreach(const QString &cap, caps) {
+        QString name = cap.section('=', 0, 0).toLower();
+        _capsAvailable.removeAll(name);
+        _capsEnabled.remove(name);
+    }
+    updateAutoWhoCycle();
+}
+
+
+void CoreNetwork::saslFinished()
+{
+    _saslPending = false;
+    if (_capsPending.isEmpty())
+        endCapNegotiation();
+}
+
+
+void CoreNetwork::requestCaps(const QStringList &caps)
+{
+    _capsPending << caps;
+    putRawLine(serverEncode(QString("CAP REQ :%1").arg(caps.join(" "))));
+}
+
+
+void CoreNetwork::endCapNegotiation()
+{
+    if (!_capNegotiationActive)
+        return;
+
+    _capNegotiationActive = false;
+    putRawLine(serverEncode(QString("CAP END")));
+}
+
+
 /******** AutoWHO ********/
 
 void CoreNetwork::startAutoWhoCycle()
@@ -867,10 +1021,27 @@ void CoreNetwork::startAutoWhoCycle()
         _autoWhoCycleTimer.stop();
         return;
     }
+    // with away-notify the server tells us about away changes, so we only WHO newly joined channels
+    if (capEnabled("away-notify")) {
+        _autoWhoCycleTimer.stop();
+        return;
+    }
     _autoWhoQueue = channels();
 }
 
 
+void CoreNetwork::updateAutoWhoCycle()
+{
+    if (!isConnected() || !networkConfig()->autoWhoEnabled())
+        return;
+
+    if (capEnabled("away-notify"))
+        _autoWhoCycleTimer.stop();
+    else if (!_autoWhoCycleTimer.isActive())
+        _autoWhoCycleTimer.start();
+}
+
+
 void CoreNetwork::setAutoWhoDelay(int delay)
 {
     _autoWhoTimer.setInterval(delay * 1000);
@@ -910,7 +1081,7 @@ void CoreNetwork::sendAutoWho()
         putRawLine("WHO " + serverEncode(chan));
         break;
     }
-    if (_autoWhoQueue.isEmpty() && networkConfig()->autoWhoEnabled() && !_autoWhoCycleTimer.isActive()) {
+    if (_autoWhoQueue.isEmpty() && networkConfig()->autoWhoEnabled() && !_autoWhoCycleTimer.isActive() && !capEnabled("away-notify")) {
         // Timer was stopped, means a new cycle is due immediately
         _autoWhoCycleTimer.start();
         startAutoWhoCycle();
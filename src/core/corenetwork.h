@@ -25,6 +25,7 @@
 #include "coreircchannel.h"
 #include "coreircuser.h"
 
+#include <QSet>
 #include <QTimer>
 
 #ifdef HAVE_SSL
@@ -89,6 +90,9 @@ public:
 
     inline bool isAutoWhoInProgress(const QString &channel) const { return _autoWhoPending.value(channel.toLower(), 0); }
 
+    //! Whether the server acknowledged the IRCv3 capability
+    inline bool capEnabled(const QString &cap) const { return _capsEnabled.contains(cap.toLower()); }
+
     inline UserId userId() const { return _coreSession->user(); }
 
     inline QAbstractSocket::SocketState socketState() const { return socket.state(); }
@@ -140,6 +144,13 @@ public slots:
 
     bool setAutoWhoDone(const QString &channel);
 
+    // IRCv3 capability negotiation, driven by CoreSessionEventProcessor::processIrcEventCap()
+    void capsListed(const QStringList &caps, bool complete);
+    void capsAcknowledged(const QStringList &caps);
+    void capsRejected(const QStringList &caps);
+    void capsRemoved(const QStringList &caps);
+    void saslFinished();
+
     void updateIssuedModes(const QString &requestedModes);
     void updatePersistentModes(QString addModes, QString removeModes);
     void resetPersistentModes();
@@ -165,6 +176,7 @@ signals:
     void sslErrors(const QVariant &errorData);
 
     void newEvent(Event *event);
+    void newEvents(const QList<Event *> &events);
     void socketInitialized(const CoreIdentity *identity, const QHostAddress &localAddress, quint16 localPort, const QHostAddress &peerAddress, quint16 peerPort);
     void socketDisconnected(const CoreIdentity *identity, const QHostAddress &localAddress, quint16 localPort, const QHostAddress &peerAddress, quint16 peerPort);
 
@@ -195,6 +207,7 @@ private slots:
     void disablePingTimeout();
     void sendAutoWho();
     void startAutoWhoCycle();
+    void updateAutoWhoCycle();
 
 #ifdef HAVE_SSL
     void sslErrors(const QList<QSslError> &errors);
@@ -215,6 +228,8 @@ private:
 
     CoreUserInputHandler *_userInputHandler;
 
+    QByteArray _incompleteLine; // received data after the last complete line
+
     QHash<QString, QString> _channelKeys; // stores persistent channels and their passwords, if any
 
     QTimer _autoReconnectTimer;
@@ -236,6 +251,15 @@ private:
     uint _pingCount;
     bool _sendPings;
 
+    void requestCaps(const QStringList &caps);
+    void endCapNegotiation();
+
+    QStringList _capsAvailable; // offered by the server, without their values
+    QSet<QString> _capsEnabled;
+    QStringList _capsPending; // requested, but not acknowledged or rejected yet
+    bool _capNegotiationActive; // registration waits for CAP END
+    bool _saslPending;
+
     QStringList _autoWhoQueue;
     QHash<QString, int> _autoWhoPending;
     QTimer _autoWhoTimer, _autoWhoCycleTimer;
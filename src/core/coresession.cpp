@@ -21,7 +21,9 @@
 #include "coresession.h"
 
 #include <QtScript>
+#include <QUuid>
 
+#include "backlogretention.h"
 #include "core.h"
 #include "coreuserinputhandler.h"
 #include "corebuffersyncer.h"
@@ -56,6 +58,9 @@ public:
 };
 
 
+// seconds a disconnected client has to come back and resume its session
+int CoreSession::_resumeTimeout = 10 * 60;
+
 CoreSession::CoreSession(UserId uid, bool restoreState, QObject *parent)
     : QObject(parent),
     _user(uid),
@@ -63,6 +68,7 @@ CoreSession::CoreSession(UserId uid, bool restoreState, QObject *parent)
     _aliasManager(this),
     _bufferSyncer(new CoreBufferSyncer(this)),
     _backlogManager(new CoreBacklogManager(this)),
+    _backlogRetention(new BacklogRetention(uid)),
     _bufferViewManager(new CoreBufferViewManager(_signalProxy, this)),
     _ircListHelper(new CoreIrcListHelper(this)),
     _networkConfig(new CoreNetworkConfig("GlobalNetworkConfig", this)),
@@ -118,6 +124,13 @@ CoreSession::CoreSession(UserId uid, bool restoreState, QObject *parent)
     // periodically save our session state
     connect(&(Core::instance()->syncTimer()), SIGNAL(timeout()), this, SLOT(saveSessionState()));
 
+    Q_ASSERT(Core::backlogWriter()); // sessions only exist once storage is set up
+    if (Core::backlogWriter()->isDeferred())
+        Core::backlogWriter()->addReceiver(this);
+
+    // older clients would complain about every unknown sync call
+    p->setRequiredFeature("IrcUser", "setAccount", Quassel::IrcUserAccount);
+
     p->synchronize(_bufferSyncer);
     p->synchronize(&aliasManager());
     p->synchronize(_backlogManager);
@@ -136,6 +149,11 @@ CoreSession::CoreSession(UserId uid, bool restoreState, QObject *parent)
 
 CoreSession::~CoreSession()
 {
+    if (Core::backlogWriter()->isDeferred())
+        Core::backlogWriter()->removeReceiver(this);
+    delete _backlogRetention;
+    foreach(const SuspendedClient &suspended, _suspendedClients)
+        dropSuspendedClient(suspended);
     saveSessionState();
     foreach(CoreNetwork *net, _networks.values()) {
         delete net;
@@ -214,8 +232,40 @@ void CoreSession::restoreSessionState()
 
 void CoreSession::addClient(RemotePeer *peer)
 {
-    peer->dispatch(sessionState());
-    signalProxy()->addPeer(peer);
+    if (!peer->isResumable()) {
+        peer->dispatch(sessionState());
+        signalProxy()->addPeer(peer);
+        return;
+    }
+
+    // The client gets what it missed from the journal of its previous connection. If the journal doesn't
+    // reach back far enough, or there is none, it has to start over with a full session state.
+    purgeSuspendedClients();
+    RemotePeer::Journal journal;
+    quint64 first = 0; // sequence number of the message before the oldest one in the journal
+    bool resumed = false;
+    if (!peer->resumeToken().isEmpty() && _suspendedClients.contains(peer->resumeToken())) {
+        SuspendedClient suspended = _suspendedClients.take(peer->resumeToken());
+        journal = *suspended.journal;
+        dropSuspendedClient(suspended);
+        first = journal.sequence - journal.entries.count();
+        resumed = peer->resumeSequence() >= first && peer->resumeSequence() <= journal.sequence;
+    }
+
+    Protocol::SessionState state = resumed ? Protocol::SessionState() : sessionState();
+    state.resumeToken = QUuid::createUuid().toByteArray();
+    state.resumed = resumed;
+    _resumeTokens[peer] = state.resumeToken;
+
+    peer->dispatch(state);
+    peer->setJournaling(true);
+    if (!signalProxy()->addPeer(peer) || !resumed)
+        return;
+
+    for (int i = (int)(peer->resumeSequence() - first); i < journal.entries.count(); i++)
+        journal.entries[i](peer);
+
+    quInfo() << qPrintable(tr("Client")) << peer->description() << qPrintable(tr("resumed its session (UserId: %1, %2 messages replayed).").arg(user().toInt()).arg(journal.sequence - peer->resumeSequence()));
 }
 
 
@@ -231,6 +281,42 @@ void CoreSession::removeClient(Peer *peer)
     RemotePeer *p = qobject_cast<RemotePeer *>(peer);
     if (p)
         quInfo() << qPrintable(tr("Client")) << p->description() << qPrintable(tr("disconnected (UserId: %1).").arg(user().toInt()));
+
+    // keep recording what the client misses from now on, in case it comes back
+    if (p && _resumeTokens.contains(peer)) {
+        SuspendedClient suspended;
+        suspended.journal = new RemotePeer::Journal(p->takeJournal());
+        suspended.sequence = suspended.journal->sequence;
+        suspended.since = QDateTime::currentDateTime();
+        signalProxy()->addBroadcastSink(suspended.journal);
+        _suspendedClients[_resumeTokens.take(peer)] = suspended;
+        p->setJournaling(false);
+    }
+    purgeSuspendedClients();
+}
+
+
+void CoreSession::dropSuspendedClient(const SuspendedClient &suspended)
+{
+    signalProxy()->removeBroadcastSink(suspended.journal);
+    delete suspended.journal;
+}
+
+
+// Once a journal had to drop messages the client hasn't seen, the client can't resume anymore and needs a full sync
+void CoreSession::purgeSuspendedClients()
+{
+    QDateTime expiry = QDateTime::currentDateTime().addSecs(-_resumeTimeout);
+    QHash<QByteArray, SuspendedClient>::iterator iter = _suspendedClients.begin();
+    while (iter != _suspendedClients.end()) {
+        quint64 first = iter->journal->sequence - iter->journal->entries.count();
+        if (iter->since < expiry || first > iter->sequence) {
+            dropSuspendedClient(iter.value());
+            iter = _suspendedClients.erase(iter);
+        }
+        else
+            ++iter;
+    }
 }
 
 
@@ -305,6 +391,16 @@ QList<BufferInfo> CoreSession::buffers() const
 
 void CoreSession::customEvent(QEvent *event)
 {
+    if (event->type() == BacklogWriter::MessagesStoredEventId) {
+        BacklogWriter::MessagesStoredEvent *storedEvent = static_cast<BacklogWriter::MessagesStoredEvent *>(event);
+        // FIXME: extend protocol to a displayMessages(MessageList)
+        for (int i = 0; i < storedEvent->messages.count(); i++) {
+            emit displayMsg(storedEvent->messages[i]);
+        }
+        event->accept();
+        return;
+    }
+
     if (event->type() != QEvent::User)
         return;
 
@@ -324,7 +420,9 @@ void CoreSession::processMessages()
             bufferInfo = Core::bufferInfo(user(), rawMsg.networkId, BufferInfo::StatusBuffer, "");
         }
         Message msg(bufferInfo, rawMsg.type, rawMsg.text, rawMsg.sender, rawMsg.flags);
-        if(Core::storeMessage(msg))
+        if (Core::backlogWriter()->isDeferred())
+            Core::backlogWriter()->enqueue(this, MessageList() << msg);
+        else if(Core::storeMessage(msg))
             emit displayMsg(msg);
     }
     else {
@@ -367,7 +465,11 @@ void CoreSession::processMessages()
             messages << msg;
         }
 
-        if(Core::storeMessages(messages)) {
+        if (Core::backlogWriter()->isDeferred()) {
+            // displayed once the BacklogWriter has committed them, see customEvent()
+            Core::backlogWriter()->enqueue(this, messages);
+        }
+        else if(Core::storeMessages(messages)) {
             // FIXME: extend protocol to a displayMessages(MessageList)
             for (int i = 0; i < messages.count(); i++) {
                 emit displayMsg(messages[i]);
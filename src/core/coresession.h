@@ -30,8 +30,10 @@
 #include "peer.h"
 #include "protocol.h"
 #include "message.h"
+#include "remotepeer.h"
 #include "storage.h"
 
+class BacklogRetention;
 class CoreBacklogManager;
 class CoreBufferSyncer;
 class CoreBufferViewManager;
@@ -188,6 +190,8 @@ private:
     void loadSettings();
     void initScriptEngine();
 
+    void purgeSuspendedClients();
+
     /// Hook for converting events to the old displayMsg() handlers
     Q_INVOKABLE void processMessageEvent(MessageEvent *event);
 
@@ -202,6 +206,7 @@ private:
 
     CoreBufferSyncer *_bufferSyncer;
     CoreBacklogManager *_backlogManager;
+    BacklogRetention *_backlogRetention;
     CoreBufferViewManager *_bufferViewManager;
     CoreIrcListHelper *_ircListHelper;
     CoreNetworkConfig *_networkConfig;
@@ -219,6 +224,18 @@ private:
     QList<RawMessage> _messageQueue;
     bool _processMessages;
     CoreIgnoreListManager _ignoreListManager;
+
+    // journals of disconnected clients that may resume their session, by resume token
+    // they are registered with the signal proxy, so they keep recording while the client is away
+    struct SuspendedClient {
+        RemotePeer::Journal *journal;
+        quint64 sequence; // journal sequence when the client disconnected
+        QDateTime since;
+    };
+    void dropSuspendedClient(const SuspendedClient &suspended);
+    QHash<QByteArray, SuspendedClient> _suspendedClients;
+    QHash<Peer *, QByteArray> _resumeTokens;
+    static int _resumeTimeout;
 };
 
 
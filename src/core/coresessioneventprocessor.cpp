@@ -98,7 +98,7 @@ void CoreSessionEventProcessor::processIrcEventNumeric(IrcEventNumeric *e)
     case 905:
     case 906:
     case 907:
-        qobject_cast<CoreNetwork *>(e->network())->putRawLine("CAP END");
+        qobject_cast<CoreNetwork *>(e->network())->saslFinished();
         break;
 
     default:
@@ -138,27 +138,179 @@ void CoreSessionEventProcessor::processIrcEventAuthenticate(IrcEvent *e)
 }
 
 
+/* CAP <target> <subcommand> [*] :<caps>
+   The '*' is only sent for LS replies spanning multiple lines, all but the last one have it. */
 void CoreSessionEventProcessor::processIrcEventCap(IrcEvent *e)
 {
-    // for SASL, there will only be a single param of 'sasl', however you can check here for
-    // additional CAP messages (ls, multi-prefix, et cetera).
+    if (!checkParamCount(e, 2))
+        return;
 
-    if (e->params().count() == 3) {
-        if (e->params().at(2).startsWith("sasl")) { // Freenode (at least) sends "sasl " with a trailing space for some reason!
+    CoreNetwork *net = coreNetwork(e);
+    QString subCommand = e->params().at(1).toUpper();
+    bool more = e->params().count() > 3 && e->params().at(2) == "*";
+    // Freenode (at least) sends "sasl " with a trailing space for some reason!
+    QStringList caps;
+    if (e->params().count() > 2)
+        caps = e->params().last().split(' ', QString::SkipEmptyParts);
+
+    if (subCommand == "LS") {
+        net->capsListed(caps, !more);
+    }
+    else if (subCommand == "NEW") {
+        net->capsListed(caps, true);
+    }
+    else if (subCommand == "ACK") {
+        net->capsAcknowledged(caps);
+        if (caps.contains("sasl", Qt::CaseInsensitive)) {
             // FIXME use event
             // if the current identity has a cert set, use SASL EXTERNAL
 #ifdef HAVE_SSL
-            if (!coreNetwork(e)->identityPtr()->sslCert().isNull()) {
-                coreNetwork(e)->putRawLine(coreNetwork(e)->serverEncode("AUTHENTICATE EXTERNAL"));
+            if (!net->identityPtr()->sslCert().isNull()) {
+                net->putRawLine(net->serverEncode("AUTHENTICATE EXTERNAL"));
             } else {
 #endif
                 // Only working with PLAIN atm, blowfish later
-                coreNetwork(e)->putRawLine(coreNetwork(e)->serverEncode("AUTHENTICATE PLAIN"));
+                net->putRawLine(net->serverEncode("AUTHENTICATE PLAIN"));
 #ifdef HAVE_SSL
             }
 #endif
         }
     }
+    else if (subCommand == "NAK") {
+        net->capsRejected(caps);
+    }
+    else if (subCommand == "DEL") {
+        net->capsRemoved(caps);
+    }
+}
+
+
+/* A complete IRCv3 batch, holding the events parsed from its lines
+   Netsplits and netjoins are applied at once instead of being pieced together by Netsplit. Everything
+   else, like chathistory, is processed in one go, so the messages end up in a single storage transaction. */
+void CoreSessionEventProcessor::processIrcEventBatch(IrcEventBatch *e)
+{
+    QList<Event *> events = e->takeEvents();
+
+    if (e->batchType() == "netsplit")
+        events = handleNetsplitBatch(e, events);
+    else if (e->batchType() == "netjoin")
+        events = handleNetjoinBatch(e, events);
+
+    coreSession()->eventManager()->postEvents(events);
+}
+
+
+QList<Event *> CoreSessionEventProcessor::handleNetsplitBatch(IrcEventBatch *batch, const QList<Event *> &events)
+{
+    Network *net = batch->network();
+    QString servers = batch->batchParams().join(" ");
+    QList<Event *> remaining;
+    QList<IrcUser *> ircUsers;
+    QStringList channels;
+    QHash<QString, QStringList> users; // key: channel, value: sender strings
+
+    foreach(Event *event, events) {
+        if (event->type() != EventManager::IrcEventQuit) {
+            remaining << event;
+            continue;
+        }
+        IrcEvent *quitEvent = static_cast<IrcEvent *>(event);
+        IrcUser *ircuser = net->updateNickFromMask(quitEvent->prefix());
+        if (ircuser && !ircUsers.contains(ircuser)) {
+            ircUsers << ircuser;
+            foreach(const QString &channel, ircuser->channels()) {
+                if (!users.contains(channel))
+                    channels << channel;
+                users[channel] << quitEvent->prefix();
+            }
+        }
+        delete event;
+    }
+
+    foreach(const QString &channel, channels)
+        emit newEvent(new NetworkSplitEvent(EventManager::NetworkSplitQuit, net, channel, users.value(channel), servers));
+    foreach(IrcUser *ircuser, ircUsers)
+        ircuser->quit();
+
+    return remaining;
+}
+
+
+QList<Event *> CoreSessionEventProcessor::handleNetjoinBatch(IrcEventBatch *batch, const QList<Event *> &events)
+{
+    Network *net = batch->network();
+    QString servers = batch->batchParams().join(" ");
+    QList<Event *> remaining;
+    QStringList channels;
+    QHash<QString, QList<IrcUser *> > ircUsers; // key: channel
+    QHash<QString, QStringList> users;          // key: channel, value: sender strings
+
+    foreach(Event *event, events) {
+        if (event->type() != EventManager::IrcEventJoin) {
+            remaining << event;
+            continue;
+        }
+        // joins to channels we don't know are handled like any other join
+        IrcEvent *joinEvent = static_cast<IrcEvent *>(event);
+        if (joinEvent->params().isEmpty() || !net->ircChannel(joinEvent->params().at(0))) {
+            remaining << event;
+            continue;
+        }
+        IrcUser *ircuser = net->updateNickFromMask(joinEvent->prefix());
+        if (!ircuser || net->isMe(ircuser)) {
+            remaining << event;
+            continue;
+        }
+        updateFromExtendedJoin(joinEvent, ircuser);
+
+        QString channel = joinEvent->params().at(0);
+        if (!users.contains(channel))
+            channels << channel;
+        ircUsers[channel] << ircuser;
+        users[channel] << joinEvent->prefix();
+        delete event;
+    }
+
+    foreach(const QString &channel, channels) {
+        IrcChannel *ircChannel = net->ircChannel(channel);
+        QStringList modes;
+        for (int i = 0; i < ircUsers[channel].count(); i++)
+            modes << QString();
+        ircChannel->joinIrcUsers(ircUsers[channel], modes);
+        emit newEvent(new NetworkSplitEvent(EventManager::NetworkSplitJoin, net, channel, users[channel], servers));
+    }
+
+    return remaining;
+}
+
+
+/* ACCOUNT <account>, with account-notify; "*" means logged out */
+void CoreSessionEventProcessor::processIrcEventAccount(IrcEvent *e)
+{
+    if (!checkParamCount(e, 1))
+        return;
+
+    IrcUser *ircuser = e->network()->updateNickFromMask(e->prefix());
+    if (ircuser)
+        ircuser->setAccount(e->params().at(0) == "*" ? QString() : e->params().at(0));
+}
+
+
+/* AWAY [:<message>], with away-notify; no message means the user is back */
+void CoreSessionEventProcessor::processIrcEventAway(IrcEvent *e)
+{
+    IrcUser *ircuser = e->network()->updateNickFromMask(e->prefix());
+    if (!ircuser)
+        return;
+
+    if (!e->params().isEmpty() && !e->params().at(0).isEmpty()) {
+        ircuser->setAway(true);
+        ircuser->setAwayMessage(e->params().at(0));
+    }
+    else {
+        ircuser->setAway(false);
+    }
 }
 
 
@@ -189,6 +341,8 @@ void CoreSessionEventProcessor::processIrcEventJoin(IrcEvent *e)
             break;
     }
 
+    updateFromExtendedJoin(e, ircuser);
+
     if (!handledByNetsplit)
         ircuser->joinChannel(channel);
     else
@@ -202,6 +356,17 @@ void CoreSessionEventProcessor::processIrcEventJoin(IrcEvent *e)
 }
 
 
+// with extended-join, JOINs also carry the account and the real name
+void CoreSessionEventProcessor::updateFromExtendedJoin(IrcEvent *e, IrcUser *ircuser)
+{
+    if (e->params().count() < 3 || !coreNetwork(e)->capEnabled("extended-join"))
+        return;
+
+    ircuser->setAccount(e->params().at(1) == "*" ? QString() : e->params().at(1));
+    ircuser->setRealName(e->params().at(2));
+}
+
+
 void CoreSessionEventProcessor::lateProcessIrcEventKick(IrcEvent *e)
 {
     if (checkParamCount(e, 2)) {
@@ -796,11 +961,18 @@ void CoreSessionEventProcessor::processIrcEvent353(IrcEvent *e)
     foreach(QString nick, e->params()[2].split(' ', QString::SkipEmptyParts)) {
         QString mode;
 
-        if (e->network()->prefixes().contains(nick[0])) {
-            mode = e->network()->prefixToMode(nick[0]);
+        // with multi-prefix, all of the user's prefixes are listed
+        while (!nick.isEmpty() && e->network()->prefixes().contains(nick[0])) {
+            mode += e->network()->prefixToMode(nick[0]);
             nick = nick.mid(1);
         }
 
+        // with userhost-in-names, we get the full hostmask
+        if (nick.contains('!')) {
+            e->network()->updateNickFromMask(nick);
+            nick = nickFromMask(nick);
+        }
+
         nicks << nick;
         modes << mode;
     }
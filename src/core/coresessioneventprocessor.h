@@ -28,7 +28,9 @@
 class CoreSession;
 class CtcpEvent;
 class IrcEvent;
+class IrcEventBatch;
 class IrcEventNumeric;
+class IrcUser;
 class Netsplit;
 
 #ifdef HAVE_QCA2
@@ -46,7 +48,10 @@ public:
 
     Q_INVOKABLE void processIrcEventNumeric(IrcEventNumeric *event);
 
+    Q_INVOKABLE void processIrcEventAccount(IrcEvent *event);      // account-notify
     Q_INVOKABLE void processIrcEventAuthenticate(IrcEvent *event); // SASL auth
+    Q_INVOKABLE void processIrcEventAway(IrcEvent *event);         // away-notify
+    Q_INVOKABLE void processIrcEventBatch(IrcEventBatch *event);   // IRCv3 batches
     Q_INVOKABLE void processIrcEventCap(IrcEvent *event);          // CAP framework
     Q_INVOKABLE void processIrcEventInvite(IrcEvent *event);
     Q_INVOKABLE void processIrcEventJoin(IrcEvent *event);
@@ -110,6 +115,15 @@ protected:
     bool checkParamCount(IrcEvent *event, int minParams);
     inline CoreNetwork *coreNetwork(NetworkEvent *e) const { return qobject_cast<CoreNetwork *>(e->network()); }
     void tryNextNick(NetworkEvent *e, const QString &errnick, bool erroneous = false);
+    void updateFromExtendedJoin(IrcEvent *e, IrcUser *ircuser);
+
+    //! Apply the QUITs of a netsplit batch at once
+    /** \return The events in the batch that are not QUITs */
+    QList<Event *> handleNetsplitBatch(IrcEventBatch *batch, const QList<Event *> &events);
+
+    //! Apply the JOINs of a netjoin batch at once, one bulk-join per channel
+    /** \return The events in the batch that are not JOINs */
+    QList<Event *> handleNetjoinBatch(IrcEventBatch *batch, const QList<Event *> &events);
 
 private slots:
     //! Joins after a netsplit
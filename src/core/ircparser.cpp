@@ -31,24 +31,283 @@
 #  include "keyevent.h"
 #endif
 
+const int IrcParser::_maxOpenBatches = 16;
+const int IrcParser::_maxBatchEvents = 10000;
+const int IrcParser::_batchTimeout = 60;
+
 IrcParser::IrcParser(CoreSession *session) :
     QObject(session),
     _coreSession(session)
 {
     connect(this, SIGNAL(newEvent(Event *)), coreSession()->eventManager(), SLOT(postEvent(Event *)));
+    connect(coreSession(), SIGNAL(networkDisconnected(NetworkId)), this, SLOT(destroyBatches(NetworkId)));
+    connect(coreSession(), SIGNAL(networkRemoved(NetworkId)), this, SLOT(destroyBatches(NetworkId)));
+}
+
+
+IrcParser::~IrcParser()
+{
+    foreach(NetworkId networkId, _openBatches.keys())
+        destroyBatches(networkId);
+}
+
+
+// The events held back by a batch that never completed are owned by us, a batch deletes its events along with itself
+void IrcParser::destroyBatches(NetworkId networkId)
+{
+    QHash<QByteArray, IrcEventBatch *> batches = _openBatches.take(networkId);
+    qDeleteAll(batches);
+}
+
+
+// The held back events are sent on their own, without the batch
+void IrcParser::flushBatch(IrcEventBatch *batch)
+{
+    qWarning() << "Giving up on batch" << batch->reference() << "of" << batch->network()->networkName() << "with" << batch->events().count() << "events";
+    foreach(Event *event, batch->takeEvents())
+        emit newEvent(event);
+    delete batch;
+}
+
+
+void IrcParser::flushStaleBatches(NetworkId networkId, const QDateTime &now)
+{
+    QHash<QByteArray, IrcEventBatch *> &openBatches = _openBatches[networkId];
+    QDateTime expiry = now.addSecs(-_batchTimeout);
+    QHash<QByteArray, IrcEventBatch *>::iterator iter = openBatches.begin();
+    while (iter != openBatches.end()) {
+        if (iter.value()->timestamp() < expiry) {
+            flushBatch(iter.value());
+            iter = openBatches.erase(iter);
+        }
+        else
+            ++iter;
+    }
 }
 
 
-bool IrcParser::checkParamCount(const QString &cmd, const QList<QByteArray> &params, int minParams)
+bool IrcParser::checkParamCount(const QByteArray &cmd, const IrcLine::ParamList &params, int minParams)
 {
     if (params.count() < minParams) {
-        qWarning() << "Expected" << minParams << "params for IRC command" << cmd << ", got:" << params;
+        QList<QByteArray> paramList;
+        for (int i = 0; i < params.count(); i++)
+            paramList << params.at(i);
+        qWarning() << "Expected" << minParams << "params for IRC command" << cmd << ", got:" << paramList;
         return false;
     }
     return true;
 }
 
 
+namespace {
+
+struct IrcCommand {
+    const char *name;
+    EventManager::EventType type;
+};
+
+// Non-numeric commands with an event type of their own, everything else is IrcEventUnknown
+const IrcCommand ircCommands[] = {
+    { "ACCOUNT", EventManager::IrcEventAccount },
+    { "AUTHENTICATE", EventManager::IrcEventAuthenticate },
+    { "AWAY", EventManager::IrcEventAway },
+    { "BATCH", EventManager::IrcEventBatch },
+    { "CAP", EventManager::IrcEventCap },
+    { "INVITE", EventManager::IrcEventInvite },
+    { "JOIN", EventManager::IrcEventJoin },
+    { "KICK", EventManager::IrcEventKick },
+    { "MODE", EventManager::IrcEventMode },
+    { "NICK", EventManager::IrcEventNick },
+    { "NOTICE", EventManager::IrcEventNotice },
+    { "PART", EventManager::IrcEventPart },
+    { "PING", EventManager::IrcEventPing },
+    { "PONG", EventManager::IrcEventPong },
+    { "PRIVMSG", EventManager::IrcEventPrivmsg },
+    { "QUIT", EventManager::IrcEventQuit },
+    { "TOPIC", EventManager::IrcEventTopic },
+    { "WALLOPS", EventManager::IrcEventWallops }
+};
+const int ircCommandCount = sizeof(ircCommands) / sizeof(ircCommands[0]);
+
+// Perfect hash table for ircCommands. The hash multiplier is chosen once so that no two commands share a
+// slot, thus looking up a command takes one hash and one comparison.
+class IrcCommandTable
+{
+public:
+    IrcCommandTable()
+    {
+        for (_multiplier = 31; ; _multiplier += 2) {
+            int i;
+            for (i = 0; i < Size; i++)
+                _slots[i] = -1;
+            for (i = 0; i < ircCommandCount; i++) {
+                int &slot = _slots[hash(ircCommands[i].name, qstrlen(ircCommands[i].name))];
+                if (slot >= 0)
+                    break;
+                slot = i;
+            }
+            if (i == ircCommandCount)
+                break;
+        }
+    }
+
+    EventManager::EventType type(const QByteArray &command) const
+    {
+        int slot = _slots[hash(command.constData(), command.size())];
+        if (slot < 0)
+            return EventManager::Invalid;
+        const char *name = ircCommands[slot].name;
+        // compare the lengths first, the command may be longer than the name or contain a NUL
+        if ((int)qstrlen(name) != command.size() || qstrnicmp(name, command.constData(), command.size()) != 0)
+            return EventManager::Invalid;
+        return ircCommands[slot].type;
+    }
+
+private:
+    enum { Size = 64 };
+
+    // commands are case insensitive, so letters are hashed as upper case
+    uint hash(const char *command, int length) const
+    {
+        uint h = 0;
+        for (int i = 0; i < length; i++)
+            h = h * _multiplier + (command[i] & ~0x20);
+        return (h ^ (h >> 11)) % Size;
+    }
+
+    uint _multiplier;
+    int _slots[Size];
+};
+
+
+// The number of a numeric reply, 0 for any other command
+uint replyNumber(const QByteArray &command)
+{
+    uint num = 0;
+    for (int i = 0; i < command.size(); i++) {
+        char c = command.at(i);
+        if (c < '0' || c > '9')
+            return 0;
+        num = num * 10 + (c - '0');
+    }
+    return num;
+}
+
+
+inline bool isWhitespace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
+
+
+// The command is the first part without whitespace
+QByteArray rawCommand(const char *data, int begin, int end)
+{
+    while (begin < end && isWhitespace(data[begin]))
+        begin++;
+    while (end > begin && isWhitespace(data[end - 1]))
+        end--;
+    return QByteArray::fromRawData(data + begin, end - begin);
+}
+
+
+// Event data outlives the line, so it must not share its data
+inline QByteArray detached(const QByteArray &raw)
+{
+    return QByteArray(raw.constData(), raw.size());
+}
+
+
+// The value of an IRCv3 message tag, as in "@key=value;key2"
+// NOTE: Escaped values are not unescaped, which is fine for the tags we look at
+QByteArray tagValue(const QByteArray &tags, const char *key)
+{
+    int keyLength = qstrlen(key);
+    int pos = 0;
+    while (pos < tags.size()) {
+        int end = tags.indexOf(';', pos);
+        if (end < 0)
+            end = tags.size();
+        if (end - pos > keyLength && tags.at(pos + keyLength) == '=' && !qstrncmp(tags.constData() + pos, key, keyLength))
+            return QByteArray::fromRawData(tags.constData() + pos + keyLength + 1, end - pos - keyLength - 1);
+        pos = end + 1;
+    }
+    return QByteArray();
+}
+
+}
+
+
+// Parts are separated by one or more spaces. A parameter introduced by " :" is the last one and may contain spaces.
+bool IrcParser::tokenize(const QByteArray &line, IrcLine &ircLine)
+{
+    const char *data = line.constData();
+    int length = line.size();
+
+    // IRCv3 message tags come first, introduced by '@'
+    int start = 0;
+    if (length > 0 && data[0] == '@') {
+        while (start < length && data[start] != ' ')
+            start++;
+        ircLine.tags = QByteArray::fromRawData(data + 1, start - 1);
+    }
+    while (start < length && data[start] == ' ')
+        start++;
+
+    // a colon as the first char indicates the existence of a prefix
+    if (start < length && data[start] == ':') {
+        int prefixEnd = start;
+        while (prefixEnd < length && data[prefixEnd] != ' ')
+            prefixEnd++;
+        ircLine.prefix = QByteArray::fromRawData(data + start + 1, prefixEnd - start - 1);
+        start = prefixEnd;
+        while (start < length && data[start] == ' ')
+            start++;
+    }
+
+    // the trailing parameter might contain anything, so find it before splitting the rest
+    // the search starts at the space before the command, in case there is nothing but the trailing parameter
+    // NOTE: This assumes that this is true in raw encoding, but well, hopefully there are no servers running in japanese on protocol level...
+    int trailingPos = -1;
+    int end = length;
+    for (int i = start > 0 ? start - 1 : 0; i + 1 < length; i++) {
+        if (data[i] == ' ' && data[i + 1] == ':') {
+            trailingPos = i + 2;
+            end = i;
+            break;
+        }
+    }
+
+    int pos = start;
+    while (pos < end) {
+        if (data[pos] == ' ') {
+            pos++;
+            continue;
+        }
+        int tokenEnd = pos;
+        while (tokenEnd < end && data[tokenEnd] != ' ')
+            tokenEnd++;
+
+        if (ircLine.command.isNull())
+            ircLine.command = rawCommand(data, pos, tokenEnd);
+        else
+            ircLine.params.append(QByteArray::fromRawData(data + pos, tokenEnd - pos));
+
+        pos = tokenEnd;
+    }
+
+    // an empty trailing parameter is dropped
+    if (trailingPos >= 0 && trailingPos < length) {
+        if (ircLine.command.isNull())
+            ircLine.command = rawCommand(data, trailingPos, length);
+        else
+            ircLine.params.append(QByteArray::fromRawData(data + trailingPos, length - trailingPos));
+    }
+
+    return !ircLine.command.isEmpty();
+}
+
+
 QByteArray IrcParser::decrypt(Network *network, const QString &bufferName, const QByteArray &message, bool isTopic)
 {
 #ifdef HAVE_QCA2
@@ -85,84 +344,46 @@ void IrcParser::processNetworkIncoming(NetworkDataEvent *e)
     // note that the IRC server is still alive
     net->resetPingTimeout();
 
-    QByteArray msg = e->data();
-    if (msg.isEmpty()) {
+    const QByteArray line = e->data(); // the parts of ircLine share its data
+    if (line.isEmpty()) {
         qWarning() << "Received empty string from server!";
         return;
     }
 
     // Now we split the raw message into its various parts...
-    QString prefix;
-    QByteArray trailing;
-    QString cmd, target;
-
-    // First, check for a trailing parameter introduced by " :", since this might screw up splitting the msg
-    // NOTE: This assumes that this is true in raw encoding, but well, hopefully there are no servers running in japanese on protocol level...
-    int idx = msg.indexOf(" :");
-    if (idx >= 0) {
-        if (msg.length() > idx + 2)
-            trailing = msg.mid(idx + 2);
-        msg = msg.left(idx);
-    }
-    // OK, now it is safe to split...
-    QList<QByteArray> params = msg.split(' ');
-
-    // This could still contain empty elements due to (faulty?) ircds sending multiple spaces in a row
-    // Also, QByteArray is not nearly as convenient to work with as QString for such things :)
-    QList<QByteArray>::iterator iter = params.begin();
-    while (iter != params.end()) {
-        if (iter->isEmpty())
-            iter = params.erase(iter);
-        else
-            ++iter;
-    }
-
-    if (!trailing.isEmpty())
-        params << trailing;
-    if (params.count() < 1) {
+    IrcLine ircLine;
+    if (!tokenize(line, ircLine)) {
         qWarning() << "Received invalid string from server!";
         return;
     }
-
-    QString foo = net->serverDecode(params.takeFirst());
-
-    // a colon as the first chars indicates the existence of a prefix
-    if (foo[0] == ':') {
-        foo.remove(0, 1);
-        prefix = foo;
-        if (params.count() < 1) {
-            qWarning() << "Received invalid string from server!";
-            return;
-        }
-        foo = net->serverDecode(params.takeFirst());
-    }
-
-    // next string without a whitespace is the command
-    cmd = foo.trimmed();
+    QString prefix = net->serverDecode(ircLine.prefix);
+    const QByteArray &cmd = ircLine.command;
+    IrcLine::ParamList &params = ircLine.params;
+    QString target;
 
     QList<Event *> events;
     EventManager::EventType type = EventManager::Invalid;
 
-    uint num = cmd.toUInt();
+    uint num = replyNumber(cmd);
     if (num > 0) {
         // numeric reply
         if (params.count() == 0) {
-            qWarning() << "Message received from server violates RFC and is ignored!" << msg;
+            qWarning() << "Message received from server violates RFC and is ignored!" << line;
             return;
         }
         // numeric replies have the target as first param (RFC 2812 - 2.4). this is usually our own nick. Remove this!
-        target = net->serverDecode(params.takeFirst());
+        target = net->serverDecode(params.at(0));
+        for (int i = 1; i < params.count(); i++)
+            params[i - 1] = params.at(i);
+        params.resize(params.count() - 1);
         type = EventManager::IrcEventNumeric;
     }
     else {
         // any other irc command
-        QString typeName = QLatin1String("IrcEvent") + cmd.at(0).toUpper() + cmd.mid(1).toLower();
-        type = eventManager()->eventTypeByName(typeName);
-        if (type == EventManager::Invalid) {
-            type = eventManager()->eventTypeByName("IrcEventUnknown");
-            Q_ASSERT(type != EventManager::Invalid);
-        }
-        target = QString();
+        static const IrcCommandTable commandTable;
+        type = commandTable.type(cmd);
+        if (type == EventManager::Invalid)
+            type = EventManager::IrcEventUnknown;
     }
 
     // Almost always, all params are server-encoded. There's a few exceptions, let's catch them here!
@@ -180,7 +401,7 @@ void IrcParser::processNetworkIncoming(NetworkDataEvent *e)
 
         if (checkParamCount(cmd, params, 1)) {
             QString senderNick = nickFromMask(prefix);
-            QByteArray msg = params.count() < 2 ? QByteArray() : params.at(1);
+            QByteArray msg = params.count() < 2 ? QByteArray() : detached(params.at(1));
 
             QStringList targets = net->serverDecode(params.at(0)).split(',', QString::SkipEmptyParts);
             QStringList::const_iterator targetIter;
@@ -233,17 +454,71 @@ void IrcParser::processNetworkIncoming(NetworkDataEvent *e)
 #ifdef HAVE_QCA2
                 // Handle DH1080 key exchange
                 if (params[1].startsWith("DH1080_INIT") && !net->isChannelName(target)) {
-                    events << new KeyEvent(EventManager::KeyEvent, net, prefix, target, KeyEvent::Init, params[1].mid(12));
+                    events << new KeyEvent(EventManager::KeyEvent, net, prefix, target, KeyEvent::Init, detached(params[1].mid(12)));
                 } else if (params[1].startsWith("DH1080_FINISH") && !net->isChannelName(target)) {
-                    events << new KeyEvent(EventManager::KeyEvent, net, prefix, target, KeyEvent::Finish, params[1].mid(14));
+                    events << new KeyEvent(EventManager::KeyEvent, net, prefix, target, KeyEvent::Finish, detached(params[1].mid(14)));
                 } else
 #endif
-                    events << new IrcEventRawMessage(EventManager::IrcEventRawNotice, net, params[1], prefix, target, e->timestamp());
+                    events << new IrcEventRawMessage(EventManager::IrcEventRawNotice, net, detached(params[1]), prefix, target, e->timestamp());
+            }
+        }
+        break;
+
+    case EventManager::IrcEventBatch:
+        defaultHandling = false; // the batch is only sent once it is complete
+
+        // BATCH +<reference> <type> [<params>] opens a batch, BATCH -<reference> closes it
+        if (checkParamCount(cmd, params, 1)) {
+            QHash<QByteArray, IrcEventBatch *> &openBatches = _openBatches[net->networkId()];
+            QByteArray reference = params.at(0).mid(1);
+            if (params.at(0).startsWith('+')) {
+                if (!checkParamCount(cmd, params, 2) || openBatches.contains(reference))
+                    break;
+                if (openBatches.count() >= _maxOpenBatches) {
+                    // make room by giving up on the oldest batch
+                    QHash<QByteArray, IrcEventBatch *>::iterator oldest = openBatches.begin();
+                    for (QHash<QByteArray, IrcEventBatch *>::iterator iter = oldest; iter != openBatches.end(); ++iter) {
+                        if (iter.value()->timestamp() < oldest.value()->timestamp())
+                            oldest = iter;
+                    }
+                    flushBatch(oldest.value());
+                    openBatches.erase(oldest);
+                }
+                QStringList batchParams;
+                batchParams << net->serverDecode(reference);
+                for (int i = 1; i < params.count(); i++)
+                    batchParams << net->serverDecode(params.at(i));
+                IrcEventBatch *batch = new IrcEventBatch(net, prefix, batchParams);
+                batch->setTimestamp(e->timestamp());
+                openBatches.insert(detached(reference), batch);
+            }
+            else if (params.at(0).startsWith('-')) {
+                IrcEventBatch *batch = openBatches.take(reference);
+                if (!batch) {
+                    // we may have given up on it already
+                    qDebug() << "Received end of unknown batch" << reference;
+                    break;
+                }
+                // a nested batch becomes part of its outer batch, cf. the end of this method
+                events << batch;
             }
         }
         break;
 
     // the following events need only special casing for param decoding
+    case EventManager::IrcEventAway:
+        if (params.count() >= 1) {
+            decParams << net->userDecode(nickFromMask(prefix), params.at(0));
+        }
+        break;
+
+    case EventManager::IrcEventJoin:
+        if (params.count() >= 3) { // extended-join: channel, account and real name
+            decParams << net->serverDecode(params.at(0)) << net->serverDecode(params.at(1));
+            decParams << net->userDecode(nickFromMask(prefix), params.at(2));
+        }
+        break;
+
     case EventManager::IrcEventKick:
         if (params.count() >= 3) { // we have a reason
             decParams << net->serverDecode(params.at(0)) << net->serverDecode(params.at(1));
@@ -323,7 +598,23 @@ void IrcParser::processNetworkIncoming(NetworkDataEvent *e)
         events << event;
     }
 
+    // events from lines belonging to an open batch are held back until the batch is complete
+    IrcEventBatch *batch = 0;
+    QByteArray reference = tagValue(ircLine.tags, "batch");
+    if (!_openBatches.value(net->networkId()).isEmpty()) {
+        flushStaleBatches(net->networkId(), e->timestamp());
+        if (!reference.isEmpty())
+            batch = _openBatches[net->networkId()].value(reference);
+        if (batch && batch->events().count() + events.count() > _maxBatchEvents) {
+            flushBatch(_openBatches[net->networkId()].take(reference));
+            batch = 0;
+        }
+    }
+
     foreach(Event *event, events) {
-        emit newEvent(event);
+        if (batch)
+            batch->addEvent(event);
+        else
+            emit newEvent(event);
     }
 }
@@ -21,11 +21,14 @@
 #ifndef IRCPARSER_H
 #define IRCPARSER_H
 
+#include <QVarLengthArray>
+
 #include "coresession.h"
 
 class Event;
 class EventManager;
 class IrcEvent;
+class IrcEventBatch;
 class NetworkDataEvent;
 
 class IrcParser : public QObject
@@ -34,6 +37,7 @@ class IrcParser : public QObject
 
 public:
     IrcParser(CoreSession *session);
+    ~IrcParser();
 
     inline CoreSession *coreSession() const { return _coreSession; }
     inline EventManager *eventManager() const { return coreSession()->eventManager(); }
@@ -44,13 +48,38 @@ signals:
 protected:
     Q_INVOKABLE void processNetworkIncoming(NetworkDataEvent *e);
 
-    bool checkParamCount(const QString &cmd, const QList<QByteArray> &params, int minParams);
+    //! A raw line from the server, split in place: the parts share the line's data instead of copying it
+    struct IrcLine {
+        typedef QVarLengthArray<QByteArray, 16> ParamList;
+        QByteArray tags;
+        QByteArray prefix;
+        QByteArray command;
+        ParamList params;
+    };
+    static bool tokenize(const QByteArray &line, IrcLine &ircLine);
+
+    bool checkParamCount(const QByteArray &cmd, const IrcLine::ParamList &params, int minParams);
 
     // no-op if we don't have crypto support!
     QByteArray decrypt(Network *network, const QString &target, const QByteArray &message, bool isTopic = false);
 
+private slots:
+    void destroyBatches(NetworkId networkId);
+
+private:
+    void flushBatch(IrcEventBatch *batch);
+    void flushStaleBatches(NetworkId networkId, const QDateTime &now);
+
 private:
     CoreSession *_coreSession;
+
+    // IRCv3 batches that have been opened but not closed yet, by network and reference tag
+    QHash<NetworkId, QHash<QByteArray, IrcEventBatch *> > _openBatches;
+
+    // a server that never closes its batches must not make us hold back its events forever
+    static const int _maxOpenBatches; // per network
+    static const int _maxBatchEvents;
+    static const int _batchTimeout;   // seconds
 };
 
 
@@ -26,6 +26,8 @@
 #include "network.h"
 #include "quassel.h"
 
+int PostgreSqlStorage::_insertChunkSize = 500;
+
 PostgreSqlStorage::PostgreSqlStorage(QObject *parent)
     : AbstractSqlStorage(parent),
     _port(-1)
@@ -1359,46 +1361,58 @@ QHash<BufferId, MsgId> PostgreSqlStorage::bufferMarkerLineMsgIds(UserId user)
 }
 
 
-bool PostgreSqlStorage::logMessage(Message &msg)
+int PostgreSqlStorage::senderId(QSqlDatabase &db, const QString &sender, QHash<QString, int> &newSenderIds)
 {
-    QSqlDatabase db = logDb();
-    if (!beginTransaction(db)) {
-        qWarning() << "PostgreSqlStorage::logMessage(): cannot start transaction!";
-        qWarning() << " -" << qPrintable(db.lastError().text());
-        return false;
-    }
+    int senderId = cachedSenderId(sender);
+    if (senderId != -1)
+        return senderId;
 
-    QSqlQuery getSenderIdQuery = executePreparedQuery("select_senderid", msg.sender(), db);
-    int senderId;
-    if (getSenderIdQuery.first()) {
-        senderId = getSenderIdQuery.value(0).toInt();
+    if (newSenderIds.contains(sender))
+        return newSenderIds[sender];
+
+    QSqlQuery selectSenderQuery = executePreparedQuery("select_senderid", sender, db);
+    if (selectSenderQuery.first()) {
+        senderId = selectSenderQuery.value(0).toInt();
     }
     else {
         // it's possible that the sender was already added by another thread
         // since the insert might fail we're setting a savepoint
-        savePoint("sender_sp1", db);
-        QSqlQuery addSenderQuery = executePreparedQuery("insert_sender", msg.sender(), db);
-
+        savePoint("sender_sp", db);
+        QSqlQuery addSenderQuery = executePreparedQuery("insert_sender", sender, db);
         if (addSenderQuery.lastError().isValid()) {
-            rollbackSavePoint("sender_sp1", db);
-            getSenderIdQuery = executePreparedQuery("select_senderid", msg.sender(), db);
-            watchQuery(getSenderIdQuery);
-            getSenderIdQuery.first();
-            senderId = getSenderIdQuery.value(0).toInt();
+            rollbackSavePoint("sender_sp", db);
+            selectSenderQuery = executePreparedQuery("select_senderid", sender, db);
+            watchQuery(selectSenderQuery);
+            selectSenderQuery.first();
+            senderId = selectSenderQuery.value(0).toInt();
         }
         else {
-            releaseSavePoint("sender_sp1", db);
+            releaseSavePoint("sender_sp", db);
             addSenderQuery.first();
             senderId = addSenderQuery.value(0).toInt();
         }
     }
+    newSenderIds[sender] = senderId;
+    return senderId;
+}
+
+
+bool PostgreSqlStorage::logMessage(Message &msg)
+{
+    QSqlDatabase db = logDb();
+    if (!beginTransaction(db)) {
+        qWarning() << "PostgreSqlStorage::logMessage(): cannot start transaction!";
+        qWarning() << " -" << qPrintable(db.lastError().text());
+        return false;
+    }
 
+    QHash<QString, int> newSenderIds;
     QVariantList params;
     params << msg.timestamp()
            << msg.bufferInfo().bufferId().toInt()
            << msg.type()
            << (int)msg.flags()
-           << senderId
+           << senderId(db, msg.sender(), newSenderIds)
            << msg.contents();
     QSqlQuery logMessageQuery = executePreparedQuery("insert_message", params, db);
 
@@ -1410,6 +1424,7 @@ bool PostgreSqlStorage::logMessage(Message &msg)
     logMessageQuery.first();
     MsgId msgId = logMessageQuery.value(0).toInt();
     db.commit();
+    cacheSenderIds(newSenderIds);
     if (msgId.isValid()) {
         msg.setMsgId(msgId);
         return true;
@@ -1430,66 +1445,73 @@ bool PostgreSqlStorage::logMessages(MessageList &msgs)
     }
 
     QList<int> senderIdList;
-    QHash<QString, int> senderIds;
-    QSqlQuery addSenderQuery;
-    QSqlQuery selectSenderQuery;;
+    QHash<QString, int> newSenderIds;
+    QHash<int, int> bufferUserIds; // the owner of each buffer, looked up once per buffer instead of per row
     for (int i = 0; i < msgs.count(); i++) {
-        const QString &sender = msgs.at(i).sender();
-        if (senderIds.contains(sender)) {
-            senderIdList << senderIds[sender];
-            continue;
-        }
+        senderIdList << senderId(db, msgs.at(i).sender(), newSenderIds);
 
-        selectSenderQuery = executePreparedQuery("select_senderid", sender, db);
-        if (selectSenderQuery.first()) {
-            senderIdList << selectSenderQuery.value(0).toInt();
-            senderIds[sender] = selectSenderQuery.value(0).toInt();
-        }
-        else {
-            savePoint("sender_sp", db);
-            addSenderQuery = executePreparedQuery("insert_sender", sender, db);
-            if (addSenderQuery.lastError().isValid()) {
-                // seems it was inserted meanwhile... by a different thread
-                rollbackSavePoint("sender_sp", db);
-                selectSenderQuery = executePreparedQuery("select_senderid", sender, db);
-                watchQuery(selectSenderQuery);
-                selectSenderQuery.first();
-                senderIdList << selectSenderQuery.value(0).toInt();
-                senderIds[sender] = selectSenderQuery.value(0).toInt();
-            }
-            else {
-                releaseSavePoint("sender_sp", db);
-                addSenderQuery.first();
-                senderIdList << addSenderQuery.value(0).toInt();
-                senderIds[sender] = addSenderQuery.value(0).toInt();
+        int bufferId = msgs.at(i).bufferInfo().bufferId().toInt();
+        if (!bufferUserIds.contains(bufferId)) {
+            QSqlQuery userIdQuery = executePreparedQuery("select_buffer_userid", bufferId, db);
+            if (!watchQuery(userIdQuery) || !userIdQuery.first()) {
+                db.rollback();
+                return false;
             }
+            bufferUserIds[bufferId] = userIdQuery.value(0).toInt();
         }
     }
 
     // yes we loop twice over the same list. This avoids alternating queries.
+    // The messages themselves are written with multi-row INSERTs. PostgreSQL doesn't promise to return
+    // the rows of INSERT ... RETURNING in the order of the VALUES, so the messageids are reserved
+    // beforehand and inserted explicitly. A chunk costs two round trips.
     bool error = false;
-    for (int i = 0; i < msgs.count(); i++) {
-        Message &msg = msgs[i];
-        QVariantList params;
-        params << msg.timestamp()
-               << msg.bufferInfo().bufferId().toInt()
-               << msg.type()
-               << (int)msg.flags()
-               << senderIdList.at(i)
-               << msg.contents();
-        QSqlQuery logMessageQuery = executePreparedQuery("insert_message", params, db);
-        if (!watchQuery(logMessageQuery)) {
-            db.rollback();
+    for (int start = 0; !error && start < msgs.count(); start += _insertChunkSize) {
+        int end = qMin(start + _insertChunkSize, msgs.count());
+
+        QSqlQuery msgIdQuery = executePreparedQuery("select_messageids", end - start, db);
+        if (!watchQuery(msgIdQuery)) {
             error = true;
             break;
         }
-        else {
-            logMessageQuery.first();
-            msg.setMsgId(logMessageQuery.value(0).toInt());
+        QList<int> msgIds;
+        while (msgIdQuery.next())
+            msgIds << msgIdQuery.value(0).toInt();
+        if (msgIds.count() != end - start) {
+            qWarning() << "PostgreSqlStorage::logMessages(): got" << msgIds.count() << "messageids for" << end - start << "messages!";
+            error = true;
+            break;
         }
+        qSort(msgIds); // keep the ids ascending in the order the messages arrived
+
+        QStringList rows;
+        for (int i = start; i < end; i++) {
+            const Message &msg = msgs.at(i);
+            QVariantList params;
+            params << msgIds.at(i - start)
+                   << msg.timestamp()
+                   << msg.bufferInfo().bufferId().toInt()
+                   << msg.type()
+                   << (int)msg.flags()
+                   << senderIdList.at(i)
+                   << msg.contents()
+                   << bufferUserIds.value(msg.bufferInfo().bufferId().toInt());
+            // the values contain message text, so nothing may scan them for placeholders afterwards
+            rows << "(" + formatValues(params, db) + ")";
+        }
+
+        QSqlQuery logMessagesQuery = db.exec(queryString("insert_messages").arg(rows.join(", ")));
+        if (!watchQuery(logMessagesQuery)) {
+            error = true;
+            break;
+        }
+
+        for (int i = start; i < end; i++)
+            msgs[i].setMsgId(msgIds.at(i - start));
     }
 
     if (error) {
+        db.rollback();
         // we had a rollback in the db so we need to reset all msgIds
         for (int i = 0; i < msgs.count(); i++) {
             msgs[i].setMsgId(MsgId());
@@ -1498,25 +1520,24 @@ bool PostgreSqlStorage::logMessages(MessageList &msgs)
     }
 
     db.commit();
+    cacheSenderIds(newSenderIds);
     return true;
 }
 
 
-QList<Message> PostgreSqlStorage::requestMsgs(UserId user, BufferId bufferId, MsgId first, MsgId last, int limit)
+bool PostgreSqlStorage::visitMsgs(UserId user, BufferId bufferId, MessageVisitor &visitor, MsgId first, MsgId last, int limit)
 {
-    QList<Message> messagelist;
-
     QSqlDatabase db = logDb();
     if (!beginReadOnlyTransaction(db)) {
-        qWarning() << "PostgreSqlStorage::requestMsgs(): cannot start read only transaction!";
+        qWarning() << "PostgreSqlStorage::visitMsgs(): cannot start read only transaction!";
         qWarning() << " -" << qPrintable(db.lastError().text());
-        return messagelist;
+        return false;
     }
 
     BufferInfo bufferInfo = getBufferInfo(user, bufferId);
     if (!bufferInfo.isValid()) {
         db.rollback();
-        return messagelist;
+        return false;
     }
 
     QString queryName;
@@ -1544,7 +1565,7 @@ QList<Message> PostgreSqlStorage::requestMsgs(UserId user, BufferId bufferId, Ms
     if (!watchQuery(query)) {
         qDebug() << "select_messages failed";
         db.rollback();
-        return messagelist;
+        return false;
     }
 
     QDateTime timestamp;
@@ -1558,18 +1579,18 @@ QList<Message> PostgreSqlStorage::requestMsgs(UserId user, BufferId bufferId, Ms
             query.value(4).toString(),
             (Message::Flags)query.value(3).toUInt());
         msg.setMsgId(query.value(0).toInt());
-        messagelist << msg;
+        if (!visitor.append(msg))
+            break;
     }
 
     db.commit();
-    return messagelist;
+    visitor.flush();
+    return true;
 }
 
 
-QList<Message> PostgreSqlStorage::requestAllMsgs(UserId user, MsgId first, MsgId last, int limit)
+bool PostgreSqlStorage::visitAllMsgs(UserId user, MessageVisitor &visitor, MsgId first, MsgId last, int limit)
 {
-    QList<Message> messagelist;
-
     // requestBuffers uses it's own transaction.
     QHash<BufferId, BufferInfo> bufferInfoHash;
     foreach(BufferInfo bufferInfo, requestBuffers(user)) {
@@ -1578,12 +1599,13 @@ QList<Message> PostgreSqlStorage::requestAllMsgs(UserId user, MsgId first, MsgId
 
     QSqlDatabase db = logDb();
     if (!beginReadOnlyTransaction(db)) {
-        qWarning() << "PostgreSqlStorage::requestAllMsgs(): cannot start read only transaction!";
+        qWarning() << "PostgreSqlStorage::visitAllMsgs(): cannot start read only transaction!";
         qWarning() << " -" << qPrintable(db.lastError().text());
-        return messagelist;
+        return false;
     }
 
     QSqlQuery query(db);
+    query.setForwardOnly(true);
     if (last == -1) {
         query.prepare(queryString("select_messagesAllNew"));
     }
@@ -1593,15 +1615,17 @@ QList<Message> PostgreSqlStorage::requestAllMsgs(UserId user, MsgId first, MsgId
     }
     query.bindValue(":userid", user.toInt());
     query.bindValue(":firstmsg", first.toInt());
+    // LIMIT NULL is the same as no limit at all
+    query.bindValue(":limit", limit == -1 ? QVariant(QVariant::Int) : QVariant(limit));
     safeExec(query);
     if (!watchQuery(query)) {
         db.rollback();
-        return messagelist;
+        return false;
     }
 
     QDateTime timestamp;
-    for (int i = 0; i < limit && query.next(); i++) {
-        timestamp = query.value(1).toDateTime();
+    for (int i = 0; (limit == -1 || i < limit) && query.next(); i++) {
+        timestamp = query.value(2).toDateTime();
         timestamp.setTimeSpec(Qt::UTC);
         Message msg(timestamp,
             bufferInfoHash[query.value(1).toInt()],
@@ -1610,11 +1634,162 @@ QList<Message> PostgreSqlStorage::requestAllMsgs(UserId user, MsgId first, MsgId
             query.value(5).toString(),
             (Message::Flags)query.value(4).toUInt());
         msg.setMsgId(query.value(0).toInt());
-        messagelist << msg;
+        if (!visitor.append(msg))
+            break;
     }
 
     db.commit();
-    return messagelist;
+    visitor.flush();
+    return true;
+}
+
+
+bool PostgreSqlStorage::searchMsgs(UserId user, const QString &query, BufferId bufferId, MessageVisitor &visitor, int offset, int limit)
+{
+    // requestBuffers uses it's own transaction.
+    QHash<BufferId, BufferInfo> bufferInfoHash;
+    foreach(BufferInfo bufferInfo, requestBuffers(user)) {
+        bufferInfoHash[bufferInfo.bufferId()] = bufferInfo;
+    }
+
+    QSqlDatabase db = logDb();
+    if (!beginReadOnlyTransaction(db)) {
+        qWarning() << "PostgreSqlStorage::searchMsgs(): cannot start read only transaction!";
+        qWarning() << " -" << qPrintable(db.lastError().text());
+        return false;
+    }
+
+    // plainto_tsquery() ignores operators, so the user input can be passed as is
+    QSqlQuery searchQuery(db);
+    searchQuery.setForwardOnly(true);
+    searchQuery.prepare(queryString("select_messagesSearch"));
+    searchQuery.bindValue(":query", query);
+    searchQuery.bindValue(":userid", user.toInt());
+    searchQuery.bindValue(":allbuffers", !bufferId.isValid());
+    searchQuery.bindValue(":bufferid", bufferId.toInt());
+    // LIMIT NULL is the same as no limit at all
+    searchQuery.bindValue(":limit", limit == -1 ? QVariant(QVariant::Int) : QVariant(limit));
+    searchQuery.bindValue(":offset", offset);
+    safeExec(searchQuery);
+    if (!watchQuery(searchQuery)) {
+        db.rollback();
+        return false;
+    }
+
+    QDateTime timestamp;
+    while (searchQuery.next()) {
+        timestamp = searchQuery.value(2).toDateTime();
+        timestamp.setTimeSpec(Qt::UTC);
+        Message msg(timestamp,
+            bufferInfoHash[searchQuery.value(1).toInt()],
+            (Message::Type)searchQuery.value(3).toUInt(),
+            searchQuery.value(6).toString(),
+            searchQuery.value(5).toString(),
+            (Message::Flags)searchQuery.value(4).toUInt());
+        msg.setMsgId(searchQuery.value(0).toInt());
+        if (!visitor.append(msg))
+            break;
+    }
+
+    db.commit();
+    visitor.flush();
+    return true;
+}
+
+
+void PostgreSqlStorage::setAsyncCommit(bool enabled)
+{
+    // only affects this session, the server still guarantees consistency
+    QSqlDatabase db = logDb();
+    QSqlQuery query = db.exec(enabled ? "SET synchronous_commit TO off" : "SET synchronous_commit TO on");
+    watchQuery(query);
+}
+
+
+int PostgreSqlStorage::expireMsgs(UserId user, const BufferInfo &buffer, const QDateTime &before, int keepCount, int batchSize, MessageVisitor *archive)
+{
+    QSqlDatabase db = logDb();
+    if (!beginTransaction(db)) {
+        qWarning() << "PostgreSqlStorage::expireMsgs(): cannot start transaction!";
+        qWarning() << " -" << qPrintable(db.lastError().text());
+        return -1;
+    }
+
+    // -1 doesn't match any message, and neither does comparing against NULL
+    int lastMsgId = -1;
+    QVariant beforeTime = before.isValid() ? QVariant(before.toUTC()) : QVariant(QVariant::DateTime);
+
+    if (keepCount > 0) {
+        QSqlQuery lastMsgQuery(db);
+        lastMsgQuery.prepare(queryString("select_expired_lastmsg"));
+        lastMsgQuery.bindValue(":bufferid", buffer.bufferId().toInt());
+        lastMsgQuery.bindValue(":userid", user.toInt());
+        lastMsgQuery.bindValue(":keepcount", keepCount);
+        safeExec(lastMsgQuery);
+        if (!watchQuery(lastMsgQuery)) {
+            db.rollback();
+            return -1;
+        }
+        if (lastMsgQuery.first())
+            lastMsgId = lastMsgQuery.value(0).toInt();
+    }
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    query.prepare(queryString("select_expired_messages"));
+    query.bindValue(":bufferid", buffer.bufferId().toInt());
+    query.bindValue(":userid", user.toInt());
+    query.bindValue(":lastmsg", lastMsgId);
+    query.bindValue(":time", beforeTime);
+    query.bindValue(":limit", batchSize);
+    safeExec(query);
+    if (!watchQuery(query)) {
+        db.rollback();
+        return -1;
+    }
+
+    int count = 0;
+    int maxMsgId = 0;
+    QDateTime timestamp;
+    while (query.next()) {
+        maxMsgId = query.value(0).toInt();
+        count++;
+        if (archive) {
+            timestamp = query.value(1).toDateTime();
+            timestamp.setTimeSpec(Qt::UTC);
+            Message msg(timestamp,
+                buffer,
+                (Message::Type)query.value(2).toUInt(),
+                query.value(5).toString(),
+                query.value(4).toString(),
+                (Message::Flags)query.value(3).toUInt());
+            msg.setMsgId(maxMsgId);
+            if (!archive->append(msg))
+                break;
+        }
+    }
+    if (archive && !archive->flush()) {
+        db.rollback();
+        return -1;
+    }
+
+    if (count) {
+        QSqlQuery deleteQuery(db);
+        deleteQuery.prepare(queryString("delete_expired_messages"));
+        deleteQuery.bindValue(":bufferid", buffer.bufferId().toInt());
+        deleteQuery.bindValue(":userid", user.toInt());
+        deleteQuery.bindValue(":maxmsg", maxMsgId);
+        deleteQuery.bindValue(":lastmsg", lastMsgId);
+        deleteQuery.bindValue(":time", beforeTime);
+        safeExec(deleteQuery);
+        if (!watchQuery(deleteQuery)) {
+            db.rollback();
+            return -1;
+        }
+    }
+
+    db.commit();
+    return count;
 }
 
 
@@ -1722,28 +1897,33 @@ QSqlQuery PostgreSqlStorage::prepareAndExecuteQuery(const QString &queryname, co
 }
 
 
-QSqlQuery PostgreSqlStorage::executePreparedQuery(const QString &queryname, const QVariantList &params, QSqlDatabase &db)
+QString PostgreSqlStorage::formatValues(const QVariantList &values, const QSqlDatabase &db)
 {
     QSqlDriver *driver = db.driver();
 
-    QStringList paramStrings;
+    QStringList valueStrings;
     QSqlField field;
-    for (int i = 0; i < params.count(); i++) {
-        const QVariant &value = params.at(i);
+    for (int i = 0; i < values.count(); i++) {
+        const QVariant &value = values.at(i);
         field.setType(value.type());
         if (value.isNull())
             field.clear();
         else
             field.setValue(value);
 
-        paramStrings << driver->formatValue(field);
+        valueStrings << driver->formatValue(field);
     }
+    return valueStrings.join(", ");
+}
+
 
+QSqlQuery PostgreSqlStorage::executePreparedQuery(const QString &queryname, const QVariantList &params, QSqlDatabase &db)
+{
     if (params.isEmpty()) {
         return prepareAndExecuteQuery(queryname, db);
     }
     else {
-        return prepareAndExecuteQuery(queryname, paramStrings.join(", "), db);
+        return prepareAndExecuteQuery(queryname, formatValues(params, db), db);
     }
 }
 
@@ -1957,6 +2137,7 @@ bool PostgreSqlMigrationWriter::writeMo(const BacklogMO &backlog)
     bindValue(4, (int)backlog.flags);
     bindValue(5, backlog.senderid);
     bindValue(6, backlog.message);
+    bindValue(7, backlog.bufferid.toInt());
     return exec();
 }
 
@@ -2013,3 +2194,54 @@ bool PostgreSqlMigrationWriter::postProcess()
     }
     return true;
 }
+
+
+// the checkpoint is kept as "<MigrationObject>:<last id>" in the coreinfo table
+bool PostgreSqlMigrationWriter::saveCheckpoint(MigrationObject mo, int lastId)
+{
+    QSqlDatabase db = logDb();
+    QString checkpoint = QString("%1:%2").arg((int)mo).arg(lastId);
+
+    QSqlQuery updateQuery(db);
+    updateQuery.prepare("UPDATE coreinfo SET value = :checkpoint WHERE key = 'migrationcheckpoint'");
+    updateQuery.bindValue(":checkpoint", checkpoint);
+    safeExec(updateQuery);
+    if (!watchQuery(updateQuery))
+        return false;
+    if (updateQuery.numRowsAffected() > 0)
+        return true;
+
+    QSqlQuery insertQuery(db);
+    insertQuery.prepare("INSERT INTO coreinfo (key, value) VALUES ('migrationcheckpoint', :checkpoint)");
+    insertQuery.bindValue(":checkpoint", checkpoint);
+    safeExec(insertQuery);
+    return watchQuery(insertQuery);
+}
+
+
+bool PostgreSqlMigrationWriter::loadCheckpoint(MigrationObject &mo, int &lastId)
+{
+    QSqlQuery query(logDb());
+    query.prepare("SELECT value FROM coreinfo WHERE key = 'migrationcheckpoint'");
+    safeExec(query);
+    if (!watchQuery(query) || !query.first())
+        return false;
+
+    QStringList checkpoint = query.value(0).toString().split(':');
+    if (checkpoint.count() != 2) {
+        qWarning() << "PostgreSqlMigrationWriter::loadCheckpoint(): ignoring invalid checkpoint" << query.value(0).toString();
+        return false;
+    }
+    mo = (MigrationObject)checkpoint[0].toInt();
+    lastId = checkpoint[1].toInt();
+    return true;
+}
+
+
+bool PostgreSqlMigrationWriter::clearCheckpoint()
+{
+    QSqlQuery query(logDb());
+    query.prepare("DELETE FROM coreinfo WHERE key = 'migrationcheckpoint'");
+    safeExec(query);
+    return watchQuery(query);
+}
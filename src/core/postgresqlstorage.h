@@ -99,8 +99,15 @@ public slots:
     /* Message handling */
     virtual bool logMessage(Message &msg);
     virtual bool logMessages(MessageList &msgs);
-    virtual QList<Message> requestMsgs(UserId user, BufferId bufferId, MsgId first = -1, MsgId last = -1, int limit = -1);
-    virtual QList<Message> requestAllMsgs(UserId user, MsgId first = -1, MsgId last = -1, int limit = -1);
+    virtual bool visitMsgs(UserId user, BufferId bufferId, MessageVisitor &visitor, MsgId first = -1, MsgId last = -1, int limit = -1);
+    virtual bool visitAllMsgs(UserId user, MessageVisitor &visitor, MsgId first = -1, MsgId last = -1, int limit = -1);
+    virtual bool searchMsgs(UserId user, const QString &query, BufferId bufferId, MessageVisitor &visitor, int offset, int limit);
+
+    virtual void setAsyncCommit(bool enabled);
+
+    virtual int expireMsgs(UserId user, const BufferInfo &buffer, const QDateTime &before, int keepCount, int batchSize, MessageVisitor *archive = 0);
+    // no removeUnusedSenders(): there is no index on backlog.senderid, so the ON DELETE SET NULL
+    // check would scan the whole backlog once per deleted sender
 
 protected:
     virtual bool initDbSession(QSqlDatabase &db);
@@ -119,6 +126,7 @@ protected:
     bool beginTransaction(QSqlDatabase &db);
     bool beginReadOnlyTransaction(QSqlDatabase &db);
 
+    QString formatValues(const QVariantList &values, const QSqlDatabase &db);
     QSqlQuery executePreparedQuery(const QString &queryname, const QVariantList &params, QSqlDatabase &db);
     QSqlQuery executePreparedQuery(const QString &queryname, const QVariant &param, QSqlDatabase &db);
     void deallocateQuery(const QString &queryname, const QSqlDatabase &db);
@@ -130,6 +138,8 @@ protected:
 private:
     void bindNetworkInfo(QSqlQuery &query, const NetworkInfo &info);
     void bindServerInfo(QSqlQuery &query, const Network::Server &server);
+    // find or create the sender's id, ids not yet cached are added to newSenderIds
+    int senderId(QSqlDatabase &db, const QString &sender, QHash<QString, int> &newSenderIds);
     QSqlQuery prepareAndExecuteQuery(const QString &queryname, const QString &paramstring, QSqlDatabase &db);
     inline QSqlQuery prepareAndExecuteQuery(const QString &queryname, QSqlDatabase &db) { return prepareAndExecuteQuery(queryname, QString(), db); }
 
@@ -138,6 +148,9 @@ private:
     QString _databaseName;
     QString _userName;
     QString _password;
+
+    // rows per multi-row INSERT in logMessages()
+    static int _insertChunkSize;
 };
 
 
@@ -165,6 +178,10 @@ public:
 
     virtual bool postProcess();
 
+    virtual bool saveCheckpoint(MigrationObject mo, int lastId);
+    virtual bool loadCheckpoint(MigrationObject &mo, int &lastId);
+    virtual bool clearCheckpoint();
+
 protected:
     virtual inline bool transaction() { return logDb().transaction(); }
     virtual inline void rollback() { logDb().rollback(); }
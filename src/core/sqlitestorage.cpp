@@ -29,7 +29,8 @@
 int SqliteStorage::_maxRetryCount = 150;
 
 SqliteStorage::SqliteStorage(QObject *parent)
-    : AbstractSqlStorage(parent)
+    : AbstractSqlStorage(parent),
+    _walMode(false)
 {
 }
 
@@ -424,13 +425,14 @@ bool SqliteStorage::updateIdentity(UserId user, const CoreIdentity &identity)
         checkQuery.prepare(queryString("select_checkidentity"));
         checkQuery.bindValue(":identityid", identity.id().toInt());
         checkQuery.bindValue(":userid", user.toInt());
-        lockForRead();
+        lockForWrite();
         safeExec(checkQuery);
 
         // there should be exactly one identity for the given id and user
         error = (!checkQuery.first() || checkQuery.value(0).toInt() != 1);
     }
     if (error) {
+        db.rollback();
         unlock();
         return false;
     }
@@ -498,13 +500,14 @@ void SqliteStorage::removeIdentity(UserId user, IdentityId identityId)
         checkQuery.prepare(queryString("select_checkidentity"));
         checkQuery.bindValue(":identityid", identityId.toInt());
         checkQuery.bindValue(":userid", user.toInt());
-        lockForRead();
+        lockForWrite();
         safeExec(checkQuery);
 
         // there should be exactly one identity for the given id and user
         error = (!checkQuery.first() || checkQuery.value(0).toInt() != 1);
     }
     if (error) {
+        db.rollback();
         unlock();
         return;
     }
@@ -1134,8 +1137,13 @@ BufferInfo SqliteStorage::bufferInfo(UserId user, const NetworkId &networkId, Bu
             createQuery.bindValue(":buffercname", buffer.toLower());
             createQuery.bindValue(":joined", type & BufferInfo::ChannelBuffer ? 1 : 0);
 
+            // In WAL mode a read transaction can't be turned into a write transaction once
+            // another connection has committed, so we start a fresh one for the insert.
+            query.finish();
+            db.commit();
             unlock();
             lockForWrite();
+            db.transaction();
             safeExec(createQuery);
             watchQuery(createQuery);
             bufferInfo = BufferInfo(createQuery.lastInsertId().toInt(), networkId, type, 0, buffer);
@@ -1154,8 +1162,7 @@ BufferInfo SqliteStorage::getBufferInfo(UserId user, const BufferId &bufferId)
 
     BufferInfo bufferInfo;
     {
-        QSqlQuery query(db);
-        query.prepare(queryString("select_buffer_by_id"));
+        QSqlQuery query = cachedQuery("select_buffer_by_id", db);
         query.bindValue(":userid", user.toInt());
         query.bindValue(":bufferid", bufferId.toInt());
 
@@ -1166,6 +1173,7 @@ BufferInfo SqliteStorage::getBufferInfo(UserId user, const BufferId &bufferId)
             bufferInfo = BufferInfo(query.value(0).toInt(), query.value(1).toInt(), (BufferInfo::Type)query.value(2).toInt(), 0, query.value(4).toString());
             Q_ASSERT(!query.next());
         }
+        query.finish();
         db.commit();
     }
     unlock();
@@ -1181,8 +1189,7 @@ QList<BufferInfo> SqliteStorage::requestBuffers(UserId user)
     db.transaction();
 
     {
-        QSqlQuery query(db);
-        query.prepare(queryString("select_buffers"));
+        QSqlQuery query = cachedQuery("select_buffers", db);
         query.bindValue(":userid", user.toInt());
 
         lockForRead();
@@ -1320,7 +1327,7 @@ bool SqliteStorage::mergeBuffersPermanently(const UserId &user, const BufferId &
         checkQuery.bindValue(":newbufferid", bufferId1.toInt());
         checkQuery.bindValue(":userid", user.toInt());
 
-        lockForRead();
+        lockForWrite();
         safeExec(checkQuery);
         error = (!checkQuery.first() || checkQuery.value(0).toInt() != 2);
     }
@@ -1464,40 +1471,65 @@ QHash<BufferId, MsgId> SqliteStorage::bufferMarkerLineMsgIds(UserId user)
 }
 
 
+int SqliteStorage::senderId(QSqlDatabase &db, const QString &sender, QHash<QString, int> &newSenderIds)
+{
+    int senderId = cachedSenderId(sender);
+    if (senderId != -1)
+        return senderId;
+
+    if (newSenderIds.contains(sender))
+        return newSenderIds[sender];
+
+    QSqlQuery selectSenderQuery = cachedQuery("select_senderid", db);
+    selectSenderQuery.bindValue(":sender", sender);
+    safeExec(selectSenderQuery);
+    if (selectSenderQuery.first()) {
+        senderId = selectSenderQuery.value(0).toInt();
+        selectSenderQuery.finish();
+    }
+    else {
+        QSqlQuery addSenderQuery = cachedQuery("insert_sender", db);
+        addSenderQuery.bindValue(":sender", sender);
+        safeExec(addSenderQuery);
+        if (!watchQuery(addSenderQuery))
+            return -1;
+        senderId = addSenderQuery.lastInsertId().toInt();
+    }
+    newSenderIds[sender] = senderId;
+    return senderId;
+}
+
+
 bool SqliteStorage::logMessage(Message &msg)
 {
     QSqlDatabase db = logDb();
     db.transaction();
 
     bool error = false;
+    QHash<QString, int> newSenderIds;
     {
-        QSqlQuery logMessageQuery(db);
-        logMessageQuery.prepare(queryString("insert_message"));
+        lockForWrite();
+        int senderId = this->senderId(db, msg.sender(), newSenderIds);
+
+        QSqlQuery logMessageQuery = cachedQuery("insert_message", db);
 
         logMessageQuery.bindValue(":time", msg.timestamp().toTime_t());
         logMessageQuery.bindValue(":bufferid", msg.bufferInfo().bufferId().toInt());
         logMessageQuery.bindValue(":type", msg.type());
         logMessageQuery.bindValue(":flags", (int)msg.flags());
-        logMessageQuery.bindValue(":sender", msg.sender());
+        logMessageQuery.bindValue(":senderid", senderId);
         logMessageQuery.bindValue(":message", msg.contents());
 
-        lockForWrite();
-        safeExec(logMessageQuery);
-
-        if (logMessageQuery.lastError().isValid()) {
-            // constraint violation - must be NOT NULL constraint - probably the sender is missing...
-            if (logMessageQuery.lastError().number() == 19) {
-                QSqlQuery addSenderQuery(db);
-                addSenderQuery.prepare(queryString("insert_sender"));
-                addSenderQuery.bindValue(":sender", msg.sender());
-                safeExec(addSenderQuery);
-                safeExec(logMessageQuery);
-                error = !watchQuery(logMessageQuery);
-            }
-            else {
-                watchQuery(logMessageQuery);
-            }
+        if (senderId == -1) {
+            error = true;
         }
+        else {
+            safeExec(logMessageQuery);
+            error = !watchQuery(logMessageQuery);
+        }
+        // nothing is inserted if the buffer doesn't exist
+        if (!error && logMessageQuery.numRowsAffected() != 1)
+            error = true;
         if (!error) {
             MsgId msgId = logMessageQuery.lastInsertId().toInt();
             if (msgId.isValid()) {
@@ -1514,6 +1546,7 @@ bool SqliteStorage::logMessage(Message &msg)
     }
     else {
         db.commit();
+        cacheSenderIds(newSenderIds);
     }
 
     unlock();
@@ -1526,26 +1559,22 @@ bool SqliteStorage::logMessages(MessageList &msgs)
     QSqlDatabase db = logDb();
     db.transaction();
 
-    {
-        QSet<QString> senders;
-        QSqlQuery addSenderQuery(db);
-        addSenderQuery.prepare(queryString("insert_sender"));
-        lockForWrite();
-        for (int i = 0; i < msgs.count(); i++) {
-            const QString &sender = msgs.at(i).sender();
-            if (senders.contains(sender))
-                continue;
-            senders << sender;
-
-            addSenderQuery.bindValue(":sender", sender);
-            safeExec(addSenderQuery);
+    bool error = false;
+    QList<int> senderIdList;
+    QHash<QString, int> newSenderIds;
+    lockForWrite();
+    for (int i = 0; i < msgs.count(); i++) {
+        int senderId = this->senderId(db, msgs.at(i).sender(), newSenderIds);
+        if (senderId == -1) {
+            error = true;
+            break;
         }
+        senderIdList << senderId;
     }
 
-    bool error = false;
-    {
-        QSqlQuery logMessageQuery(db);
-        logMessageQuery.prepare(queryString("insert_message"));
+    // yes we loop twice over the same list. This avoids alternating queries.
+    if (!error) {
+        QSqlQuery logMessageQuery = cachedQuery("insert_message", db);
         for (int i = 0; i < msgs.count(); i++) {
             Message &msg = msgs[i];
 
@@ -1553,11 +1582,11 @@ bool SqliteStorage::logMessages(MessageList &msgs)
             logMessageQuery.bindValue(":bufferid", msg.bufferInfo().bufferId().toInt());
             logMessageQuery.bindValue(":type", msg.type());
             logMessageQuery.bindValue(":flags", (int)msg.flags());
-            logMessageQuery.bindValue(":sender", msg.sender());
+            logMessageQuery.bindValue(":senderid", senderIdList.at(i));
             logMessageQuery.bindValue(":message", msg.contents());
 
             safeExec(logMessageQuery);
-            if (!watchQuery(logMessageQuery)) {
+            if (!watchQuery(logMessageQuery) || logMessageQuery.numRowsAffected() != 1) {
                 error = true;
                 break;
             }
@@ -1578,15 +1607,14 @@ bool SqliteStorage::logMessages(MessageList &msgs)
     else {
         db.commit();
         unlock();
+        cacheSenderIds(newSenderIds);
     }
     return !error;
 }
 
 
-QList<Message> SqliteStorage::requestMsgs(UserId user, BufferId bufferId, MsgId first, MsgId last, int limit)
+bool SqliteStorage::visitMsgs(UserId user, BufferId bufferId, MessageVisitor &visitor, MsgId first, MsgId last, int limit)
 {
-    QList<Message> messagelist;
-
     QSqlDatabase db = logDb();
     db.transaction();
 
@@ -1595,8 +1623,7 @@ QList<Message> SqliteStorage::requestMsgs(UserId user, BufferId bufferId, MsgId
     {
         // code dupication from getBufferInfo:
         // this is due to the impossibility of nesting transactions and recursive locking
-        QSqlQuery bufferInfoQuery(db);
-        bufferInfoQuery.prepare(queryString("select_buffer_by_id"));
+        QSqlQuery bufferInfoQuery = cachedQuery("select_buffer_by_id", db);
         bufferInfoQuery.bindValue(":userid", user.toInt());
         bufferInfoQuery.bindValue(":bufferid", bufferId.toInt());
 
@@ -1607,24 +1634,26 @@ QList<Message> SqliteStorage::requestMsgs(UserId user, BufferId bufferId, MsgId
             bufferInfo = BufferInfo(bufferInfoQuery.value(0).toInt(), bufferInfoQuery.value(1).toInt(), (BufferInfo::Type)bufferInfoQuery.value(2).toInt(), 0, bufferInfoQuery.value(4).toString());
             error = !bufferInfo.isValid();
         }
+        bufferInfoQuery.finish();
     }
     if (error) {
         db.rollback();
         unlock();
-        return messagelist;
+        return false;
     }
 
     {
-        QSqlQuery query(db);
+        // rows are handed to the visitor as we step through them, cached queries are forward only
+        QSqlQuery query;
         if (last == -1 && first == -1) {
-            query.prepare(queryString("select_messagesNewestK"));
+            query = cachedQuery("select_messagesNewestK", db);
         }
         else if (last == -1) {
-            query.prepare(queryString("select_messagesNewerThan"));
+            query = cachedQuery("select_messagesNewerThan", db);
             query.bindValue(":firstmsg", first.toInt());
         }
         else {
-            query.prepare(queryString("select_messages"));
+            query = cachedQuery("select_messages", db);
             query.bindValue(":lastmsg", last.toInt());
             query.bindValue(":firstmsg", first.toInt());
         }
@@ -1632,9 +1661,9 @@ QList<Message> SqliteStorage::requestMsgs(UserId user, BufferId bufferId, MsgId
         query.bindValue(":limit", limit);
 
         safeExec(query);
-        watchQuery(query);
+        error = !watchQuery(query);
 
-        while (query.next()) {
+        while (!error && query.next()) {
             Message msg(QDateTime::fromTime_t(query.value(1).toInt()),
                 bufferInfo,
                 (Message::Type)query.value(2).toUInt(),
@@ -1642,27 +1671,28 @@ QList<Message> SqliteStorage::requestMsgs(UserId user, BufferId bufferId, MsgId
                 query.value(4).toString(),
                 (Message::Flags)query.value(3).toUInt());
             msg.setMsgId(query.value(0).toInt());
-            messagelist << msg;
+            if (!visitor.append(msg))
+                break;
         }
+        query.finish();
     }
     db.commit();
     unlock();
 
-    return messagelist;
+    visitor.flush();
+    return !error;
 }
 
 
-QList<Message> SqliteStorage::requestAllMsgs(UserId user, MsgId first, MsgId last, int limit)
+bool SqliteStorage::visitAllMsgs(UserId user, MessageVisitor &visitor, MsgId first, MsgId last, int limit)
 {
-    QList<Message> messagelist;
-
     QSqlDatabase db = logDb();
     db.transaction();
 
+    bool error = false;
     QHash<BufferId, BufferInfo> bufferInfoHash;
     {
-        QSqlQuery bufferInfoQuery(db);
-        bufferInfoQuery.prepare(queryString("select_buffers"));
+        QSqlQuery bufferInfoQuery = cachedQuery("select_buffers", db);
         bufferInfoQuery.bindValue(":userid", user.toInt());
 
         lockForRead();
@@ -1673,12 +1703,12 @@ QList<Message> SqliteStorage::requestAllMsgs(UserId user, MsgId first, MsgId las
             bufferInfoHash[bufferInfo.bufferId()] = bufferInfo;
         }
 
-        QSqlQuery query(db);
+        QSqlQuery query;
         if (last == -1) {
-            query.prepare(queryString("select_messagesAllNew"));
+            query = cachedQuery("select_messagesAllNew", db);
         }
         else {
-            query.prepare(queryString("select_messagesAll"));
+            query = cachedQuery("select_messagesAll", db);
             query.bindValue(":lastmsg", last.toInt());
         }
         query.bindValue(":userid", user.toInt());
@@ -1686,9 +1716,9 @@ QList<Message> SqliteStorage::requestAllMsgs(UserId user, MsgId first, MsgId las
         query.bindValue(":limit", limit);
         safeExec(query);
 
-        watchQuery(query);
+        error = !watchQuery(query);
 
-        while (query.next()) {
+        while (!error && query.next()) {
             Message msg(QDateTime::fromTime_t(query.value(2).toInt()),
                 bufferInfoHash[query.value(1).toInt()],
                 (Message::Type)query.value(3).toUInt(),
@@ -1696,12 +1726,279 @@ QList<Message> SqliteStorage::requestAllMsgs(UserId user, MsgId first, MsgId las
                 query.value(5).toString(),
                 (Message::Flags)query.value(4).toUInt());
             msg.setMsgId(query.value(0).toInt());
-            messagelist << msg;
+            if (!visitor.append(msg))
+                break;
+        }
+        query.finish();
+    }
+    db.commit();
+    unlock();
+
+    visitor.flush();
+    return !error;
+}
+
+
+bool SqliteStorage::searchMsgs(UserId user, const QString &query, BufferId bufferId, MessageVisitor &visitor, int offset, int limit)
+{
+    // quote every word so that FTS operators typed by the user are searched for literally
+    QStringList terms;
+    foreach(QString term, query.split(QRegExp("\\s+"), QString::SkipEmptyParts)) {
+        term.remove('"');
+        if (!term.isEmpty())
+            terms << QString("\"%1\"").arg(term);
+    }
+    if (terms.isEmpty()) {
+        visitor.flush();
+        return true;
+    }
+
+    QSqlDatabase db = logDb();
+    db.transaction();
+
+    bool error = false;
+    QHash<BufferId, BufferInfo> bufferInfoHash;
+    {
+        QSqlQuery bufferInfoQuery = cachedQuery("select_buffers", db);
+        bufferInfoQuery.bindValue(":userid", user.toInt());
+
+        lockForRead();
+        safeExec(bufferInfoQuery);
+        watchQuery(bufferInfoQuery);
+        while (bufferInfoQuery.next()) {
+            BufferInfo bufferInfo = BufferInfo(bufferInfoQuery.value(0).toInt(), bufferInfoQuery.value(1).toInt(), (BufferInfo::Type)bufferInfoQuery.value(2).toInt(), bufferInfoQuery.value(3).toInt(), bufferInfoQuery.value(4).toString());
+            bufferInfoHash[bufferInfo.bufferId()] = bufferInfo;
+        }
+
+        QSqlQuery searchQuery = cachedQuery("select_messagesSearch", db);
+        searchQuery.bindValue(":query", terms.join(" "));
+        searchQuery.bindValue(":userid", user.toInt());
+        searchQuery.bindValue(":allbuffers", !bufferId.isValid());
+        searchQuery.bindValue(":bufferid", bufferId.toInt());
+        searchQuery.bindValue(":limit", limit);
+        searchQuery.bindValue(":offset", offset);
+        safeExec(searchQuery);
+
+        error = !watchQuery(searchQuery);
+
+        while (!error && searchQuery.next()) {
+            Message msg(QDateTime::fromTime_t(searchQuery.value(2).toInt()),
+                bufferInfoHash[searchQuery.value(1).toInt()],
+                (Message::Type)searchQuery.value(3).toUInt(),
+                searchQuery.value(6).toString(),
+                searchQuery.value(5).toString(),
+                (Message::Flags)searchQuery.value(4).toUInt());
+            msg.setMsgId(searchQuery.value(0).toInt());
+            if (!visitor.append(msg))
+                break;
         }
+        searchQuery.finish();
     }
     db.commit();
     unlock();
-    return messagelist;
+
+    visitor.flush();
+    return !error;
+}
+
+
+void SqliteStorage::setAsyncCommit(bool enabled)
+{
+    // FULL is SQLite's default. With OFF, SQLite hands the data to the OS without syncing it.
+    QSqlQuery query(logDb());
+    query.prepare(enabled ? "PRAGMA synchronous = OFF" : "PRAGMA synchronous = FULL");
+    lockForWrite();
+    safeExec(query);
+    watchQuery(query);
+    unlock();
+}
+
+
+int SqliteStorage::expireMsgs(UserId user, const BufferInfo &buffer, const QDateTime &before, int keepCount, int batchSize, MessageVisitor *archive)
+{
+    QSqlDatabase db = logDb();
+    db.transaction();
+
+    // -1 and 0 don't match any message
+    int lastMsgId = -1;
+    uint beforeTime = before.isValid() ? before.toTime_t() : 0;
+
+    bool error = false;
+    int count = 0;
+    int maxMsgId = 0;
+    {
+        lockForWrite();
+        if (keepCount > 0) {
+            QSqlQuery lastMsgQuery(db);
+            lastMsgQuery.prepare(queryString("select_expired_lastmsg"));
+            lastMsgQuery.bindValue(":bufferid", buffer.bufferId().toInt());
+            lastMsgQuery.bindValue(":userid", user.toInt());
+            lastMsgQuery.bindValue(":keepcount", keepCount);
+            safeExec(lastMsgQuery);
+            error = !watchQuery(lastMsgQuery);
+            if (lastMsgQuery.first())
+                lastMsgId = lastMsgQuery.value(0).toInt();
+        }
+
+        QSqlQuery query(db);
+        query.setForwardOnly(true);
+        query.prepare(queryString("select_expired_messages"));
+        query.bindValue(":bufferid", buffer.bufferId().toInt());
+        query.bindValue(":userid", user.toInt());
+        query.bindValue(":lastmsg", lastMsgId);
+        query.bindValue(":time", beforeTime);
+        query.bindValue(":limit", batchSize);
+        if (!error) {
+            safeExec(query);
+            error = !watchQuery(query);
+        }
+
+        while (!error && query.next()) {
+            maxMsgId = query.value(0).toInt();
+            count++;
+            if (archive) {
+                Message msg(QDateTime::fromTime_t(query.value(1).toInt()),
+                    buffer,
+                    (Message::Type)query.value(2).toUInt(),
+                    query.value(5).toString(),
+                    query.value(4).toString(),
+                    (Message::Flags)query.value(3).toUInt());
+                msg.setMsgId(maxMsgId);
+                error = !archive->append(msg);
+            }
+        }
+        if (!error && archive)
+            error = !archive->flush();
+
+        if (!error && count) {
+            QSqlQuery deleteQuery(db);
+            deleteQuery.prepare(queryString("delete_expired_messages"));
+            deleteQuery.bindValue(":bufferid", buffer.bufferId().toInt());
+            deleteQuery.bindValue(":userid", user.toInt());
+            deleteQuery.bindValue(":maxmsg", maxMsgId);
+            deleteQuery.bindValue(":lastmsg", lastMsgId);
+            deleteQuery.bindValue(":time", beforeTime);
+            safeExec(deleteQuery);
+            error = !watchQuery(deleteQuery);
+        }
+    }
+
+    if (error) {
+        db.rollback();
+    }
+    else {
+        db.commit();
+    }
+    unlock();
+    return error ? -1 : count;
+}
+
+
+int SqliteStorage::removeUnusedSenders(int &senderId, int batchSize)
+{
+    QSqlDatabase db = logDb();
+    db.transaction();
+
+    int count = -1;
+    int lastSenderId = senderId;
+    {
+        QSqlQuery batchQuery(db);
+        batchQuery.prepare(queryString("select_senderid_batch_end"));
+        batchQuery.bindValue(":senderid", senderId);
+        batchQuery.bindValue(":limit", batchSize);
+
+        lockForWrite();
+        safeExec(batchQuery);
+        if (watchQuery(batchQuery)) {
+            if (batchQuery.first() && !batchQuery.value(0).isNull())
+                lastSenderId = batchQuery.value(0).toInt();
+            batchQuery.finish();
+
+            if (lastSenderId == senderId) {
+                count = 0; // no senders left
+            }
+            else {
+                // backlog_senderid_idx turns the reference check into one index lookup per sender
+                QSqlQuery deleteQuery(db);
+                deleteQuery.prepare(queryString("delete_unused_senders"));
+                deleteQuery.bindValue(":first", senderId);
+                deleteQuery.bindValue(":last", lastSenderId);
+                safeExec(deleteQuery);
+                if (watchQuery(deleteQuery))
+                    count = deleteQuery.numRowsAffected();
+            }
+        }
+    }
+
+    if (count == -1) {
+        db.rollback();
+    }
+    else {
+        db.commit();
+        senderId = lastSenderId;
+        // inserts resolve senders under the write lock, so nobody can pick up a stale id before this
+        if (count > 0)
+            clearSenderCache();
+    }
+    unlock();
+    return count;
+}
+
+
+Storage::State SqliteStorage::init(const QVariantMap &settings)
+{
+    State state = AbstractSqlStorage::init(settings);
+    if (state == IsReady)
+        initWalMode();
+    return state;
+}
+
+
+// Runs on the main thread before sessions or the backlog writer exist, so _walMode never changes
+// while another thread might hold or be about to release the lock.
+void SqliteStorage::initWalMode()
+{
+    // The journal mode is stored in the database file, so all further connections use it as well,
+    // and without --sqlite-wal we just ask for the current mode.
+    QSqlQuery query = logDb().exec(Quassel::isOptionSet("sqlite-wal") ? "PRAGMA journal_mode = WAL" : "PRAGMA journal_mode");
+    if (!watchQuery(query) || !query.first())
+        return;
+
+    _walMode = query.value(0).toString().toLower() == "wal";
+    if (_walMode)
+        quInfo() << "SQLite database is in WAL mode, readers no longer wait for writers";
+    else if (Quassel::isOptionSet("sqlite-wal"))
+        quWarning() << "Unable to switch SQLite database to WAL mode, falling back to locking the whole database";
+}
+
+
+void SqliteStorage::sync()
+{
+    if (!_walMode)
+        return;
+
+    // Move committed transactions from the WAL back into the database file, without waiting for readers
+    QSqlQuery query(logDb());
+    query.prepare("PRAGMA wal_checkpoint(PASSIVE)");
+    safeExec(query);
+    watchQuery(query);
+}
+
+
+void SqliteStorage::lockForWrite()
+{
+    _dbLock.lockForWrite();
+    _writeLockOwner.fetchAndStoreOrdered(QThread::currentThread());
+}
+
+
+void SqliteStorage::unlock()
+{
+    // Only the owner of the write lock can find itself in _writeLockOwner, every other caller holds a read lock
+    if (_writeLockOwner.testAndSetOrdered(QThread::currentThread(), 0))
+        _dbLock.unlock();
+    else if (!_walMode) // readers don't take the lock in WAL mode
+        _dbLock.unlock();
 }
 
 
@@ -1781,13 +2078,13 @@ bool SqliteMigrationReader::prepareQuery(MigrationObject mo)
         break;
     case Sender:
         newQuery(queryString("migrate_read_sender"), logDb());
-        bindValue(0, 0);
-        bindValue(1, stepSize());
+        bindValue(0, resumeId());
+        bindValue(1, resumeId() + stepSize());
         break;
     case Backlog:
         newQuery(queryString("migrate_read_backlog"), logDb());
-        bindValue(0, 0);
-        bindValue(1, stepSize());
+        bindValue(0, resumeId());
+        bindValue(1, resumeId() + stepSize());
         break;
     case IrcServer:
         newQuery(queryString("migrate_read_ircserver"), logDb());
@@ -23,9 +23,11 @@
 
 #include "abstractsqlstorage.h"
 
+#include <QAtomicPointer>
 #include <QSqlDatabase>
 
 class QSqlQuery;
+class QThread;
 
 class SqliteStorage : public AbstractSqlStorage
 {
@@ -45,6 +47,7 @@ public slots:
     virtual inline QStringList setupKeys() const { return QStringList(); }
     virtual inline QVariantMap setupDefaults() const { return QVariantMap(); }
     QString description() const;
+    virtual State init(const QVariantMap &settings = QVariantMap());
 
     // TODO: Add functions for configuring the backlog handling, i.e. defining auto-cleanup settings etc
 
@@ -100,8 +103,16 @@ public slots:
     /* Message handling */
     virtual bool logMessage(Message &msg);
     virtual bool logMessages(MessageList &msgs);
-    virtual QList<Message> requestMsgs(UserId user, BufferId bufferId, MsgId first = -1, MsgId last = -1, int limit = -1);
-    virtual QList<Message> requestAllMsgs(UserId user, MsgId first = -1, MsgId last = -1, int limit = -1);
+    virtual bool visitMsgs(UserId user, BufferId bufferId, MessageVisitor &visitor, MsgId first = -1, MsgId last = -1, int limit = -1);
+    virtual bool visitAllMsgs(UserId user, MessageVisitor &visitor, MsgId first = -1, MsgId last = -1, int limit = -1);
+    virtual bool searchMsgs(UserId user, const QString &query, BufferId bufferId, MessageVisitor &visitor, int offset, int limit);
+
+    virtual void setAsyncCommit(bool enabled);
+
+    virtual int expireMsgs(UserId user, const BufferInfo &buffer, const QDateTime &before, int keepCount, int batchSize, MessageVisitor *archive = 0);
+    virtual int removeUnusedSenders(int &senderId, int batchSize);
+
+    virtual void sync();
 
 protected:
     inline virtual void setConnectionProperties(const QVariantMap & /* properties */) {}
@@ -116,11 +127,18 @@ private:
     static QString backlogFile();
     void bindNetworkInfo(QSqlQuery &query, const NetworkInfo &info);
     void bindServerInfo(QSqlQuery &query, const Network::Server &server);
-
-    inline void lockForRead() { _dbLock.lockForRead(); }
-    inline void lockForWrite() { _dbLock.lockForWrite(); }
-    inline void unlock() { _dbLock.unlock(); }
+    // find or create the sender's id, ids not yet cached are added to newSenderIds. needs the write lock.
+    int senderId(QSqlDatabase &db, const QString &sender, QHash<QString, int> &newSenderIds);
+    void initWalMode();
+
+    // In WAL mode every reader works on a snapshot of its own connection and
+    // doesn't need to wait for anyone, so only writers are serialized.
+    inline void lockForRead() { if (!_walMode) _dbLock.lockForRead(); }
+    void lockForWrite();
+    void unlock(); // releases the write lock if the calling thread holds it, its read lock otherwise
     QReadWriteLock _dbLock;
+    QAtomicPointer<QThread> _writeLockOwner;
+    bool _walMode; // decided once in init(), before any other thread uses the storage
     static int _maxRetryCount;
 };
 
@@ -153,6 +171,7 @@ protected:
     virtual inline bool transaction() { return logDb().transaction(); }
     virtual inline void rollback() { logDb().rollback(); }
     virtual inline bool commit() { return logDb().commit(); }
+    virtual inline void closeThreadConnection() { removeConnectionFromPool(); }
 
 private:
     void setMaxId(MigrationObject mo);
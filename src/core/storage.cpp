@@ -27,11 +27,74 @@
 #    include "../../3rdparty/sha512/sha512.h"
 #endif
 
+namespace {
+
+// Collects all visited messages, used to implement the list-based request methods
+class MessageCollector : public MessageVisitor
+{
+public:
+    inline const QList<Message> &messages() const { return _messages; }
+
+protected:
+    bool visit(const MessageList &messages)
+    {
+        _messages << messages;
+        return true;
+    }
+
+private:
+    QList<Message> _messages;
+};
+
+}
+
+
+bool MessageVisitor::append(const Message &msg)
+{
+    if (_done)
+        return false;
+
+    _chunk << msg;
+    if (_chunk.count() >= _chunkSize)
+        return flush();
+    return true;
+}
+
+
+bool MessageVisitor::flush()
+{
+    if (_done)
+        return false;
+
+    if (!_chunk.isEmpty()) {
+        _done = !visit(_chunk);
+        _chunk.clear();
+    }
+    return !_done;
+}
+
+
 Storage::Storage(QObject *parent)
     : QObject(parent)
 {
 }
 
+
+QList<Message> Storage::requestMsgs(UserId user, BufferId bufferId, MsgId first, MsgId last, int limit)
+{
+    MessageCollector collector;
+    visitMsgs(user, bufferId, collector, first, last, limit);
+    return collector.messages();
+}
+
+
+QList<Message> Storage::requestAllMsgs(UserId user, MsgId first, MsgId last, int limit)
+{
+    MessageCollector collector;
+    visitAllMsgs(user, collector, first, last, limit);
+    return collector.messages();
+}
+
 QString Storage::hashPassword(const QString &password)
 {
     return hashPasswordSha2_512(password);
@@ -28,6 +28,42 @@
 #include "message.h"
 #include "network.h"
 
+//! Receives the result of a backlog query in chunks
+/** Storage backends feed the rows of a backlog query into a MessageVisitor one by one, while
+ *  stepping through the result set. The visitor collects them into chunks of at most
+ *  chunkSize() messages and hands each full chunk to visit(), so the memory needed for a
+ *  backlog request is bounded by the chunk size rather than by the size of the result.
+ */
+class MessageVisitor
+{
+public:
+    MessageVisitor(int chunkSize = 500) : _chunkSize(chunkSize), _done(false) {}
+    virtual ~MessageVisitor() {}
+
+    inline int chunkSize() const { return _chunkSize; }
+
+    //! Queue a message read from storage
+    /** \return false if the visitor does not want any more messages
+     */
+    bool append(const Message &msg);
+
+    //! Hand the remaining queued messages to visit()
+    /** Called by the storage backend once the query is exhausted. */
+    bool flush();
+
+protected:
+    //! Process a chunk of messages in the order they were returned by the query
+    /** \return false to stop fetching further rows
+     */
+    virtual bool visit(const MessageList &messages) = 0;
+
+private:
+    MessageList _chunk;
+    int _chunkSize;
+    bool _done;
+};
+
+
 class Storage : public QObject
 {
     Q_OBJECT
@@ -392,7 +428,7 @@ public slots:
      *  \param limit    if != -1 limit the returned list to a max of \limit entries
      *  \return The requested list of messages
      */
-    virtual QList<Message> requestMsgs(UserId user, BufferId bufferId, MsgId first = -1, MsgId last = -1, int limit = -1) = 0;
+    virtual QList<Message> requestMsgs(UserId user, BufferId bufferId, MsgId first = -1, MsgId last = -1, int limit = -1);
 
     //! Request a certain number of messages across all buffers
     /** \param first    if != -1 return only messages with a MsgId >= first
@@ -400,7 +436,75 @@ public slots:
      *  \param limit    Max amount of messages
      *  \return The requested list of messages
      */
-    virtual QList<Message> requestAllMsgs(UserId user, MsgId first = -1, MsgId last = -1, int limit = -1) = 0;
+    virtual QList<Message> requestAllMsgs(UserId user, MsgId first = -1, MsgId last = -1, int limit = -1);
+
+public:
+    //! Stream a certain number messages stored in a given buffer into a visitor.
+    /** Same semantics as requestMsgs(), but the messages are handed to the visitor in chunks
+     *  while the result set is being read instead of being collected in a list.
+     *  \param visitor  The visitor receiving the messages
+     *  \return true if the query succeeded, even if the visitor stopped it early
+     */
+    virtual bool visitMsgs(UserId user, BufferId bufferId, MessageVisitor &visitor, MsgId first = -1, MsgId last = -1, int limit = -1) = 0;
+
+    //! Stream a certain number of messages across all buffers into a visitor.
+    /** Same semantics as requestAllMsgs(), see visitMsgs().
+     *  \param visitor  The visitor receiving the messages
+     *  \return true if the query succeeded, even if the visitor stopped it early
+     */
+    virtual bool visitAllMsgs(UserId user, MessageVisitor &visitor, MsgId first = -1, MsgId last = -1, int limit = -1) = 0;
+
+    //! Stream the messages matching a full-text search into a visitor
+    /** The words of \p query are matched against the message text. The matching
+     *  messages are ordered by relevance where the backend can rank them, newest first otherwise.
+     *  \note This method is threadsafe.
+     *
+     *  \param user      The owner of the messages
+     *  \param query     The words to search for, all of them have to match
+     *  \param bufferId  If valid, only messages of this buffer are searched
+     *  \param visitor   The visitor receiving the matching messages
+     *  \param offset    Number of matches to skip, for paging through the results
+     *  \param limit     Max amount of messages
+     *  \return true if the query succeeded, even if it matched nothing
+     */
+    virtual bool searchMsgs(UserId user, const QString &query, BufferId bufferId, MessageVisitor &visitor, int offset, int limit) = 0;
+
+    //! Trade durability of commits for throughput
+    /** With async commits enabled, a transaction may be reported as committed before it has
+     *  reached the disk. A crash of the OS may then lose the latest transactions, but never
+     *  leaves the database inconsistent.
+     *  \note Only affects the database connection of the calling thread.
+     *  \param enabled  Whether commits of the calling thread are asynchronous
+     */
+    virtual void setAsyncCommit(bool enabled) { Q_UNUSED(enabled) }
+
+    //! Delete a batch of expired messages from a buffer
+    /** A message is expired if it is older than \p before, or if it is not among the \p keepCount
+     *  newest messages of its buffer. Only the oldest \p batchSize expired messages are deleted
+     *  per call, so a large cleanup can be spread over many short transactions.
+     *  \note This method is threadsafe.
+     *
+     *  \param user       The owner of the buffer
+     *  \param buffer     The buffer to clean up
+     *  \param before     Messages older than this are expired. Ignored if invalid.
+     *  \param keepCount  Number of newest messages to keep. Ignored if 0.
+     *  \param batchSize  Maximum number of messages to delete
+     *  \param archive    If given, receives the expired messages before they are deleted. Nothing is
+     *                    deleted if it refuses them.
+     *  \return The number of deleted messages, or -1 on error
+     */
+    virtual int expireMsgs(UserId user, const BufferInfo &buffer, const QDateTime &before, int keepCount, int batchSize, MessageVisitor *archive = 0) = 0;
+
+    //! Delete the senders of a batch that are no longer referenced by any message
+    /** Checks the next \p batchSize senders with an id greater than \p senderId and deletes the
+     *  unreferenced ones. The default implementation does nothing.
+     *  \note This method is threadsafe.
+     *  \param senderId   The last sender checked by the previous batch, 0 to start. Is set to the last
+     *                    sender checked by this batch, and left unchanged once all senders are checked.
+     *  \param batchSize  Maximum number of senders to check
+     *  \return The number of deleted senders, or -1 on error
+     */
+    virtual int removeUnusedSenders(int &senderId, int batchSize) { Q_UNUSED(senderId) Q_UNUSED(batchSize) return 0; }
 
 signals:
     //! Sent when a new BufferInfo is created, or an existing one changed somehow.
@@ -134,6 +134,7 @@
 #include "settingspages/aliasessettingspage.h"
 #include "settingspages/appearancesettingspage.h"
 #include "settingspages/backlogsettingspage.h"
+#include "settingspages/backlogretentionsettingspage.h"
 #include "settingspages/bufferviewsettingspage.h"
 #include "settingspages/chatmonitorsettingspage.h"
 #include "settingspages/chatviewsettingspage.h"
@@ -1375,6 +1376,7 @@ void MainWin::showSettingsDlg()
     dlg->registerSettingsPage(new ConnectionSettingsPage(dlg));
     dlg->registerSettingsPage(new IdentitiesSettingsPage(dlg));
     dlg->registerSettingsPage(new NetworksSettingsPage(dlg));
+    dlg->registerSettingsPage(new BacklogRetentionSettingsPage(dlg));
     dlg->registerSettingsPage(new AliasesSettingsPage(dlg));
     dlg->registerSettingsPage(new IgnoreListSettingsPage(dlg));
 
@@ -0,0 +1,108 @@
+/***************************************************************************
+ *   Copyright (C) 2005-2015 by the Quassel Project                        *
+ *   devel@quassel-irc.org                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include "backlogretentionsettingspage.h"
+
+#include "client.h"
+#include "clientbacklogmanager.h"
+
+BacklogRetentionSettingsPage::BacklogRetentionSettingsPage(QWidget *parent)
+    : SettingsPage(tr("IRC"), tr("Backlog Retention"), parent)
+{
+    ui.setupUi(this);
+    initAutoWidgets();
+
+    connect(Client::instance(), SIGNAL(connected()), this, SLOT(clientConnected()));
+    connect(Client::instance(), SIGNAL(disconnected()), this, SLOT(clientDisconnected()));
+    connect(Client::backlogManager(), SIGNAL(backlogRetentionReceived(QVariantMap)), this, SLOT(rulesReceived(QVariantMap)));
+
+    setEnabled(false);
+    if (Client::isConnected())
+        clientConnected();
+}
+
+
+void BacklogRetentionSettingsPage::clientConnected()
+{
+    // older cores neither answer the request nor expire anything
+    if (Client::coreFeatures() & Quassel::BacklogRetentionRules)
+        Client::backlogManager()->requestBacklogRetention();
+}
+
+
+void BacklogRetentionSettingsPage::clientDisconnected()
+{
+    setEnabled(false);
+    setChangedState(false);
+    _rules.clear();
+}
+
+
+void BacklogRetentionSettingsPage::rulesReceived(const QVariantMap &rules)
+{
+    _rules = rules;
+    setEnabled(true);
+    load();
+}
+
+
+bool BacklogRetentionSettingsPage::hasDefaults() const
+{
+    return true;
+}
+
+
+void BacklogRetentionSettingsPage::save()
+{
+    SettingsPage::save();
+    if (isEnabled())
+        Client::backlogManager()->requestSetBacklogRetention(_rules);
+}
+
+
+QVariant BacklogRetentionSettingsPage::loadAutoWidgetValue(const QString &widgetName)
+{
+    if (!isEnabled())
+        return QVariant();
+    QVariantMap defaultRule = _rules["Default"].toMap();
+    if (widgetName == "maxAge")
+        return defaultRule["MaxAge"].toInt();
+    if (widgetName == "maxCount")
+        return defaultRule["MaxCount"].toInt();
+
+    return SettingsPage::loadAutoWidgetValue(widgetName);
+}
+
+
+void BacklogRetentionSettingsPage::saveAutoWidgetValue(const QString &widgetName, const QVariant &value)
+{
+    if (!isEnabled())
+        return;
+    QVariantMap defaultRule = _rules["Default"].toMap();
+    if (widgetName == "maxAge")
+        defaultRule["MaxAge"] = value.toInt();
+    else if (widgetName == "maxCount")
+        defaultRule["MaxCount"] = value.toInt();
+    else {
+        SettingsPage::saveAutoWidgetValue(widgetName, value);
+        return;
+    }
+    _rules["Default"] = defaultRule;
+}
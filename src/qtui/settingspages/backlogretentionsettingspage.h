@@ -0,0 +1,58 @@
+/***************************************************************************
+ *   Copyright (C) 2005-2015 by the Quassel Project                        *
+ *   devel@quassel-irc.org                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef BACKLOGRETENTIONSETTINGSPAGE_H_
+#define BACKLOGRETENTIONSETTINGSPAGE_H_
+
+#include "settingspage.h"
+
+#include "ui_backlogretentionsettingspage.h"
+
+//! Edits the default rule of the core's backlog retention
+/** Network and buffer rules the user set up by other means are kept as they are.
+ */
+class BacklogRetentionSettingsPage : public SettingsPage
+{
+    Q_OBJECT
+
+public:
+    BacklogRetentionSettingsPage(QWidget *parent = 0);
+
+    bool hasDefaults() const;
+    bool needsCoreConnection() const { return true; }
+
+public slots:
+    void save();
+
+private slots:
+    void clientConnected();
+    void clientDisconnected();
+    void rulesReceived(const QVariantMap &rules);
+
+private:
+    QVariant loadAutoWidgetValue(const QString &widgetName);
+    void saveAutoWidgetValue(const QString &widgetName, const QVariant &value);
+
+    Ui::BacklogRetentionSettingsPage ui;
+    QVariantMap _rules;
+};
+
+
+#endif
@@ -5,6 +5,7 @@ set(SETTINGSPAGES
     aliases
     appearance
     backlog
+    backlogretention
     bufferview
     chatmonitor
     chatview